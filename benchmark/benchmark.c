@@ -0,0 +1,683 @@
+/*
+ * Loopback load generator.
+ *
+ * Starts a server and a number of simulated clients which send timestamped
+ * messages at a fixed rate.  The server echoes every message, so clients
+ * can measure round trip times.  Server and clients may also run in
+ * separate processes, e.g. one server and several client processes:
+ *
+ *   benchmark --mode server --duration 30
+ *   benchmark --mode clients --clients 200 --host 127.0.0.1
+ *
+ * Run with --help for all options.
+ */
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h> // printf, fprintf
+#include <stdlib.h> // malloc, free, qsort, strtol, strtod
+#include <string.h> // memset, memcpy, strcmp
+#include <time.h> // clock
+#include <enet/enet.h>
+#include <enet_mp.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h> // usleep
+#endif
+
+
+typedef enum _Mode
+{
+    MODE_ALL,
+    MODE_SERVER,
+    MODE_CLIENTS
+} Mode;
+
+typedef struct _Options
+{
+    Mode mode;
+    const char* host;
+    int port;
+    int client_count;
+    int message_size;
+    int send_rate; // Messages per second and client.
+    int channel_count;
+    int reliable_percentage;
+    int duration; // Seconds of sending after all clients connected.
+    int batch_messages;
+    int threaded;
+    int shard_count;
+} Options;
+
+enum
+{
+    WELCOME_MESSAGE,
+    ECHO_MESSAGE
+};
+
+// Every message starts with this header and is padded to the message size.
+typedef struct _MessageHeader
+{
+    enet_uint8 type;
+    enet_uint8 padding[7];
+    double send_time;
+} MessageHeader;
+
+typedef struct _Samples
+{
+    double* values;
+    int count;
+    int capacity;
+} Samples;
+
+typedef struct _Counters
+{
+    unsigned long long sent_packets;
+    unsigned long long sent_bytes;
+    unsigned long long received_packets;
+    unsigned long long received_bytes;
+} Counters;
+
+typedef struct _BenchmarkClient
+{
+    ENetMpClient* client;
+    int welcomed;
+    int disconnected;
+    double next_send_time;
+    unsigned int sequence;
+} BenchmarkClient;
+
+static Options options;
+static char* message_buffer;
+
+static Counters server_counters;
+static Counters client_counters;
+static Samples round_trip_times;
+static int welcomed_client_count;
+static int connecting_client_count;
+static double last_welcome_time;
+
+// ENet allocates on the network threads too.
+static atomic_ullong allocation_count;
+static atomic_ullong free_count;
+
+
+static double get_time( void )
+{
+#if defined(_WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if(frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+#endif
+}
+
+static void sleep_briefly( void )
+{
+#if defined(_WIN32)
+    Sleep(1);
+#else
+    usleep(1000);
+#endif
+}
+
+static double get_cpu_time( void )
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void* counting_malloc( size_t size )
+{
+    atomic_fetch_add_explicit(&allocation_count, 1, memory_order_relaxed);
+    return malloc(size);
+}
+
+static void counting_free( void* memory )
+{
+    if(memory)
+        atomic_fetch_add_explicit(&free_count, 1, memory_order_relaxed);
+    free(memory);
+}
+
+static void no_memory( void )
+{
+    fprintf(stderr, "Out of memory\n");
+    abort();
+}
+
+static void add_sample( Samples* samples, double value )
+{
+    if(samples->count == samples->capacity)
+    {
+        samples->capacity = samples->capacity ? samples->capacity*2 : 4096;
+        samples->values = (double*)realloc(samples->values,
+                                           samples->capacity * sizeof(double));
+    }
+    samples->values[samples->count++] = value;
+}
+
+static int compare_doubles( const void* a, const void* b )
+{
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double get_percentile( const Samples* samples, double percentile )
+{
+    if(samples->count == 0)
+        return 0;
+    int index = (int)(percentile / 100.0 * samples->count);
+    if(index >= samples->count)
+        index = samples->count - 1;
+    return samples->values[index];
+}
+
+static void count_packet( Counters* counters, int sent, int size )
+{
+    if(sent)
+    {
+        counters->sent_packets++;
+        counters->sent_bytes += size;
+    }
+    else
+    {
+        counters->received_packets++;
+        counters->received_bytes += size;
+    }
+}
+
+static enet_uint32 get_message_flags( unsigned int sequence )
+{
+    if((int)(sequence % 100) < options.reliable_percentage)
+        return ENET_PACKET_FLAG_RELIABLE;
+    else
+        return 0;
+}
+
+// ---- Server ----
+
+static void server_send( ENetMpServer* server,
+                         int client_slot,
+                         int channel,
+                         const void* data,
+                         int size,
+                         enet_uint32 flags )
+{
+    if(options.batch_messages)
+    {
+        enet_mp_server_queue_message(server, client_slot, channel, data, size, flags);
+    }
+    else
+    {
+        ENetPacket* packet = enet_mp_server_acquire_packet(server, size, flags);
+        memcpy(packet->data, data, size);
+        enet_mp_server_send(server, client_slot, channel, packet);
+    }
+    count_packet(&server_counters, 1, size);
+}
+
+static void client_connecting( ENetMpServer* server,
+                               int client_slot,
+                               const void* auth_data,
+                               int auth_data_size )
+{
+    MessageHeader* header = (MessageHeader*)message_buffer;
+    header->type = WELCOME_MESSAGE;
+    header->send_time = 0;
+    server_send(server,
+                client_slot,
+                0,
+                message_buffer,
+                sizeof(MessageHeader),
+                ENET_PACKET_FLAG_RELIABLE);
+}
+
+static void client_disconnected( ENetMpServer* server,
+                                 int client_slot,
+                                 ENetMpDisconnectReason reason )
+{
+}
+
+static void client_sent_packet( ENetMpServer* server,
+                                int client_slot,
+                                int channel,
+                                const ENetPacket* packet )
+{
+    count_packet(&server_counters, 0, (int)packet->dataLength);
+    server_send(server,
+                client_slot,
+                channel,
+                packet->data,
+                (int)packet->dataLength,
+                packet->flags & ENET_PACKET_FLAG_RELIABLE);
+}
+
+static ENetMpServer* create_server( void )
+{
+    ENetMpServerConfiguration config;
+    memset(&config, 0, sizeof(config));
+    config.address.host = ENET_HOST_ANY;
+    config.address.port = (enet_uint16)options.port;
+    config.channel_count = options.channel_count;
+    config.max_clients = options.client_count > 0 ? options.client_count : 1;
+    config.batch_messages = options.batch_messages;
+    config.threaded = options.threaded;
+    config.shard_count = options.shard_count;
+    // All clients connect from the same address at once.
+    config.connect_rate_limit = config.max_clients;
+    config.callbacks.client_connecting = client_connecting;
+    config.callbacks.client_disconnected = client_disconnected;
+    config.callbacks.client_sent_packet = client_sent_packet;
+    return enet_mp_server_create(&config);
+}
+
+// ---- Clients ----
+
+static void client_send( BenchmarkClient* c, double time )
+{
+    const unsigned int sequence = c->sequence++;
+    const int channel = (int)(sequence % (unsigned int)options.channel_count);
+    const enet_uint32 flags = get_message_flags(sequence);
+    const int size = options.message_size;
+
+    MessageHeader* header = (MessageHeader*)message_buffer;
+    header->type = ECHO_MESSAGE;
+    header->send_time = time;
+
+    if(options.batch_messages)
+    {
+        enet_mp_client_queue_message(c->client, channel, message_buffer, size, flags);
+    }
+    else
+    {
+        ENetPacket* packet = enet_mp_client_acquire_packet(c->client, size, flags);
+        memcpy(packet->data, message_buffer, size);
+        enet_mp_client_send(c->client, channel, packet);
+    }
+    count_packet(&client_counters, 1, size);
+}
+
+static void disconnected( ENetMpClient* client, ENetMpDisconnectReason reason )
+{
+    BenchmarkClient* c = (BenchmarkClient*)enet_mp_client_get_user_data(client);
+    c->disconnected = 1;
+}
+
+static void received_packet( ENetMpClient* client,
+                             int channel,
+                             const ENetPacket* packet )
+{
+    BenchmarkClient* c = (BenchmarkClient*)enet_mp_client_get_user_data(client);
+    if(packet->dataLength < sizeof(MessageHeader))
+        return;
+    count_packet(&client_counters, 0, (int)packet->dataLength);
+
+    MessageHeader header;
+    memcpy(&header, packet->data, sizeof(header));
+    const double time = get_time();
+    switch(header.type)
+    {
+        case WELCOME_MESSAGE:
+            c->welcomed = 1;
+            c->next_send_time = time;
+            welcomed_client_count++;
+            last_welcome_time = time;
+            break;
+
+        case ECHO_MESSAGE:
+            add_sample(&round_trip_times, time - header.send_time);
+            break;
+    }
+}
+
+static BenchmarkClient* create_clients( void )
+{
+    ENetAddress address;
+    if(enet_address_set_host(&address, options.host) != 0)
+        return NULL;
+    address.port = (enet_uint16)options.port;
+
+    BenchmarkClient* clients =
+        (BenchmarkClient*)calloc(options.client_count, sizeof(BenchmarkClient));
+    int i = 0;
+    for(; i < options.client_count; i++)
+    {
+        ENetMpClientConfiguration config;
+        memset(&config, 0, sizeof(config));
+        config.user_data = &clients[i];
+        config.server_address = address;
+        config.channel_count = options.channel_count;
+        config.batch_messages = options.batch_messages;
+        config.shard_count = options.shard_count;
+        config.callbacks.disconnected = disconnected;
+        config.callbacks.received_packet = received_packet;
+        clients[i].client = enet_mp_client_create(&config);
+        if(!clients[i].client)
+        {
+            fprintf(stderr, "Can't create client %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+        connecting_client_count++;
+    }
+    return clients;
+}
+
+static void destroy_clients( BenchmarkClient* clients )
+{
+    int i = 0;
+    for(; i < options.client_count; i++)
+        enet_mp_client_destroy(clients[i].client);
+    free(clients);
+}
+
+static void service_clients( BenchmarkClient* clients, int sending )
+{
+    const double interval = options.send_rate > 0 ? 1.0 / options.send_rate : 0;
+    int i = 0;
+    for(; i < options.client_count; i++)
+    {
+        BenchmarkClient* c = &clients[i];
+        if(c->disconnected)
+            continue;
+
+        enet_mp_client_service_all(c->client, 0, 0, 0);
+
+        if(!sending || !c->welcomed || options.send_rate <= 0)
+            continue;
+        const double time = get_time();
+        // Catch up if servicing fell behind, but don't send a huge burst.
+        if(time - c->next_send_time > 1.0)
+            c->next_send_time = time;
+        while(c->next_send_time <= time)
+        {
+            client_send(c, time);
+            c->next_send_time += interval;
+        }
+        if(options.batch_messages)
+            enet_mp_client_flush_messages(c->client);
+    }
+}
+
+// ---- Report ----
+
+static void print_rate( const char* name,
+                        unsigned long long value,
+                        double seconds,
+                        double cpu_seconds )
+{
+    printf("  %-18s %14.0f/s %14.0f/cpu-s\n",
+           name,
+           seconds > 0 ? value / seconds : 0.0,
+           cpu_seconds > 0 ? value / cpu_seconds : 0.0);
+}
+
+static void print_counters( const char* name,
+                            const Counters* counters,
+                            double seconds,
+                            double cpu_seconds )
+{
+    printf("%s:\n", name);
+    print_rate("sent packets", counters->sent_packets, seconds, cpu_seconds);
+    print_rate("sent bytes", counters->sent_bytes, seconds, cpu_seconds);
+    print_rate("received packets", counters->received_packets, seconds, cpu_seconds);
+    print_rate("received bytes", counters->received_bytes, seconds, cpu_seconds);
+}
+
+static void print_report( double connect_seconds,
+                          double seconds,
+                          double cpu_seconds,
+                          unsigned long long allocations )
+{
+    printf("clients=%d message_size=%d send_rate=%d channels=%d reliable=%d%% "
+           "batch=%d threaded=%d shards=%d\n",
+           options.client_count,
+           options.message_size,
+           options.send_rate,
+           options.channel_count,
+           options.reliable_percentage,
+           options.batch_messages,
+           options.threaded,
+           options.shard_count);
+
+    if(options.mode != MODE_SERVER)
+    {
+        printf("connect: %d/%d clients in %.3f s (%.1f/s)\n",
+               welcomed_client_count,
+               options.client_count,
+               connect_seconds,
+               connect_seconds > 0 ? welcomed_client_count / connect_seconds : 0.0);
+
+        Samples* rtt = &round_trip_times;
+        qsort(rtt->values, rtt->count, sizeof(double), compare_doubles);
+        printf("round trip: samples=%d p50=%.3f ms p90=%.3f ms p99=%.3f ms "
+               "p99.9=%.3f ms max=%.3f ms\n",
+               rtt->count,
+               get_percentile(rtt, 50) * 1000,
+               get_percentile(rtt, 90) * 1000,
+               get_percentile(rtt, 99) * 1000,
+               get_percentile(rtt, 99.9) * 1000,
+               get_percentile(rtt, 100) * 1000);
+    }
+
+    printf("measured %.2f s wall time, %.2f s cpu time\n", seconds, cpu_seconds);
+    if(options.mode != MODE_CLIENTS)
+        print_counters("server", &server_counters, seconds, cpu_seconds);
+    if(options.mode != MODE_SERVER)
+        print_counters("clients", &client_counters, seconds, cpu_seconds);
+
+    const unsigned long long packets = server_counters.sent_packets +
+                                       server_counters.received_packets +
+                                       client_counters.sent_packets +
+                                       client_counters.received_packets;
+    printf("enet allocations: %llu (%.2f per packet), %llu still alive\n",
+           allocations,
+           packets > 0 ? (double)allocations / packets : 0.0,
+           atomic_load(&allocation_count) - atomic_load(&free_count));
+}
+
+// ---- Main ----
+
+static void print_usage( const char* program )
+{
+    printf("Usage: %s [options]\n"
+           "  --mode all|server|clients  Processes to simulate (default all)\n"
+           "  --host NAME                Server host for client mode (default 127.0.0.1)\n"
+           "  --port N                   Server port (default 7777)\n"
+           "  --clients N                Number of clients (default 64)\n"
+           "  --size N                   Message size in bytes (default 64)\n"
+           "  --rate N                   Messages per second and client (default 30)\n"
+           "  --channels N               Messages are spread over N channels (default 1)\n"
+           "  --reliable N               Percentage of reliable messages (default 100)\n"
+           "  --duration N               Seconds to send (default 10)\n"
+           "  --batch                    Batch messages\n"
+           "  --threaded                 Use a network thread on the server\n"
+           "  --shards N                 Server shards (default 1)\n",
+           program);
+}
+
+static void parse_options( int argc, char** argv )
+{
+    options.mode = MODE_ALL;
+    options.host = "127.0.0.1";
+    options.port = 7777;
+    options.client_count = 64;
+    options.message_size = 64;
+    options.send_rate = 30;
+    options.channel_count = 1;
+    options.reliable_percentage = 100;
+    options.duration = 10;
+    options.shard_count = 1;
+
+    int i = 1;
+    for(; i < argc; i++)
+    {
+        const char* option = argv[i];
+        const char* value = i+1 < argc ? argv[i+1] : NULL;
+        int* int_value = NULL;
+
+        if(strcmp(option, "--batch") == 0)
+            options.batch_messages = 1;
+        else if(strcmp(option, "--threaded") == 0)
+            options.threaded = 1;
+        else if(strcmp(option, "--help") == 0)
+        {
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        else if(!value)
+        {
+            fprintf(stderr, "Unknown option or missing value: %s\n", option);
+            exit(EXIT_FAILURE);
+        }
+        else if(strcmp(option, "--mode") == 0)
+        {
+            if(strcmp(value, "all") == 0)
+                options.mode = MODE_ALL;
+            else if(strcmp(value, "server") == 0)
+                options.mode = MODE_SERVER;
+            else if(strcmp(value, "clients") == 0)
+                options.mode = MODE_CLIENTS;
+            else
+            {
+                fprintf(stderr, "Unknown mode: %s\n", value);
+                exit(EXIT_FAILURE);
+            }
+            i++;
+        }
+        else if(strcmp(option, "--host") == 0)
+        {
+            options.host = value;
+            i++;
+        }
+        else if(strcmp(option, "--port") == 0)
+            int_value = &options.port;
+        else if(strcmp(option, "--clients") == 0)
+            int_value = &options.client_count;
+        else if(strcmp(option, "--size") == 0)
+            int_value = &options.message_size;
+        else if(strcmp(option, "--rate") == 0)
+            int_value = &options.send_rate;
+        else if(strcmp(option, "--channels") == 0)
+            int_value = &options.channel_count;
+        else if(strcmp(option, "--reliable") == 0)
+            int_value = &options.reliable_percentage;
+        else if(strcmp(option, "--duration") == 0)
+            int_value = &options.duration;
+        else if(strcmp(option, "--shards") == 0)
+            int_value = &options.shard_count;
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", option);
+            exit(EXIT_FAILURE);
+        }
+
+        if(int_value)
+        {
+            *int_value = (int)strtol(value, NULL, 10);
+            i++;
+        }
+    }
+
+    if(options.message_size < (int)sizeof(MessageHeader))
+        options.message_size = (int)sizeof(MessageHeader);
+    if(options.channel_count < 1)
+        options.channel_count = 1;
+    if(options.shard_count < 1)
+        options.shard_count = 1;
+}
+
+int main( int argc, char** argv )
+{
+    parse_options(argc, argv);
+
+    ENetCallbacks callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.malloc = counting_malloc;
+    callbacks.free = counting_free;
+    callbacks.no_memory = no_memory;
+    if(enet_initialize_with_callbacks(ENET_VERSION, &callbacks) != 0)
+    {
+        fprintf(stderr, "Can't initialize ENet\n");
+        return EXIT_FAILURE;
+    }
+
+    message_buffer = (char*)calloc(options.message_size, 1);
+
+    ENetMpServer* server = NULL;
+    if(options.mode != MODE_CLIENTS)
+    {
+        server = create_server();
+        if(!server)
+        {
+            fprintf(stderr, "Can't create server\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    BenchmarkClient* clients = NULL;
+    const double connect_start_time = get_time();
+    if(options.mode != MODE_SERVER)
+    {
+        clients = create_clients();
+        if(!clients)
+        {
+            fprintf(stderr, "Can't resolve %s\n", options.host);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Connect phase: wait until every client has been welcomed.
+    const double connect_timeout = 10.0 + options.client_count * 0.01;
+    while(options.mode != MODE_SERVER &&
+          welcomed_client_count < options.client_count &&
+          get_time() - connect_start_time < connect_timeout)
+    {
+        if(server)
+            enet_mp_server_poll(server);
+        service_clients(clients, 0);
+    }
+    const double connect_seconds = last_welcome_time > 0 ?
+                                   last_welcome_time - connect_start_time : 0;
+
+    // Measurement phase.
+    memset(&server_counters, 0, sizeof(server_counters));
+    memset(&client_counters, 0, sizeof(client_counters));
+    const unsigned long long start_allocations = atomic_load(&allocation_count);
+    const double start_time = get_time();
+    const double start_cpu_time = get_cpu_time();
+    const double end_time = start_time + options.duration;
+    while(get_time() < end_time)
+    {
+        if(server)
+            enet_mp_server_poll(server);
+        if(clients)
+            service_clients(clients, 1);
+        else if(options.threaded)
+            sleep_briefly();
+    }
+    const double seconds = get_time() - start_time;
+    const double cpu_seconds = get_cpu_time() - start_cpu_time;
+
+    print_report(connect_seconds,
+                 seconds,
+                 cpu_seconds,
+                 atomic_load(&allocation_count) - start_allocations);
+
+    if(clients)
+        destroy_clients(clients);
+    if(server)
+        enet_mp_server_destroy(server);
+    free(round_trip_times.values);
+    free(message_buffer);
+    enet_deinitialize();
+    return EXIT_SUCCESS;
+}
@@ -1,11 +1,13 @@
 #include <string.h> // strcmp
 #include "shared.h"
 
-int is_running = 1;
+static const int TICK_RATE = 1;
+
+ENetMpServer* server = NULL;
 
 void stop()
 {
-    is_running = 0;
+    enet_mp_server_stop(server);
 }
 
 void client_connecting( ENetMpServer* server,
@@ -28,6 +30,12 @@ void client_disconnected( ENetMpServer* server,
            reason);
 }
 
+void tick( ENetMpServer* server, unsigned long long number )
+{
+    printf(".");
+    fflush(stdout);
+}
+
 void client_sent_packet( ENetMpServer* server,
                          int client_slot,
                          int channel,
@@ -49,21 +57,18 @@ int main()
     config.address.host = ENET_HOST_ANY;
     config.address.port = PORT;
     config.max_clients = 32;
+    config.tick_rate = TICK_RATE;
     config.callbacks.client_connecting = client_connecting;
     config.callbacks.client_disconnected = client_disconnected;
     config.callbacks.client_sent_packet = client_sent_packet;
+    config.callbacks.tick = tick;
 
-    ENetMpServer* server = enet_mp_server_create(&config);
+    server = enet_mp_server_create(&config);
     assert(server);
 
     signal(SIGTERM, stop);
     signal(SIGINT, stop);
-    while(is_running)
-    {
-        printf(".");
-        fflush(stdout);
-        enet_mp_server_service(server, SERVICE_TIMEOUT);
-    }
+    enet_mp_server_run(server);
 
     enet_mp_server_destroy(server);
     printf("\nstopped\n");
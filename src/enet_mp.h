@@ -57,9 +57,104 @@ typedef enum _ENetMpDisconnectReason
     ENET_MP_DISCONNECT_AUTH_FAILURE,
     ENET_MP_DISCONNECT_SERVER_SHUTDOWN,
     ENET_MP_DISCONNECT_SERVER_FULL,
-    ENET_MP_DISCONNECT_REPLY_TIMEOUT
+    ENET_MP_DISCONNECT_REPLY_TIMEOUT,
+    ENET_MP_DISCONNECT_RATE_LIMITED,
+    ENET_MP_DISCONNECT_SESSION_EXPIRED,
+    ENET_MP_DISCONNECT_REASON_COUNT
 } ENetMpDisconnectReason;
 
+/**
+ * Types of synced variables.
+ *
+ * Integers and floats are converted to network byte order on the wire,
+ * blobs are sent as they are.
+ */
+typedef enum _ENetMpVariableType
+{
+    ENET_MP_VARIABLE_INT8,
+    ENET_MP_VARIABLE_INT16,
+    ENET_MP_VARIABLE_INT32,
+    ENET_MP_VARIABLE_FLOAT,
+    ENET_MP_VARIABLE_BLOB
+} ENetMpVariableType;
+
+/**
+ * Log levels ordered by verbosity.
+ */
+typedef enum _ENetMpLogLevel
+{
+    ENET_MP_LOG_OFF,
+    ENET_MP_LOG_ERROR,
+    ENET_MP_LOG_WARNING,
+    ENET_MP_LOG_INFO,
+    ENET_MP_LOG_DEBUG,
+    ENET_MP_LOG_TRACE // Logs every single packet.
+} ENetMpLogLevel;
+
+/**
+ * Log categories, which may be combined into a bit mask.
+ */
+typedef enum _ENetMpLogCategory
+{
+    ENET_MP_LOG_CATEGORY_CONNECTION = 1 << 0,
+    ENET_MP_LOG_CATEGORY_PACKET     = 1 << 1,
+    ENET_MP_LOG_CATEGORY_PROTOCOL   = 1 << 2,
+    ENET_MP_LOG_CATEGORY_ALL        = 0xFF
+} ENetMpLogCategory;
+
+typedef void (*ENetMpLogSink)( void* user_data,
+                               ENetMpLogLevel level,
+                               ENetMpLogCategory category,
+                               const char* message );
+
+/**
+ * Log messages are only formatted if a sink is set and their level and
+ * category are enabled.
+ *
+ * Messages above the compile time level `ENET_MP_MAX_LOG_LEVEL` are
+ * removed from the library entirely.
+ */
+typedef struct _ENetMpLogConfiguration
+{
+    /**
+     * Receives the formatted log messages.  Logging is disabled if `NULL`.
+     */
+    ENetMpLogSink sink;
+
+    /**
+     * Passed to the sink.
+     */
+    void* user_data;
+
+    /**
+     * Most verbose level that is logged.
+     */
+    ENetMpLogLevel level;
+
+    /**
+     * Bit mask of #ENetMpLogCategory values or 0 for all categories.
+     */
+    int categories;
+
+} ENetMpLogConfiguration;
+
+/**
+ * Server information returned by queries.
+ */
+typedef struct _ENetMpServerInformation
+{
+    int free_client_slots;
+    int used_client_slots;
+
+    /**
+     * Information set with #enet_mp_server_set_information or `NULL`.
+     * Points into the reply which was parsed.
+     */
+    const void* user_data;
+    int user_data_size;
+
+} ENetMpServerInformation;
+
 /**
  * Local server instance.
  *
@@ -77,6 +172,10 @@ typedef struct _ENetMpServerCallbacks
      * If e.g. the authentication failed use #enet_mp_server_disconnect_client
      * with #ENET_MP_DISCONNECT_AUTH_FAILURE.
      *
+     * With ENetMpServerConfiguration::deferred_auth the client is not
+     * accepted when the callback returns.  Instead the decision is passed
+     * to #enet_mp_server_accept_client or #enet_mp_server_reject_client.
+     *
      * @param auth_data
      * Contains the data which was set by the client in its
      * #ENetMpClientConfiguration or `NULL`.
@@ -88,6 +187,9 @@ typedef struct _ENetMpServerCallbacks
 
     /**
      * Callback which is triggered when a client disconnected.
+     *
+     * For clients whose connection dropped while sessions are enabled,
+     * this happens once the session timeout elapsed without a resume.
      */
     void (*client_disconnected)( ENetMpServer* server,
                                  int client_slot,
@@ -97,15 +199,282 @@ typedef struct _ENetMpServerCallbacks
      * Callback which is triggered when the server received a packet from a client.
      *
      * The packet is destroyed after this call, so you don't need to destroy it
-     * yourself.
+     * yourself.  Use #enet_mp_packet_retain to keep it alive.
      */
     void (*client_sent_packet)( ENetMpServer* server,
                                 int client_slot,
                                 int channel,
                                 const ENetPacket* packet );
 
+    /**
+     * Optional callback which is triggered at the end of each service call
+     * in which #client_connecting was triggered in deferred auth mode.
+     *
+     * Allows verifying all requests of a service call with a single request
+     * to the auth backend.
+     */
+    void (*client_auth_batch_complete)( ENetMpServer* server );
+
+    /**
+     * Optional callback which is triggered when the connection of an
+     * active client dropped and its slot is kept for a resume.
+     *
+     * Nothing can be sent to the client until it resumed.
+     */
+    void (*client_suspended)( ENetMpServer* server, int client_slot );
+
+    /**
+     * Optional callback which is triggered when a suspended client
+     * reconnected and got its slot back.
+     */
+    void (*client_resumed)( ENetMpServer* server, int client_slot );
+
+    /**
+     * Callback which is triggered once per tick by #enet_mp_server_run.
+     * Everything sent during the tick is flushed right after it.
+     *
+     * @param tick
+     * Counts from zero.  Skipped ticks are counted as well, so it's
+     * proportional to the elapsed time.
+     */
+    void (*tick)( ENetMpServer* server, unsigned long long tick );
+
 } ENetMpServerCallbacks;
 
+typedef enum _ENetMpCompressionMethod
+{
+    ENET_MP_COMPRESSION_NONE = 0,
+
+    /**
+     * ENet's adaptive range coder.  Good for small packets with skewed byte
+     * distributions.
+     */
+    ENET_MP_COMPRESSION_RANGE_CODER,
+
+    /**
+     * Fast LZ77 block codec.  Good for repetitive data, especially with a
+     * dictionary of typical packet content.
+     */
+    ENET_MP_COMPRESSION_LZ
+
+} ENetMpCompressionMethod;
+
+typedef struct _ENetMpChannelCompression
+{
+    ENetMpCompressionMethod method;
+
+    /**
+     * Packets with fewer bytes are sent uncompressed.
+     */
+    int threshold;
+
+} ENetMpChannelCompression;
+
+/**
+ * Compression is applied to individual packets, so dense channels don't
+ * pay for it.  Server and client must use the same configuration.
+ *
+ * Packets of channels with compression enabled carry one extra byte.
+ */
+typedef struct _ENetMpCompressionConfiguration
+{
+    /**
+     * Policy of each user channel or `NULL` if none is compressed.
+     */
+    const ENetMpChannelCompression* channels;
+
+    /**
+     * Policy for snapshots.
+     */
+    ENetMpChannelCompression snapshots;
+
+    /**
+     * Data which LZ compressed packets may refer to.  Should consist of
+     * typical packet content.  Only the last 64 KiB are used.
+     */
+    const void* dictionary;
+    int dictionary_size;
+
+    /**
+     * Compressed packets which claim to be larger are dropped.  Uses a
+     * default of 16 MiB if zero.
+     *
+     * Independently of this, compressed packets are limited to 256 times
+     * their compressed size, so small packets can't make receivers
+     * allocate much memory.  Data which compresses better is sent
+     * uncompressed.
+     */
+    int max_decompressed_size;
+
+} ENetMpCompressionConfiguration;
+
+/**
+ * Counts packets which were sent on a channel with compression enabled.
+ */
+typedef struct _ENetMpCompressionStatistics
+{
+    unsigned int packet_count;
+    unsigned int compressed_packet_count;
+    unsigned long long uncompressed_size;
+    unsigned long long compressed_size; // Including headers.
+
+} ENetMpCompressionStatistics;
+
+/**
+ * Channel index for the compression statistics of snapshots.
+ */
+#define ENET_MP_SNAPSHOT_CHANNEL (-1)
+
+/**
+ * Histograms use 16 linear buckets per power of two, so each bucket is at
+ * most 6.25% wide relative to its values.
+ */
+#define ENET_MP_HISTOGRAM_BUCKET_COUNT 464
+
+/**
+ * Distribution of durations in microseconds.
+ */
+typedef struct _ENetMpHistogram
+{
+    unsigned long long count;
+    unsigned long long sum;
+    enet_uint32 min;
+    enet_uint32 max;
+    unsigned int buckets[ENET_MP_HISTOGRAM_BUCKET_COUNT];
+
+} ENetMpHistogram;
+
+typedef struct _ENetMpChannelMetrics
+{
+    unsigned long long sent_packets;
+    unsigned long long sent_bytes;
+    unsigned long long received_packets;
+    unsigned long long received_bytes;
+
+} ENetMpChannelMetrics;
+
+/**
+ * Metrics of a connection between client and server.
+ *
+ * The values taken from ENet (round trip time, packet loss and resends)
+ * are sampled after each service call.  On threaded servers the network
+ * thread samples them twice per second and passes them with its events.
+ */
+typedef struct _ENetMpConnectionMetrics
+{
+    /**
+     * All channels, including the internal ones.  Sizes are measured on
+     * the wire, i.e. after compression and batching.
+     */
+    ENetMpChannelMetrics total;
+
+    /**
+     * Reliable packets which had to be sent again.
+     */
+    unsigned long long resent_packets;
+
+    /**
+     * Mean round trip time and its variance in milliseconds.
+     */
+    enet_uint32 round_trip_time;
+    enet_uint32 round_trip_time_variance;
+
+    /**
+     * Ratio of lost packets between 0 and 1.
+     */
+    float packet_loss;
+
+} ENetMpConnectionMetrics;
+
+typedef struct _ENetMpServerMetrics
+{
+    /**
+     * Clients which got a slot.
+     */
+    unsigned long long connects;
+
+    /**
+     * Clients which lost their slot or were turned away, by reason.
+     * Contains the reasons the server gave when it disconnected clients
+     * itself; the remaining ones come from the clients.
+     */
+    unsigned long long disconnects[ENET_MP_DISCONNECT_REASON_COUNT];
+
+    /**
+     * Disconnects which happened without any reason, i.e. connections
+     * which timed out.  Also counted as #ENET_MP_DISCONNECT_UNKNOWN.
+     */
+    unsigned long long timeouts;
+
+    /**
+     * Connections of active clients which dropped while sessions were
+     * enabled, and how many of those were resumed.  Sessions which
+     * expired are counted as timeouts.
+     */
+    unsigned long long suspends;
+    unsigned long long resumes;
+
+    /**
+     * Traffic of all clients.
+     */
+    ENetMpChannelMetrics total;
+
+    /**
+     * Duration of service and poll calls.  Includes the time ENet waits
+     * for events, so calls with a timeout should be avoided for
+     * meaningful numbers.
+     */
+    ENetMpHistogram service_duration;
+
+    /**
+     * Duration of each callback invocation.
+     */
+    ENetMpHistogram callback_duration;
+
+    /**
+     * Ticks which #enet_mp_server_run ran, ticks which ended after the
+     * next tick was due, and ticks which were skipped, because the server
+     * fell behind by more than a whole tick.
+     */
+    unsigned long long ticks;
+    unsigned long long tick_overruns;
+    unsigned long long skipped_ticks;
+
+    /**
+     * Duration of the tick callback and the following flush.
+     */
+    ENetMpHistogram tick_duration;
+
+    /**
+     * Microseconds by which ticks started after they were due.
+     */
+    ENetMpHistogram tick_lateness;
+
+} ENetMpServerMetrics;
+
+typedef struct _ENetMpClientMetrics
+{
+    ENetMpConnectionMetrics connection;
+
+    /**
+     * @see ENetMpServerMetrics::service_duration
+     */
+    ENetMpHistogram service_duration;
+
+    ENetMpHistogram callback_duration;
+
+} ENetMpClientMetrics;
+
+/**
+ * Decides whether a client receives a broadcast.
+ *
+ * @return
+ * Non-zero if the packet should be sent to the client.
+ */
+typedef int (*ENetMpClientFilter)( ENetMpServer* server,
+                                   int client_slot,
+                                   void* user_data );
+
 /**
  * Configuration used to create a server instance.
  *
@@ -133,6 +502,154 @@ typedef struct _ENetMpServerConfiguration
      */
     int max_clients;
 
+    /**
+     * Bandwidth of the host in bytes per second, which ENet uses to throttle
+     * its peers.  Zero means unlimited.
+     */
+    enet_uint32 incoming_bandwidth;
+    enet_uint32 outgoing_bandwidth;
+
+    /**
+     * Bytes per second which #enet_mp_server_schedule_packet may send to
+     * each client.  The rate is reduced for lossy connections.
+     *
+     * Zero sends scheduled packets at the end of each service call.
+     */
+    int client_send_rate;
+
+    /**
+     * Priority which scheduled packets gain per second of waiting, so that
+     * low priority packets are sent eventually.
+     *
+     * Uses a default of 1 if zero.
+     */
+    float schedule_age_boost;
+
+    /**
+     * Milliseconds a connecting client has to authenticate itself,
+     * before it gets disconnected with #ENET_MP_DISCONNECT_REPLY_TIMEOUT.
+     *
+     * Uses a default of one second if zero.
+     */
+    int reply_timeout;
+
+    /**
+     * If non-zero, clients are not accepted when #client_connecting returns,
+     * but only once #enet_mp_server_accept_client has been called.
+     *
+     * Clients which haven't been accepted or rejected within the reply
+     * timeout are disconnected.
+     */
+    int deferred_auth;
+
+    /**
+     * Milliseconds for which the slot of an active client, whose
+     * connection timed out, is kept.  A client which reconnects meanwhile
+     * gets its slot, user data and snapshot baselines back without being
+     * authenticated again.  If the server hasn't noticed the timeout yet,
+     * the old connection is dropped when the client reconnects.
+     *
+     * Zero disables sessions.  Clients must enable
+     * ENetMpClientConfiguration::resume_timeout as well.
+     */
+    int session_timeout;
+
+    /**
+     * If non-zero, messages queued with #enet_mp_server_queue_message are
+     * combined into one packet per client and channel, which is sent when
+     * it's full or at the end of the service call.
+     *
+     * Clients must use the same setting, since all packets on user
+     * channels are framed then: batches and packets which are sent on
+     * their own are marked by a leading byte.  Sending a packet on its
+     * own (e.g. with #enet_mp_server_send) therefore copies it.
+     */
+    int batch_messages;
+
+    /**
+     * Queries each address may send per second, before further queries are
+     * ignored.  Bursts of twice as many queries are allowed.
+     *
+     * Uses a default of 4 if zero.
+     */
+    int query_rate_limit;
+
+    /**
+     * Connection attempts each address may start per second.  Bursts of
+     * twice as many are allowed.  Further attempts are dropped before they
+     * take a client slot or an ENet peer and without sending a reply.
+     *
+     * Uses a default of 4 if zero.
+     */
+    int connect_rate_limit;
+
+    /**
+     * Milliseconds for which an address which exceeded the
+     * #connect_rate_limit is ignored entirely.
+     *
+     * Uses a default of five seconds if zero.  Negative values don't block.
+     */
+    int connect_block_time;
+
+    /**
+     * Connection attempts of all addresses together which each shard
+     * admits per second.  Bursts of twice as many are allowed.  Protects
+     * against floods from many or spoofed addresses.
+     *
+     * Zero means unlimited.
+     */
+    int global_connect_rate_limit;
+
+    /**
+     * Clients which may be connected without having been accepted yet.
+     * Further clients are rejected with #ENET_MP_DISCONNECT_RATE_LIMITED,
+     * so slow or stalled authentications can't occupy all client slots.
+     *
+     * Zero means unlimited.
+     */
+    int max_pending_clients;
+
+    /**
+     * Ticks per second which #enet_mp_server_run runs.
+     */
+    int tick_rate;
+
+    /**
+     * If non-zero, a network thread owns the ENet host: it receives and
+     * sends datagrams and handles timeouts.  The application must call
+     * #enet_mp_server_poll instead of the service functions, which hands
+     * received events to the callbacks on the calling thread.
+     *
+     * The host and the peers of the server must not be used by the
+     * application then.  Packets passed to the server are owned by the
+     * network thread afterwards.  All other functions must still be called
+     * from one thread.
+     */
+    int threaded;
+
+    /**
+     * Number of ENet hosts, each with its own network thread, which share
+     * the client slots.  Host i listens on `address.port + i` and serves an
+     * equal part of the slots.  Slot indices and callbacks stay global.
+     *
+     * Requires #threaded.  Uses one host if zero.
+     *
+     * @see ENetMpClientConfiguration::shard_count
+     */
+    int shard_count;
+
+    /**
+     * Edge length of the grid cells used by #enet_mp_server_send_entity_update.
+     * Should be about the view radius of the clients.
+     *
+     * Uses a default of 64 if zero.
+     */
+    float interest_cell_size;
+
+    ENetMpCompressionConfiguration compression;
+
+    ENetMpLogConfiguration log;
+
     ENetMpServerCallbacks callbacks;
 
 } ENetMpServerConfiguration;
@@ -155,10 +672,37 @@ typedef struct _ENetMpClientCallbacks
      * Callback which is triggered when the client received a packet from the server.
      *
      * The packet is destroyed after this call, so you don't need to destroy it
-     * yourself.
+     * yourself.  Use #enet_mp_packet_retain to keep it alive.
      */
     void (*received_packet)( ENetMpClient* client, int channel, const ENetPacket* packet );
 
+    /**
+     * Optional callback which is triggered when the server changed a synced
+     * variable.  The new value is available through
+     * #enet_mp_client_get_variable.
+     */
+    void (*variable_changed)( ENetMpClient* client, int variable );
+
+    /**
+     * Optional callback which is triggered when a snapshot sent by
+     * #enet_mp_server_send_snapshot has been received.
+     *
+     * The data is only valid during this call.
+     */
+    void (*received_snapshot)( ENetMpClient* client, const void* data, int size );
+
+    /**
+     * Optional callback which is triggered when the connection dropped and
+     * the client tries to resume its session.  Sends fail meanwhile.
+     */
+    void (*connection_interrupted)( ENetMpClient* client );
+
+    /**
+     * Optional callback which is triggered when the session was resumed.
+     * Messages which were in flight when the connection dropped are lost.
+     */
+    void (*connection_resumed)( ENetMpClient* client );
+
 } ENetMpClientCallbacks;
 
 /**
@@ -181,15 +725,303 @@ typedef struct _ENetMpClientConfiguration
      */
     int channel_count;
 
+    /**
+     * Bandwidth of the host in bytes per second.  Zero means unlimited.
+     */
+    enet_uint32 incoming_bandwidth;
+    enet_uint32 outgoing_bandwidth;
+
     /**
      * Authentication information sent to the server.
      */
     const void* auth_data;
     int auth_data_size;
 
-    ENetMpClientCallbacks callbacks;
-
-} ENetMpClientConfiguration;
+    /**
+     * Must match ENetMpServerConfiguration::batch_messages.
+     */
+    int batch_messages;
+
+    /**
+     * Should match ENetMpServerConfiguration::shard_count.  The client
+     * connects to a randomly chosen shard port and tries the following
+     * ones if it is full.  Clients are only rejected with
+     * #ENET_MP_DISCONNECT_SERVER_FULL if all shards are full.
+     */
+    int shard_count;
+
+    /**
+     * Must match ENetMpServerConfiguration::compression.
+     */
+    ENetMpCompressionConfiguration compression;
+
+    /**
+     * Milliseconds for which the client tries to reconnect and resume its
+     * session, when the connection timed out.  Gives up with
+     * #ENET_MP_DISCONNECT_SESSION_EXPIRED if the server no longer knows
+     * the session.
+     *
+     * Should not exceed ENetMpServerConfiguration::session_timeout.  Zero
+     * doesn't resume.
+     */
+    int resume_timeout;
+
+    ENetMpLogConfiguration log;
+
+    ENetMpClientCallbacks callbacks;
+
+} ENetMpClientConfiguration;
+
+
+/* ---- Packets ---- */
+
+/**
+ * Keeps a packet, which was passed to a receive callback, alive after the
+ * callback returned, without copying its data.
+ *
+ * Each call must be balanced by #enet_mp_packet_release.  Packet reference
+ * counts are not atomic, so both must happen on the thread which services
+ * the server or client (or while it's not servicing).
+ *
+ * @return
+ * The packet which must be released later.  For messages of a batch this is
+ * a new packet which references the batch.
+ */
+ENET_MP_API ENetPacket* enet_mp_packet_retain( const ENetPacket* packet );
+
+/**
+ * Releases a packet returned by #enet_mp_packet_retain and destroys it if
+ * it's no longer referenced.
+ */
+ENET_MP_API void enet_mp_packet_release( ENetPacket* packet );
+
+
+/* ---- Bit streams ---- */
+
+/**
+ * Packs values into as few bits as they need.
+ *
+ * Bits are collected in a 64 bit scratch word and stored four bytes at a
+ * time, least significant bit first.  Writes past the capacity don't touch
+ * the buffer, but set a sticky error which is reported by
+ * #enet_mp_bit_writer_finish, so callers only have to check once.
+ */
+typedef struct _ENetMpBitWriter
+{
+    enet_uint8* data;
+    int capacity;
+    int size; // Bytes stored in data.
+    unsigned long long scratch;
+    int scratch_bits;
+    int error;
+    ENetPacket* packet; // Resized by #enet_mp_bit_writer_finish or `NULL`.
+
+} ENetMpBitWriter;
+
+/**
+ * Reads values written by an #ENetMpBitWriter.
+ *
+ * Reads past the end return zero and set a sticky error, which can be
+ * checked once with #enet_mp_bit_reader_has_error after all reads.
+ */
+typedef struct _ENetMpBitReader
+{
+    const enet_uint8* data;
+    int size;
+    int bit_position;
+    int error;
+
+} ENetMpBitReader;
+
+ENET_MP_API void enet_mp_bit_writer_init( ENetMpBitWriter* writer,
+                                          void* data,
+                                          int capacity );
+
+/**
+ * Writes into the packet, whose current size is used as capacity.
+ *
+ * Meant for packets returned by #enet_mp_server_acquire_packet or
+ * #enet_mp_client_acquire_packet, which are shrunk to the written size
+ * when the writer is finished.
+ */
+ENET_MP_API void enet_mp_bit_writer_init_packet( ENetMpBitWriter* writer,
+                                                 ENetPacket* packet );
+
+/**
+ * Stores the remaining bits.
+ *
+ * @return
+ * Number of bytes written or < 0 if the capacity was exceeded.
+ */
+ENET_MP_API int enet_mp_bit_writer_finish( ENetMpBitWriter* writer );
+
+/**
+ * @param bit_count
+ * Between 0 and 32.  Higher bits of the value are ignored.
+ */
+ENET_MP_API void enet_mp_bit_writer_write_bits( ENetMpBitWriter* writer,
+                                                enet_uint32 value,
+                                                int bit_count );
+
+ENET_MP_API void enet_mp_bit_writer_write_bool( ENetMpBitWriter* writer,
+                                                int value );
+
+/**
+ * Uses 8 bits per 7 bits of the value, so small values stay small.
+ */
+ENET_MP_API void enet_mp_bit_writer_write_varint( ENetMpBitWriter* writer,
+                                                  enet_uint32 value );
+
+/**
+ * Varint which maps small negative values to small codes as well.
+ */
+ENET_MP_API void enet_mp_bit_writer_write_zigzag( ENetMpBitWriter* writer,
+                                                  int value );
+
+/**
+ * Maps the value linearly onto `bit_count` bits.  Values outside of
+ * `[min, max]` are clamped.
+ */
+ENET_MP_API void enet_mp_bit_writer_write_float( ENetMpBitWriter* writer,
+                                                 float value,
+                                                 float min,
+                                                 float max,
+                                                 int bit_count );
+
+/**
+ * Writes three components with #enet_mp_bit_writer_write_float.
+ */
+ENET_MP_API void enet_mp_bit_writer_write_vector( ENetMpBitWriter* writer,
+                                                  const float vector[3],
+                                                  float min,
+                                                  float max,
+                                                  int bit_count );
+
+/**
+ * Writes a unit quaternion as its three smallest components, with
+ * `bit_count` bits each, plus two bits for the index of the largest one.
+ */
+ENET_MP_API void enet_mp_bit_writer_write_quaternion( ENetMpBitWriter* writer,
+                                                      const float quaternion[4],
+                                                      int bit_count );
+
+/**
+ * Pads to the next byte boundary and copies the bytes.
+ */
+ENET_MP_API void enet_mp_bit_writer_write_bytes( ENetMpBitWriter* writer,
+                                                 const void* data,
+                                                 int size );
+
+/**
+ * Writes the length as varint followed by the characters.
+ *
+ * @param max_length
+ * The string must not be longer.  Readers should use the same limit.
+ */
+ENET_MP_API void enet_mp_bit_writer_write_string( ENetMpBitWriter* writer,
+                                                  const char* string,
+                                                  int max_length );
+
+ENET_MP_API void enet_mp_bit_reader_init( ENetMpBitReader* reader,
+                                          const void* data,
+                                          int size );
+
+ENET_MP_API void enet_mp_bit_reader_init_packet( ENetMpBitReader* reader,
+                                                 const ENetPacket* packet );
+
+/**
+ * @return
+ * Non-zero if a read went past the end or a value was malformed.
+ */
+ENET_MP_API int enet_mp_bit_reader_has_error( const ENetMpBitReader* reader );
+
+ENET_MP_API enet_uint32 enet_mp_bit_reader_read_bits( ENetMpBitReader* reader,
+                                                      int bit_count );
+
+ENET_MP_API int enet_mp_bit_reader_read_bool( ENetMpBitReader* reader );
+
+ENET_MP_API enet_uint32 enet_mp_bit_reader_read_varint( ENetMpBitReader* reader );
+
+ENET_MP_API int enet_mp_bit_reader_read_zigzag( ENetMpBitReader* reader );
+
+ENET_MP_API float enet_mp_bit_reader_read_float( ENetMpBitReader* reader,
+                                                 float min,
+                                                 float max,
+                                                 int bit_count );
+
+ENET_MP_API void enet_mp_bit_reader_read_vector( ENetMpBitReader* reader,
+                                                 float vector[3],
+                                                 float min,
+                                                 float max,
+                                                 int bit_count );
+
+/**
+ * The result is normalized.
+ */
+ENET_MP_API void enet_mp_bit_reader_read_quaternion( ENetMpBitReader* reader,
+                                                     float quaternion[4],
+                                                     int bit_count );
+
+/**
+ * Skips to the next byte boundary and returns a pointer to the following
+ * bytes without copying them.
+ *
+ * @return
+ * Pointer into the read buffer or `NULL` if it's too short.
+ */
+ENET_MP_API const void* enet_mp_bit_reader_read_bytes( ENetMpBitReader* reader,
+                                                       int size );
+
+/**
+ * Reads a string written by #enet_mp_bit_writer_write_string and
+ * terminates it.
+ *
+ * @return
+ * Length of the string or < 0 if it doesn't fit into the destination.
+ */
+ENET_MP_API int enet_mp_bit_reader_read_string( ENetMpBitReader* reader,
+                                                char* destination,
+                                                int destination_size );
+
+
+/* ---- Metrics ---- */
+
+/**
+ * @param percentile
+ * Between 0 and 100.
+ *
+ * @return
+ * Upper bound of the bucket which contains the percentile, so the result
+ * is at most 6.25% too high.  0 if the histogram is empty.
+ */
+ENET_MP_API enet_uint32 enet_mp_histogram_get_percentile( const ENetMpHistogram* histogram,
+                                                          double percentile );
+
+
+/* ---- Queries ---- */
+
+/**
+ * Sends a connectionless query to a server.
+ *
+ * Queries don't occupy a peer on the server.  The reply is a single
+ * datagram which can be received with `enet_socket_receive` and parsed
+ * with #enet_mp_query_parse_reply.
+ *
+ * @param socket
+ * A datagram socket, e.g. created by `enet_socket_create`.
+ *
+ * @return
+ * 0 on success or < 0 on failure.
+ */
+ENET_MP_API int enet_mp_query_send( ENetSocket socket, const ENetAddress* address );
+
+/**
+ * @return
+ * 0 on success or < 0 if the datagram is no query reply.
+ */
+ENET_MP_API int enet_mp_query_parse_reply( const void* data,
+                                           int size,
+                                           ENetMpServerInformation* information );
 
 
 /* ---- Server ---- */
@@ -210,22 +1042,157 @@ ENET_MP_API void enet_mp_server_destroy( ENetMpServer* server );
 /**
  * Waits for new incoming packets, sends outgoing packets and handles events.
  *
- * Should be called regulary.
+ * Should be called regulary.  Must not be used in threaded mode.
  *
  * @param timeout
  * Number of milliseconds that ENet should wait for events.
  */
 ENET_MP_API void enet_mp_server_service( ENetMpServer* server, int timeout );
 
+/**
+ * Like #enet_mp_server_service, but handles all pending events instead of
+ * just one and flushes outgoing packets only once at the end.
+ *
+ * @param timeout
+ * Number of milliseconds that ENet should wait for the first event.
+ *
+ * @param max_events
+ * Maximum number of events handled in this call or 0 for no limit.
+ *
+ * @param time_budget
+ * Stop handling events after this many milliseconds or 0 for no limit.
+ *
+ * @return
+ * Number of handled events.
+ */
+ENET_MP_API int enet_mp_server_service_all( ENetMpServer* server,
+                                            int timeout,
+                                            int max_events,
+                                            int time_budget );
+
+/**
+ * Handles the events which the network thread has received so far and
+ * passes outgoing packets to it.  Never waits for the network.
+ *
+ * Behaves like `enet_mp_server_service_all(server, 0, 0, 0)` if the server
+ * is not threaded.
+ *
+ * @return
+ * Number of handled events.
+ *
+ * @see ENetMpServerConfiguration::threaded
+ */
+ENET_MP_API int enet_mp_server_poll( ENetMpServer* server );
+
+/**
+ * Runs a fixed timestep loop until #enet_mp_server_stop is called.
+ *
+ * Each tick handles the network events which arrived since the last one,
+ * calls ENetMpServerCallbacks::tick and flushes all outgoing data at once.
+ * Between ticks ENet keeps acknowledging, resending and pinging, but its
+ * events wait for the next tick, so callbacks only run within ticks.
+ * Ticks which are late by more than a whole tick are skipped instead of
+ * run back to back.
+ *
+ * Replaces the service and poll functions and works in threaded mode as
+ * well.  The loop waits with millisecond resolution, so ticks may start up
+ * to a millisecond late.
+ *
+ * @see ENetMpServerConfiguration::tick_rate
+ */
+ENET_MP_API void enet_mp_server_run( ENetMpServer* server );
+
+/**
+ * Lets #enet_mp_server_run return after the current tick.
+ *
+ * May be called from any thread and from signal handlers.
+ */
+ENET_MP_API void enet_mp_server_stop( ENetMpServer* server );
+
+/**
+ * Socket of the server, for waiting on it in an external event loop.
+ *
+ * Readiness functions must not be used in threaded mode; use them instead
+ * of the service functions.
+ */
+ENET_MP_API ENetSocket enet_mp_server_get_socket( ENetMpServer* server );
+
+/**
+ * Milliseconds after which #enet_mp_server_handle_timers must be called,
+ * unless the socket becomes readable first.  Covers resends, pings and
+ * the timers of the server.  Zero if there is work which is due now, e.g.
+ * messages which have been queued since the last call.
+ *
+ * Should be called again after each call of the server functions.
+ * Decisions of #enet_mp_server_accept_client are not covered, so threads
+ * which decide must wake the event loop themselves.
+ */
+ENET_MP_API int enet_mp_server_get_timeout( ENetMpServer* server );
+
+/**
+ * Handles all datagrams which are waiting on the socket and flushes
+ * outgoing packets.  Never blocks.
+ *
+ * Reads until the socket is drained, so it may be used with edge
+ * triggered event loops.
+ *
+ * @return
+ * Number of handled events.
+ */
+ENET_MP_API int enet_mp_server_process_readable( ENetMpServer* server );
+
+/**
+ * Resends, pings, expires timers and flushes outgoing packets.  Never
+ * blocks.
+ *
+ * @see enet_mp_server_get_timeout
+ */
+ENET_MP_API void enet_mp_server_handle_timers( ENetMpServer* server );
+
 ENET_MP_API void* enet_mp_server_get_user_data( ENetMpServer* server );
 
+/**
+ * Host of the first shard.  Must not be used while the server is threaded.
+ */
 ENET_MP_API ENetHost* enet_mp_server_get_host( ENetMpServer* server );
 
+ENET_MP_API int enet_mp_server_get_shard_count( ENetMpServer* server );
+
+/**
+ * Must not be used while the server is threaded.
+ */
+ENET_MP_API ENetHost* enet_mp_server_get_shard_host( ENetMpServer* server,
+                                                    int shard );
+
 ENET_MP_API int enet_mp_server_get_client_slot_count( ENetMpServer* server );
 
+/**
+ * Number of client slots which are currently occupied by connected or
+ * connecting clients.
+ */
+ENET_MP_API int enet_mp_server_get_used_client_slot_count( ENetMpServer* server );
+
+/**
+ * ENet peer of a client, or `NULL` if the slot has no connected client.
+ *
+ * Must not be used while the server is threaded, since the peers belong to
+ * the network threads then.  Use #enet_mp_server_get_client_metrics for
+ * round trip time and packet loss instead.
+ */
 ENET_MP_API ENetPeer* enet_mp_server_get_client_peer( ENetMpServer* server,
                                                       int client_slot );
 
+/**
+ * Sets application specific information (e.g. server name or map), which
+ * is included in query replies.
+ *
+ * The data is copied.  Should stay below a few hundred bytes, so the
+ * reply fits into a single datagram.
+ */
+ENET_MP_API void enet_mp_server_set_information( ENetMpServer* server,
+                                                 const void* data,
+                                                 int size );
+
 /**
  * Immediately disconnect a client with the given reason.
  */
@@ -233,6 +1200,266 @@ ENET_MP_API void enet_mp_server_disconnect_client( ENetMpServer* server,
                                                    int client_slot,
                                                    ENetMpDisconnectReason reason );
 
+/**
+ * Identifies the connection attempt of a client in deferred auth mode.
+ *
+ * Must be called on the thread which services the server, e.g. in the
+ * #ENetMpServerCallbacks::client_connecting callback.
+ */
+ENET_MP_API enet_uint32 enet_mp_server_get_auth_ticket( ENetMpServer* server,
+                                                        int client_slot );
+
+/**
+ * Accepts a client whose authentication has been deferred.
+ *
+ * May be called from any thread.  The decision is applied by the next
+ * service or poll call, unless the client has disconnected or timed out
+ * meanwhile.
+ *
+ * @param ticket
+ * Returned by #enet_mp_server_get_auth_ticket when the client connected.
+ */
+ENET_MP_API void enet_mp_server_accept_client( ENetMpServer* server,
+                                               int client_slot,
+                                               enet_uint32 ticket );
+
+/**
+ * Rejects a client whose authentication has been deferred.
+ *
+ * @see enet_mp_server_accept_client
+ */
+ENET_MP_API void enet_mp_server_reject_client( ENetMpServer* server,
+                                               int client_slot,
+                                               enet_uint32 ticket,
+                                               ENetMpDisconnectReason reason );
+
+/**
+ * Queues a packet for all active (i.e. authenticated) clients.
+ *
+ * The packet is not copied, but shared by all clients.  Like
+ * `enet_host_broadcast` this takes ownership of the packet, which is
+ * destroyed if no client received it.
+ */
+ENET_MP_API void enet_mp_server_broadcast( ENetMpServer* server,
+                                           int channel,
+                                           ENetPacket* packet );
+
+/**
+ * Like #enet_mp_server_broadcast, but only sends the packet to active
+ * clients which pass the filter.
+ */
+ENET_MP_API void enet_mp_server_broadcast_filtered( ENetMpServer* server,
+                                                    int channel,
+                                                    ENetPacket* packet,
+                                                    ENetMpClientFilter filter,
+                                                    void* user_data );
+
+/**
+ * Creates a packet whose buffer is taken from the servers packet pool.
+ *
+ * The buffer returns to the pool when the packet is destroyed, so this
+ * avoids a heap allocation for the packet data.  The content of the packet
+ * is undefined and #ENetPacket::dataLength may be reduced with
+ * `enet_packet_resize`.
+ */
+ENET_MP_API ENetPacket* enet_mp_server_acquire_packet( ENetMpServer* server,
+                                                       int size,
+                                                       enet_uint32 flags );
+
+/**
+ * Queues a packet for a client, like `enet_peer_send`.
+ *
+ * @return
+ * 0 on success or < 0 if the client slot is unused or ENet failed.
+ */
+ENET_MP_API int enet_mp_server_send( ENetMpServer* server,
+                                     int client_slot,
+                                     int channel,
+                                     ENetPacket* packet );
+
+/**
+ * Sends a message to a client.
+ *
+ * If message batching is enabled, the message is copied into the clients
+ * current batch for the channel, otherwise a packet is sent right away.
+ * In both cases the receiver gets a separate packet for each message.
+ *
+ * @param flags
+ * `ENetPacketFlag` values.  Messages with different flags end up in
+ * different batches.
+ */
+ENET_MP_API void enet_mp_server_queue_message( ENetMpServer* server,
+                                               int client_slot,
+                                               int channel,
+                                               const void* data,
+                                               int size,
+                                               enet_uint32 flags );
+
+/**
+ * Sends all pending message batches.
+ *
+ * Is called by the service functions, so this is only needed to send
+ * messages earlier.
+ */
+ENET_MP_API void enet_mp_server_flush_messages( ENetMpServer* server );
+
+/**
+ * Registers a variable which is synced to all active clients.
+ *
+ * Clients must register the same variables in the same order.
+ * Variables are initially zeroed.
+ *
+ * @param size
+ * Size in bytes; only used for #ENET_MP_VARIABLE_BLOB.
+ *
+ * @return
+ * Id of the variable or -1 if no more variables can be registered.
+ */
+ENET_MP_API int enet_mp_server_register_variable( ENetMpServer* server,
+                                                  ENetMpVariableType type,
+                                                  int size );
+
+/**
+ * Changes a synced variable.
+ *
+ * Changed variables are sent to the clients at the end of each service call,
+ * so setting a variable multiple times in between only sends the last value
+ * and setting it to its current value sends nothing.
+ *
+ * @param value
+ * Points to as many bytes as the variable is large.
+ */
+ENET_MP_API void enet_mp_server_set_variable( ENetMpServer* server,
+                                              int variable,
+                                              const void* value );
+
+ENET_MP_API const void* enet_mp_server_get_variable( ENetMpServer* server,
+                                                     int variable );
+
+/**
+ * Sends a snapshot of the client specific world state.
+ *
+ * Snapshots are sent unreliably and delta encoded against the last snapshot
+ * which the client acknowledged, so lost snapshots are not resent but
+ * superseded by the next one.  If there is no usable baseline the full
+ * snapshot is sent.
+ *
+ * @param size
+ * May be up to 16 MiB.
+ *
+ * @return
+ * Sequence number of the snapshot or -1 if the client is not active.
+ */
+ENET_MP_API int enet_mp_server_send_snapshot( ENetMpServer* server,
+                                              int client_slot,
+                                              const void* data,
+                                              int size );
+
+/**
+ * Queues the packet and sends it within the budget of the client.
+ *
+ * Packets with higher priority are sent first, so they can overtake other
+ * packets of the same channel.  Waiting packets gain priority over time.
+ *
+ * The packet is referenced until it's sent, so the same packet may be
+ * scheduled for several clients.  Unreferenced packets for unused slots
+ * are destroyed.  In threaded mode the packet must not have been passed to
+ * other send functions, since its reference count is changed by the game
+ * thread.
+ *
+ * @see ENetMpServerConfiguration::client_send_rate
+ * @see ENetMpServerConfiguration::schedule_age_boost
+ */
+ENET_MP_API void enet_mp_server_schedule_packet( ENetMpServer* server,
+                                                 int client_slot,
+                                                 int channel,
+                                                 ENetPacket* packet,
+                                                 int priority );
+
+/**
+ * @param channel
+ * User channel or #ENET_MP_SNAPSHOT_CHANNEL.
+ */
+ENET_MP_API void enet_mp_server_get_compression_statistics( ENetMpServer* server,
+                                                            int channel,
+                                                            ENetMpCompressionStatistics* statistics );
+
+/**
+ * Copies the metrics of the server.
+ *
+ * Metrics are always collected and only cost a few counter updates and
+ * clock reads per event.
+ */
+ENET_MP_API void enet_mp_server_get_metrics( ENetMpServer* server,
+                                             ENetMpServerMetrics* metrics );
+
+/**
+ * Clears the server wide counters and histograms, e.g. after each export.
+ * Client metrics are kept until their slot is reused.
+ */
+ENET_MP_API void enet_mp_server_reset_metrics( ENetMpServer* server );
+
+/**
+ * @return
+ * 0 on success or < 0 if the slot is unused.
+ */
+ENET_MP_API int enet_mp_server_get_client_metrics( ENetMpServer* server,
+                                                   int client_slot,
+                                                   ENetMpConnectionMetrics* metrics );
+
+/**
+ * Traffic of a single user channel.
+ *
+ * @return
+ * 0 on success or < 0 if the slot is unused.
+ */
+ENET_MP_API int enet_mp_server_get_client_channel_metrics( ENetMpServer* server,
+                                                           int client_slot,
+                                                           int channel,
+                                                           ENetMpChannelMetrics* metrics );
+
+/**
+ * Updates the position of an entity, which is registered on first use.
+ *
+ * Entities are identified by small non-negative integers of the
+ * application's choice.
+ */
+ENET_MP_API void enet_mp_server_set_entity_position( ENetMpServer* server,
+                                                     int entity,
+                                                     float x,
+                                                     float y );
+
+ENET_MP_API void enet_mp_server_remove_entity( ENetMpServer* server,
+                                               int entity );
+
+/**
+ * Sets the area around the position which the client can see.  Views
+ * which would span more than 64 grid cells per axis are clamped.
+ *
+ * The view is cleared when the client disconnects.
+ */
+ENET_MP_API void enet_mp_server_set_client_view( ENetMpServer* server,
+                                                 int client_slot,
+                                                 float x,
+                                                 float y,
+                                                 float radius );
+
+/**
+ * Sends the packet by reference to all active clients whose view contains
+ * the grid cell of the entity.  Clients may receive updates of entities
+ * which are slightly outside of their view.
+ *
+ * Costs as much as there are receivers, independent of the number of
+ * clients and entities.  Receivers are sorted by slot, so large audiences
+ * cost slightly more than linear.
+ *
+ * @see ENetMpServerConfiguration::interest_cell_size
+ */
+ENET_MP_API void enet_mp_server_send_entity_update( ENetMpServer* server,
+                                                    int entity,
+                                                    int channel,
+                                                    ENetPacket* packet );
+
 
 /* ---- Client ---- */
 
@@ -259,12 +1486,115 @@ ENET_MP_API void enet_mp_client_destroy( ENetMpClient* client );
  */
 ENET_MP_API void enet_mp_client_service( ENetMpClient* client, int timeout );
 
+/**
+ * Like #enet_mp_client_service, but handles all pending events instead of
+ * just one and flushes outgoing packets only once at the end.
+ *
+ * @see enet_mp_server_service_all
+ */
+ENET_MP_API int enet_mp_client_service_all( ENetMpClient* client,
+                                            int timeout,
+                                            int max_events,
+                                            int time_budget );
+
+/**
+ * @see enet_mp_server_get_socket
+ */
+ENET_MP_API ENetSocket enet_mp_client_get_socket( ENetMpClient* client );
+
+/**
+ * Also covers the resume timeout.
+ *
+ * @see enet_mp_server_get_timeout
+ */
+ENET_MP_API int enet_mp_client_get_timeout( ENetMpClient* client );
+
+/**
+ * @see enet_mp_server_process_readable
+ */
+ENET_MP_API int enet_mp_client_process_readable( ENetMpClient* client );
+
+/**
+ * @see enet_mp_server_handle_timers
+ */
+ENET_MP_API void enet_mp_client_handle_timers( ENetMpClient* client );
+
 ENET_MP_API void* enet_mp_client_get_user_data( ENetMpClient* client );
 
 ENET_MP_API ENetHost* enet_mp_client_get_host( ENetMpClient* client );
 
 ENET_MP_API ENetPeer* enet_mp_client_get_server_peer( ENetMpClient* client );
 
+/**
+ * Creates a packet whose buffer is taken from the clients packet pool.
+ *
+ * @see enet_mp_server_acquire_packet
+ */
+ENET_MP_API ENetPacket* enet_mp_client_acquire_packet( ENetMpClient* client,
+                                                       int size,
+                                                       enet_uint32 flags );
+
+/**
+ * Queues a packet for the server, like `enet_peer_send`.
+ */
+ENET_MP_API int enet_mp_client_send( ENetMpClient* client,
+                                     int channel,
+                                     ENetPacket* packet );
+
+/**
+ * Sends a message to the server.
+ *
+ * @see enet_mp_server_queue_message
+ */
+ENET_MP_API void enet_mp_client_queue_message( ENetMpClient* client,
+                                               int channel,
+                                               const void* data,
+                                               int size,
+                                               enet_uint32 flags );
+
+/**
+ * Sends all pending message batches.  Batches are kept while the client
+ * is connecting or resuming.
+ *
+ * @see enet_mp_server_flush_messages
+ */
+ENET_MP_API void enet_mp_client_flush_messages( ENetMpClient* client );
+
+/**
+ * Registers a variable which is synced from the server.
+ *
+ * @see enet_mp_server_register_variable
+ */
+ENET_MP_API int enet_mp_client_register_variable( ENetMpClient* client,
+                                                  ENetMpVariableType type,
+                                                  int size );
+
+/**
+ * @return
+ * Pointer to the last value received from the server.
+ */
+ENET_MP_API const void* enet_mp_client_get_variable( ENetMpClient* client,
+                                                     int variable );
+
+ENET_MP_API void enet_mp_client_get_compression_statistics( ENetMpClient* client,
+                                                            int channel,
+                                                            ENetMpCompressionStatistics* statistics );
+
+/**
+ * @see enet_mp_server_get_metrics
+ */
+ENET_MP_API void enet_mp_client_get_metrics( ENetMpClient* client,
+                                             ENetMpClientMetrics* metrics );
+
+ENET_MP_API void enet_mp_client_reset_metrics( ENetMpClient* client );
+
+/**
+ * Traffic of a single user channel.
+ */
+ENET_MP_API void enet_mp_client_get_channel_metrics( ENetMpClient* client,
+                                                     int channel,
+                                                     ENetMpChannelMetrics* metrics );
+
 
 #ifdef __cplusplus
 }
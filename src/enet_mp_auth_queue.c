@@ -0,0 +1,48 @@
+#include <assert.h>
+#include <stdlib.h> // realloc, free
+#include <string.h> // memset
+#include "enet_mp_auth_queue.h"
+
+
+void auth_queue_init( AuthQueue* queue )
+{
+    memset(queue, 0, sizeof(AuthQueue));
+    mutex_init(&queue->mutex);
+}
+
+void auth_queue_destroy( AuthQueue* queue )
+{
+    mutex_destroy(&queue->mutex);
+    free(queue->pending);
+    free(queue->taken);
+    memset(queue, 0, sizeof(AuthQueue));
+}
+
+void auth_queue_push( AuthQueue* queue, const AuthDecision* decision )
+{
+    mutex_lock(&queue->mutex);
+    if(queue->pending_count == queue->pending_capacity)
+    {
+        queue->pending_capacity = queue->pending_capacity ? queue->pending_capacity*2 : 16;
+        queue->pending = (AuthDecision*)realloc(queue->pending,
+                                                queue->pending_capacity * sizeof(AuthDecision));
+    }
+    queue->pending[queue->pending_count++] = *decision;
+    mutex_unlock(&queue->mutex);
+}
+
+const AuthDecision* auth_queue_take( AuthQueue* queue, int* count )
+{
+    mutex_lock(&queue->mutex);
+    AuthDecision* taken = queue->pending;
+    const int taken_capacity = queue->pending_capacity;
+    *count = queue->pending_count;
+    queue->pending = queue->taken;
+    queue->pending_capacity = queue->taken_capacity;
+    queue->pending_count = 0;
+    mutex_unlock(&queue->mutex);
+
+    queue->taken = taken;
+    queue->taken_capacity = taken_capacity;
+    return taken;
+}
@@ -0,0 +1,55 @@
+#ifndef __ENET_MP_AUTH_QUEUE_H__
+#define __ENET_MP_AUTH_QUEUE_H__
+
+#include <stdbool.h>
+#include <enet/enet.h>
+#include "enet_mp.h"
+#include "enet_mp_thread.h"
+
+
+/**
+ * Outcome of a deferred authentication.
+ */
+typedef struct _AuthDecision
+{
+    int client_slot;
+    enet_uint32 ticket; // Guards against slots which have been reused since.
+    bool accepted;
+    ENetMpDisconnectReason reason; // Only used if the client was rejected.
+
+} AuthDecision;
+
+/**
+ * Collects decisions from any thread until the game thread takes them.
+ *
+ * Two arrays are swapped on each take, so the mutex is only held for a
+ * moment and the game thread can handle the decisions without it.
+ */
+typedef struct _AuthQueue
+{
+    Mutex mutex;
+    AuthDecision* pending;
+    int pending_count;
+    int pending_capacity;
+    AuthDecision* taken;
+    int taken_capacity;
+
+} AuthQueue;
+
+
+void auth_queue_init( AuthQueue* queue );
+
+void auth_queue_destroy( AuthQueue* queue );
+
+void auth_queue_push( AuthQueue* queue, const AuthDecision* decision );
+
+/**
+ * Removes all pending decisions.
+ *
+ * @return
+ * The decisions, which stay valid until the next call.
+ */
+const AuthDecision* auth_queue_take( AuthQueue* queue, int* count );
+
+
+#endif
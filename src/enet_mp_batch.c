@@ -0,0 +1,204 @@
+#include <assert.h>
+#include <stdlib.h> // calloc, free
+#include <string.h> // memcpy, memset
+#include "enet_mp.h"
+#include "enet_mp_shared.h"
+#include "enet_mp_batch.h"
+
+
+// Room for the ENet protocol and command headers in a datagram.
+static const int DATAGRAM_OVERHEAD = 64;
+
+// First byte of each packet on a channel which receives batches.  Packets
+// which were sent on their own can't be told apart from batches otherwise.
+typedef enum _FrameType
+{
+    SINGLE_MESSAGE_FRAME,
+    MESSAGE_BATCH_FRAME
+
+} FrameType;
+
+int get_message_batch_capacity( const ENetPeer* peer )
+{
+    return (int)peer->mtu - DATAGRAM_OVERHEAD;
+}
+
+void message_batcher_init( MessageBatcher* batcher,
+                           int channel_count,
+                           int capacity,
+                           PacketPool* pool,
+                           BatchSendFunction send_function,
+                           void* send_context )
+{
+    assert(send_function);
+    batcher->batches = (MessageBatch*)calloc(channel_count > 0 ? channel_count : 1,
+                                             sizeof(MessageBatch));
+    batcher->channel_count = channel_count;
+    batcher->capacity = capacity;
+    batcher->pool = pool;
+    batcher->send_function = send_function;
+    batcher->send_context = send_context;
+    batcher->pending_batch_count = 0;
+}
+
+void message_batcher_destroy( MessageBatcher* batcher )
+{
+    int i = 0;
+    for(; i < batcher->channel_count; i++)
+    {
+        MessageBatch* batch = &batcher->batches[i];
+        if(batch->packet)
+            enet_packet_destroy(batch->packet);
+    }
+    free(batcher->batches);
+    batcher->batches = NULL;
+    batcher->pending_batch_count = 0;
+}
+
+static void send_batch( MessageBatcher* batcher, enet_uint8 channel )
+{
+    MessageBatch* batch = &batcher->batches[channel];
+    assert(batch->packet);
+    enet_packet_resize(batch->packet, batch->size);
+    ENetPacket* packet = batch->packet;
+    batch->packet = NULL;
+    batch->size = 0;
+    batcher->pending_batch_count--;
+    batcher->send_function(batcher->send_context, batcher, channel, packet);
+}
+
+void message_batcher_add( MessageBatcher* batcher,
+                          enet_uint8 channel,
+                          const void* data,
+                          int size,
+                          enet_uint32 flags )
+{
+    assert(is_in_bounds(channel, batcher->channel_count));
+    assert(size >= 0);
+
+    MessageBatch* batch = &batcher->batches[channel];
+    const int entry_size = MAX_VARINT_SIZE + size;
+    const int frame_size = 1 + entry_size;
+
+    if(batch->packet &&
+       ((batch->packet->flags & ~ENET_PACKET_FLAG_NO_ALLOCATE) != flags ||
+        batch->size + entry_size > (int)batch->packet->dataLength))
+        send_batch(batcher, channel);
+
+    if(!batch->packet)
+    {
+        // Messages which are larger than a datagram get a batch of their own.
+        int capacity = batcher->capacity;
+        if(capacity < frame_size)
+            capacity = frame_size;
+        batch->packet = packet_pool_acquire(batcher->pool, capacity, flags);
+        batch->packet->data[0] = MESSAGE_BATCH_FRAME;
+        batch->size = 1;
+        batcher->pending_batch_count++;
+    }
+
+    char* destination = (char*)&batch->packet->data[batch->size];
+    destination += write_varint((enet_uint32)size, destination);
+    memcpy(destination, data, size);
+    batch->size = (int)(destination + size - (char*)batch->packet->data);
+}
+
+void message_batcher_flush( MessageBatcher* batcher )
+{
+    int i = 0;
+    for(; i < batcher->channel_count && batcher->pending_batch_count > 0; i++)
+        if(batcher->batches[i].packet)
+            send_batch(batcher, (enet_uint8)i);
+}
+
+bool message_batcher_has_pending( const MessageBatcher* batcher )
+{
+    return batcher->pending_batch_count > 0;
+}
+
+// Messages reference their batch, which is released when they're destroyed.
+// Temporary messages are never destroyed, but use the callback as marker.
+static void ENET_CALLBACK release_batch( ENetPacket* message )
+{
+    ENetPacket* batch = (ENetPacket*)message->userData;
+    assert(batch->referenceCount > 0);
+    batch->referenceCount--;
+    if(batch->referenceCount == 0)
+        enet_packet_destroy(batch);
+}
+
+ENetPacket* frame_single_message( PacketPool* pool, const ENetPacket* packet )
+{
+    const int size = (int)packet->dataLength;
+    ENetPacket* frame = packet_pool_acquire(pool,
+                                            1 + size,
+                                            packet->flags & ~ENET_PACKET_FLAG_NO_ALLOCATE);
+    frame->data[0] = SINGLE_MESSAGE_FRAME;
+    memcpy(&frame->data[1], packet->data, size);
+    return frame;
+}
+
+bool split_message_batch( const ENetPacket* frame,
+                          MessageHandler handler,
+                          void* context )
+{
+    if(frame->dataLength < 1)
+        return false;
+
+    ENetPacket message;
+    memset(&message, 0, sizeof(message));
+    message.flags = frame->flags;
+    message.freeCallback = release_batch;
+    message.userData = (void*)frame;
+
+    const char* data = (const char*)&frame->data[1];
+    const char* end = (const char*)frame->data + frame->dataLength;
+    if(frame->data[0] == SINGLE_MESSAGE_FRAME)
+    {
+        message.data = (enet_uint8*)data;
+        message.dataLength = (size_t)(end - data);
+        handler(context, &message);
+        return true;
+    }
+    if(frame->data[0] != MESSAGE_BATCH_FRAME)
+        return false;
+
+    while(data < end)
+    {
+        enet_uint32 size;
+        const int length = read_varint(data, (int)(end - data), &size);
+        if(length == 0)
+            return false;
+        data += length;
+
+        if(size > (enet_uint32)(end - data))
+            return false;
+
+        message.data = (enet_uint8*)data;
+        message.dataLength = size;
+        handler(context, &message);
+        data += size;
+    }
+    return true;
+}
+
+bool is_temporary_message( const ENetPacket* packet )
+{
+    // Retained messages have a reference count.
+    return packet->freeCallback == release_batch &&
+           packet->referenceCount == 0;
+}
+
+ENetPacket* retain_message( const ENetPacket* message )
+{
+    assert(is_temporary_message(message));
+    ENetPacket* batch = (ENetPacket*)message->userData;
+    ENetPacket* packet = enet_packet_create(message->data,
+                                            message->dataLength,
+                                            message->flags | ENET_PACKET_FLAG_NO_ALLOCATE);
+    packet->freeCallback = release_batch;
+    packet->userData = batch;
+    packet->referenceCount = 1;
+    batch->referenceCount++;
+    return packet;
+}
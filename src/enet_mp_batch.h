@@ -0,0 +1,122 @@
+#ifndef __ENET_MP_BATCH_H__
+#define __ENET_MP_BATCH_H__
+
+#include <stdbool.h>
+#include <enet/enet.h>
+#include "enet_mp_pool.h"
+
+
+/**
+ * Packet that is being filled with messages.
+ *
+ * Batches start with a frame byte, followed by `varint size + data`
+ * entries.
+ */
+typedef struct _MessageBatch
+{
+    ENetPacket* packet; // `NULL` if no messages are queued.
+    int size; // Bytes used in the packet.
+
+} MessageBatch;
+
+typedef struct _MessageBatcher MessageBatcher;
+
+/**
+ * Hands a finished batch over for sending.  Takes ownership of the packet.
+ */
+typedef void (*BatchSendFunction)( void* context,
+                                   MessageBatcher* batcher,
+                                   enet_uint8 channel,
+                                   ENetPacket* packet );
+
+/**
+ * Collects messages for a single peer.  Each channel has its own batch.
+ */
+struct _MessageBatcher
+{
+    MessageBatch* batches;
+    int channel_count;
+    int capacity; // Preferred batch size in bytes.
+    PacketPool* pool;
+    BatchSendFunction send_function;
+    void* send_context;
+    int pending_batch_count;
+};
+
+typedef void (*MessageHandler)( void* context, const ENetPacket* message );
+
+
+/**
+ * Batch capacity which fills but doesn't exceed a datagram of the peer.
+ */
+int get_message_batch_capacity( const ENetPeer* peer );
+
+void message_batcher_init( MessageBatcher* batcher,
+                           int channel_count,
+                           int capacity,
+                           PacketPool* pool,
+                           BatchSendFunction send_function,
+                           void* send_context );
+
+/**
+ * Destroys unsent batches.
+ */
+void message_batcher_destroy( MessageBatcher* batcher );
+
+/**
+ * Appends a message to the channels batch.
+ *
+ * The batch is sent beforehand if the message would not fit into the
+ * capacity or the packet flags differ.
+ */
+void message_batcher_add( MessageBatcher* batcher,
+                          enet_uint8 channel,
+                          const void* data,
+                          int size,
+                          enet_uint32 flags );
+
+/**
+ * Sends all pending batches.
+ */
+void message_batcher_flush( MessageBatcher* batcher );
+
+bool message_batcher_has_pending( const MessageBatcher* batcher );
+
+/**
+ * Copies a packet into a frame with a single message, so it can be sent on
+ * channels which receive batches.  The given packet is left to the caller.
+ */
+ENetPacket* frame_single_message( PacketPool* pool, const ENetPacket* packet );
+
+/**
+ * Calls the handler with a temporary packet for each message in the batch
+ * or single message frame.
+ *
+ * The temporary packets share the data and flags of the batch and store
+ * the batch in their `userData`.  See #retain_message.
+ *
+ * @return
+ * `false` if the frame is malformed.  Messages before the error have
+ * been handled already.
+ */
+bool split_message_batch( const ENetPacket* frame,
+                          MessageHandler handler,
+                          void* context );
+
+
+/**
+ * Whether the packet is a temporary message created by #split_message_batch.
+ */
+bool is_temporary_message( const ENetPacket* packet );
+
+/**
+ * Creates a packet which shares the data of a temporary message and keeps
+ * the batch alive.
+ *
+ * @return
+ * New packet with a reference count of 1.
+ */
+ENetPacket* retain_message( const ENetPacket* message );
+
+
+#endif
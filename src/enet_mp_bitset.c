@@ -0,0 +1,148 @@
+#include <assert.h>
+#include <stdlib.h> // calloc, realloc, free
+#include <string.h> // memset
+#include "enet_mp.h"
+#include "enet_mp_shared.h" // is_in_bounds
+#include "enet_mp_bitset.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+int count_trailing_zeros( BitsetWord word )
+{
+    assert(word != 0);
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    int count = 0;
+    while((word & 1) == 0)
+    {
+        word >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+static BitsetWord get_bit_mask( int index )
+{
+    return (BitsetWord)1 << (index % BITSET_WORD_BITS);
+}
+
+void bitset_init( Bitset* bitset, int bit_count )
+{
+    assert(bit_count >= 0);
+    bitset->bit_count = bit_count;
+    bitset->word_count = (bit_count + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+    bitset->words = (BitsetWord*)calloc(bitset->word_count > 0 ? bitset->word_count : 1,
+                                        sizeof(BitsetWord));
+    bitset->set_count = 0;
+}
+
+void bitset_destroy( Bitset* bitset )
+{
+    free(bitset->words);
+    bitset->words = NULL;
+}
+
+void bitset_resize( Bitset* bitset, int bit_count )
+{
+    assert(bit_count >= 0);
+
+    // Drop bits which are removed, so they don't linger in the last word.
+    while(bitset->bit_count > bit_count)
+    {
+        bitset_clear(bitset, bitset->bit_count-1);
+        bitset->bit_count--;
+    }
+
+    const int word_count = (bit_count + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+    if(word_count > bitset->word_count)
+    {
+        bitset->words = (BitsetWord*)realloc(bitset->words,
+                                             word_count * sizeof(BitsetWord));
+        memset(&bitset->words[bitset->word_count],
+               0,
+               (word_count - bitset->word_count) * sizeof(BitsetWord));
+        bitset->word_count = word_count;
+    }
+    bitset->bit_count = bit_count;
+}
+
+void bitset_set( Bitset* bitset, int index )
+{
+    assert(is_in_bounds(index, bitset->bit_count));
+    BitsetWord* word = &bitset->words[index / BITSET_WORD_BITS];
+    const BitsetWord mask = get_bit_mask(index);
+    if(!(*word & mask))
+    {
+        *word |= mask;
+        bitset->set_count++;
+    }
+}
+
+void bitset_clear( Bitset* bitset, int index )
+{
+    assert(is_in_bounds(index, bitset->bit_count));
+    BitsetWord* word = &bitset->words[index / BITSET_WORD_BITS];
+    const BitsetWord mask = get_bit_mask(index);
+    if(*word & mask)
+    {
+        *word &= ~mask;
+        bitset->set_count--;
+    }
+}
+
+bool bitset_test( const Bitset* bitset, int index )
+{
+    assert(is_in_bounds(index, bitset->bit_count));
+    return (bitset->words[index / BITSET_WORD_BITS] & get_bit_mask(index)) != 0;
+}
+
+void bitset_set_all( Bitset* bitset )
+{
+    if(bitset->word_count == 0)
+        return;
+
+    memset(bitset->words, 0xFF, bitset->word_count * sizeof(BitsetWord));
+
+    // Bits after bit_count must stay cleared.
+    const int tail_bits = bitset->bit_count % BITSET_WORD_BITS;
+    if(tail_bits > 0)
+        bitset->words[bitset->word_count-1] = ((BitsetWord)1 << tail_bits) - 1;
+
+    bitset->set_count = bitset->bit_count;
+}
+
+void bitset_clear_all( Bitset* bitset )
+{
+    memset(bitset->words, 0, bitset->word_count * sizeof(BitsetWord));
+    bitset->set_count = 0;
+}
+
+int bitset_find_first_set( const Bitset* bitset, int start )
+{
+    assert(start >= 0);
+    if(bitset->set_count == 0 || start >= bitset->bit_count)
+        return -1;
+
+    int word_index = start / BITSET_WORD_BITS;
+    BitsetWord word = bitset->words[word_index] &
+                      ~(get_bit_mask(start) - 1); // ignore bits before start
+    for(;;)
+    {
+        if(word)
+            return word_index*BITSET_WORD_BITS + count_trailing_zeros(word);
+
+        word_index++;
+        if(word_index >= bitset->word_count)
+            return -1;
+        word = bitset->words[word_index];
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef __ENET_MP_BITSET_H__
+#define __ENET_MP_BITSET_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+typedef uint64_t BitsetWord;
+
+enum
+{
+    BITSET_WORD_BITS = 64
+};
+
+/**
+ * Fixed size set of bits, which also tracks how many bits are set.
+ */
+typedef struct _Bitset
+{
+    BitsetWord* words;
+    int word_count;
+    int bit_count;
+    int set_count;
+} Bitset;
+
+
+int count_trailing_zeros( BitsetWord word );
+
+/**
+ * All bits are initially cleared.
+ */
+void bitset_init( Bitset* bitset, int bit_count );
+
+void bitset_destroy( Bitset* bitset );
+
+/**
+ * Changes the number of bits.  Added bits are cleared.
+ */
+void bitset_resize( Bitset* bitset, int bit_count );
+
+void bitset_set( Bitset* bitset, int index );
+
+void bitset_clear( Bitset* bitset, int index );
+
+bool bitset_test( const Bitset* bitset, int index );
+
+void bitset_set_all( Bitset* bitset );
+
+void bitset_clear_all( Bitset* bitset );
+
+/**
+ * Finds the first set bit which is not before `start`.
+ *
+ * Tests a whole word at once, so the worst case for ENet's limit of
+ * 4095 peers is 64 word tests.
+ *
+ * @return
+ * Bit index or -1 if no bit is set.
+ */
+int bitset_find_first_set( const Bitset* bitset, int start );
+
+
+#endif
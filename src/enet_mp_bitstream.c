@@ -0,0 +1,346 @@
+#include <assert.h>
+#include <math.h> // fabsf, sqrtf
+#include <string.h> // memcpy, strlen
+#include "enet_mp.h"
+#include "enet_mp_shared.h"
+
+
+// Largest absolute value of the three smallest components of a unit quaternion.
+static const float QUATERNION_COMPONENT_LIMIT = 0.70710678f;
+
+static enet_uint32 get_bit_mask( int bit_count )
+{
+    // Shifting a 32 bit value by 32 is undefined, so use 64 bits.
+    return (enet_uint32)(((unsigned long long)1 << bit_count) - 1);
+}
+
+static void store_bytes( ENetMpBitWriter* writer, int byte_count )
+{
+    if(writer->size + byte_count > writer->capacity)
+    {
+        writer->error = 1;
+    }
+    else
+    {
+        enet_uint8* destination = &writer->data[writer->size];
+        int i = 0;
+        for(; i < byte_count; i++)
+            destination[i] = (enet_uint8)(writer->scratch >> (8*i));
+        writer->size += byte_count;
+    }
+    writer->scratch >>= 8*byte_count;
+    writer->scratch_bits -= 8*byte_count;
+}
+
+void enet_mp_bit_writer_init( ENetMpBitWriter* writer,
+                              void* data,
+                              int capacity )
+{
+    assert(capacity >= 0);
+    writer->data = (enet_uint8*)data;
+    writer->capacity = capacity;
+    writer->size = 0;
+    writer->scratch = 0;
+    writer->scratch_bits = 0;
+    writer->error = 0;
+    writer->packet = NULL;
+}
+
+void enet_mp_bit_writer_init_packet( ENetMpBitWriter* writer,
+                                     ENetPacket* packet )
+{
+    enet_mp_bit_writer_init(writer, packet->data, (int)packet->dataLength);
+    writer->packet = packet;
+}
+
+int enet_mp_bit_writer_finish( ENetMpBitWriter* writer )
+{
+    store_bytes(writer, (writer->scratch_bits + 7) / 8);
+    writer->scratch_bits = 0;
+    if(writer->error)
+        return -1;
+    if(writer->packet)
+        enet_packet_resize(writer->packet, writer->size);
+    return writer->size;
+}
+
+void enet_mp_bit_writer_write_bits( ENetMpBitWriter* writer,
+                                    enet_uint32 value,
+                                    int bit_count )
+{
+    assert(bit_count >= 0 && bit_count <= 32);
+    writer->scratch |= (unsigned long long)(value & get_bit_mask(bit_count)) << writer->scratch_bits;
+    writer->scratch_bits += bit_count;
+    if(writer->scratch_bits >= 32)
+        store_bytes(writer, 4);
+}
+
+void enet_mp_bit_writer_write_bool( ENetMpBitWriter* writer, int value )
+{
+    enet_mp_bit_writer_write_bits(writer, value ? 1 : 0, 1);
+}
+
+void enet_mp_bit_writer_write_varint( ENetMpBitWriter* writer,
+                                      enet_uint32 value )
+{
+    while(value >= 0x80)
+    {
+        enet_mp_bit_writer_write_bits(writer, (value & 0x7F) | 0x80, 8);
+        value >>= 7;
+    }
+    enet_mp_bit_writer_write_bits(writer, value, 8);
+}
+
+void enet_mp_bit_writer_write_zigzag( ENetMpBitWriter* writer, int value )
+{
+    const enet_uint32 bits = (enet_uint32)value;
+    enet_mp_bit_writer_write_varint(writer, (bits << 1) ^ (0u - (bits >> 31)));
+}
+
+static enet_uint32 quantize( float value, float min, float max, int bit_count )
+{
+    assert(bit_count >= 1 && bit_count <= 32);
+    assert(min < max);
+    // Written this way round to catch NaNs as well.
+    if(!(value > min))
+        value = min;
+    if(value > max)
+        value = max;
+    const double max_code = (double)get_bit_mask(bit_count);
+    return (enet_uint32)(((double)value - min) / ((double)max - min) * max_code + 0.5);
+}
+
+static float dequantize( enet_uint32 code, float min, float max, int bit_count )
+{
+    const double max_code = (double)get_bit_mask(bit_count);
+    return (float)(min + (double)code / max_code * ((double)max - min));
+}
+
+void enet_mp_bit_writer_write_float( ENetMpBitWriter* writer,
+                                     float value,
+                                     float min,
+                                     float max,
+                                     int bit_count )
+{
+    enet_mp_bit_writer_write_bits(writer,
+                                  quantize(value, min, max, bit_count),
+                                  bit_count);
+}
+
+void enet_mp_bit_writer_write_vector( ENetMpBitWriter* writer,
+                                      const float vector[3],
+                                      float min,
+                                      float max,
+                                      int bit_count )
+{
+    int i = 0;
+    for(; i < 3; i++)
+        enet_mp_bit_writer_write_float(writer, vector[i], min, max, bit_count);
+}
+
+void enet_mp_bit_writer_write_quaternion( ENetMpBitWriter* writer,
+                                          const float quaternion[4],
+                                          int bit_count )
+{
+    int largest = 0;
+    int i = 1;
+    for(; i < 4; i++)
+        if(fabsf(quaternion[i]) > fabsf(quaternion[largest]))
+            largest = i;
+
+    // q and -q are the same rotation, so the largest component can always
+    // be made positive and doesn't need a sign bit.
+    const float sign = quaternion[largest] < 0 ? -1.0f : 1.0f;
+    enet_mp_bit_writer_write_bits(writer, (enet_uint32)largest, 2);
+    for(i = 0; i < 4; i++)
+        if(i != largest)
+            enet_mp_bit_writer_write_float(writer,
+                                           sign*quaternion[i],
+                                           -QUATERNION_COMPONENT_LIMIT,
+                                           QUATERNION_COMPONENT_LIMIT,
+                                           bit_count);
+}
+
+void enet_mp_bit_writer_write_bytes( ENetMpBitWriter* writer,
+                                     const void* data,
+                                     int size )
+{
+    assert(size >= 0);
+    const int padding = (8 - writer->scratch_bits % 8) % 8;
+    enet_mp_bit_writer_write_bits(writer, 0, padding);
+    store_bytes(writer, writer->scratch_bits / 8);
+
+    if(writer->size + size > writer->capacity)
+    {
+        writer->error = 1;
+        return;
+    }
+    if(size > 0)
+        memcpy(&writer->data[writer->size], data, size);
+    writer->size += size;
+}
+
+void enet_mp_bit_writer_write_string( ENetMpBitWriter* writer,
+                                      const char* string,
+                                      int max_length )
+{
+    const int length = (int)strlen(string);
+    assert(length <= max_length);
+    enet_mp_bit_writer_write_varint(writer, (enet_uint32)length);
+    enet_mp_bit_writer_write_bytes(writer, string, length);
+}
+
+void enet_mp_bit_reader_init( ENetMpBitReader* reader,
+                              const void* data,
+                              int size )
+{
+    assert(size >= 0);
+    reader->data = (const enet_uint8*)data;
+    reader->size = size;
+    reader->bit_position = 0;
+    reader->error = 0;
+}
+
+void enet_mp_bit_reader_init_packet( ENetMpBitReader* reader,
+                                     const ENetPacket* packet )
+{
+    enet_mp_bit_reader_init(reader, packet->data, (int)packet->dataLength);
+}
+
+int enet_mp_bit_reader_has_error( const ENetMpBitReader* reader )
+{
+    return reader->error;
+}
+
+enet_uint32 enet_mp_bit_reader_read_bits( ENetMpBitReader* reader,
+                                          int bit_count )
+{
+    assert(bit_count >= 0 && bit_count <= 32);
+    const int position = reader->bit_position;
+    if(bit_count > reader->size*8 - position)
+    {
+        reader->error = 1;
+        return 0;
+    }
+
+    // At most 39 bits, which span 5 bytes.
+    const int first_byte = position / 8;
+    const int shift = position % 8;
+    const int byte_count = (shift + bit_count + 7) / 8;
+    unsigned long long scratch = 0;
+    int i = 0;
+    for(; i < byte_count; i++)
+        scratch |= (unsigned long long)reader->data[first_byte + i] << (8*i);
+
+    reader->bit_position = position + bit_count;
+    return (enet_uint32)(scratch >> shift) & get_bit_mask(bit_count);
+}
+
+int enet_mp_bit_reader_read_bool( ENetMpBitReader* reader )
+{
+    return (int)enet_mp_bit_reader_read_bits(reader, 1);
+}
+
+enet_uint32 enet_mp_bit_reader_read_varint( ENetMpBitReader* reader )
+{
+    enet_uint32 value = 0;
+    int i = 0;
+    for(; i < MAX_VARINT_SIZE; i++)
+    {
+        const enet_uint32 byte = enet_mp_bit_reader_read_bits(reader, 8);
+        value |= (byte & 0x7F) << (7*i);
+        if(!(byte & 0x80))
+            return value;
+    }
+    reader->error = 1;
+    return 0;
+}
+
+int enet_mp_bit_reader_read_zigzag( ENetMpBitReader* reader )
+{
+    const enet_uint32 code = enet_mp_bit_reader_read_varint(reader);
+    return (int)((code >> 1) ^ (0u - (code & 1)));
+}
+
+float enet_mp_bit_reader_read_float( ENetMpBitReader* reader,
+                                     float min,
+                                     float max,
+                                     int bit_count )
+{
+    assert(bit_count >= 1 && bit_count <= 32);
+    return dequantize(enet_mp_bit_reader_read_bits(reader, bit_count),
+                      min,
+                      max,
+                      bit_count);
+}
+
+void enet_mp_bit_reader_read_vector( ENetMpBitReader* reader,
+                                     float vector[3],
+                                     float min,
+                                     float max,
+                                     int bit_count )
+{
+    int i = 0;
+    for(; i < 3; i++)
+        vector[i] = enet_mp_bit_reader_read_float(reader, min, max, bit_count);
+}
+
+void enet_mp_bit_reader_read_quaternion( ENetMpBitReader* reader,
+                                         float quaternion[4],
+                                         int bit_count )
+{
+    const int largest = (int)enet_mp_bit_reader_read_bits(reader, 2);
+    float sum = 0;
+    int i = 0;
+    for(; i < 4; i++)
+    {
+        if(i == largest)
+            continue;
+        quaternion[i] = enet_mp_bit_reader_read_float(reader,
+                                                      -QUATERNION_COMPONENT_LIMIT,
+                                                      QUATERNION_COMPONENT_LIMIT,
+                                                      bit_count);
+        sum += quaternion[i]*quaternion[i];
+    }
+    quaternion[largest] = sum < 1.0f ? sqrtf(1.0f - sum) : 0.0f;
+
+    // Quantization errors accumulate, so normalize again.
+    sum += quaternion[largest]*quaternion[largest];
+    const float scale = 1.0f / sqrtf(sum);
+    for(i = 0; i < 4; i++)
+        quaternion[i] *= scale;
+}
+
+const void* enet_mp_bit_reader_read_bytes( ENetMpBitReader* reader,
+                                           int size )
+{
+    assert(size >= 0);
+    const int first_byte = (reader->bit_position + 7) / 8;
+    if(reader->error || size > reader->size - first_byte)
+    {
+        reader->error = 1;
+        return NULL;
+    }
+    reader->bit_position = (first_byte + size) * 8;
+    return &reader->data[first_byte];
+}
+
+int enet_mp_bit_reader_read_string( ENetMpBitReader* reader,
+                                    char* destination,
+                                    int destination_size )
+{
+    assert(destination_size > 0);
+    destination[0] = '\0';
+    const enet_uint32 length = enet_mp_bit_reader_read_varint(reader);
+    if(reader->error || length >= (enet_uint32)destination_size)
+    {
+        reader->error = 1;
+        return -1;
+    }
+    const void* data = enet_mp_bit_reader_read_bytes(reader, (int)length);
+    if(!data)
+        return -1;
+    memcpy(destination, data, length);
+    destination[length] = '\0';
+    return (int)length;
+}
@@ -1,8 +1,14 @@
 #include <assert.h>
+#include <limits.h> // INT_MAX
 #include <stdlib.h> // malloc, calloc, free
-#include <string.h> // memcpy
+#include <string.h> // memcpy, memset
 #include "enet_mp.h"
 #include "enet_mp_shared.h"
+#include "enet_mp_variables.h"
+#include "enet_mp_snapshot.h"
+#include "enet_mp_batch.h"
+#include "enet_mp_compression.h"
+#include "enet_mp_metrics.h"
 
 
 typedef struct _ClientSlot
@@ -19,26 +25,164 @@ struct _ENetMpClient
     ENetHost* host;
     int user_channel_count;
     ENetPeer* server_peer;
+    ENetAddress server_address; // Of the shard the client connected to.
+    ENetAddress first_shard_address;
+    int shard_count;
+    int shard; // Index of the shard the client connected to.
+    int tried_shard_count; // Shards which were full, until activation.
+    bool activated;
 
     char* auth_data;
     int auth_data_size;
+
+    Logger logger;
+    VariableRegistry variables;
+
+    SnapshotRing snapshots;
+    enet_uint32 unsent_snapshot_ack; // 0 if there is nothing to acknowledge.
+
+    bool batch_messages;
+    MessageBatcher batcher;
+
+    PacketPool* packet_pool;
+    Compressor compressor;
+
+    PeerMetrics metrics;
+    ENetMpHistogram service_duration;
+    ENetMpHistogram callback_duration;
+
+    enet_uint32 resume_timeout; // Zero doesn't resume.
+    int session_slot;
+    SessionToken session; // Issued by the server; zero if there is none.
+    bool resuming; // Reconnecting after the connection dropped.
+    enet_uint32 resume_deadline;
 };
 
 
+// Creates the packet which is sent for the given one, which is left to the
+// caller.  While batching is enabled, the server expects frames on user
+// channels, so packets are framed as single messages first.  Then the
+// compression policy of the channel is applied.  May return the given
+// packet if neither applies.
+static ENetPacket* encode_packet( ENetMpClient* client,
+                                  enet_uint8 channel,
+                                  ENetPacket* packet )
+{
+    ENetPacket* framed = packet;
+    if(client->batch_messages && channel < client->user_channel_count)
+        framed = frame_single_message(client->packet_pool, packet);
+    if(!compressor_is_enabled(&client->compressor, channel))
+        return framed;
+    ENetPacket* compressed = compress_packet(&client->compressor, channel, framed);
+    if(framed != packet)
+        enet_packet_destroy(framed);
+    return compressed;
+}
+
+// Like encode_packet, but for packets which the client owns from here on;
+// the original is destroyed unless it is referenced elsewhere.
+static ENetPacket* prepare_packet( ENetMpClient* client,
+                                   enet_uint8 channel,
+                                   ENetPacket* packet )
+{
+    ENetPacket* encoded = encode_packet(client, channel, packet);
+    if(encoded != packet && packet->referenceCount == 0)
+        enet_packet_destroy(packet);
+    return encoded;
+}
+
+static int send_to_server( ENetMpClient* client,
+                           enet_uint8 channel,
+                           ENetPacket* packet )
+{
+    // Until the session is resumed, the server would not know where
+    // packets belong.
+    if(client->resuming)
+        return -1;
+    const int size = (int)packet->dataLength;
+    const int result = enet_peer_send(client->server_peer, channel, packet);
+    if(result == 0)
+        peer_metrics_count_sent(&client->metrics, channel, size);
+    return result;
+}
+
+// For packets which the application can't be told about.  Sends fail
+// while the client isn't connected or is resuming.
+static void send_or_drop( ENetMpClient* client,
+                          enet_uint8 channel,
+                          ENetPacket* packet )
+{
+    if(send_to_server(client, channel, packet) == 0)
+        return;
+    if(packet->referenceCount == 0)
+        enet_packet_destroy(packet);
+}
+
+static void end_callback( ENetMpClient* client, enet_uint32 start_time )
+{
+    histogram_record(&client->callback_duration,
+                     get_microseconds() - start_time);
+}
+
+static void send_batch( void* context,
+                        MessageBatcher* batcher,
+                        enet_uint8 channel,
+                        ENetPacket* packet )
+{
+    ENetMpClient* client = (ENetMpClient*)context;
+    // Batches are framed already.
+    if(compressor_is_enabled(&client->compressor, channel))
+    {
+        ENetPacket* compressed = compress_packet(&client->compressor, channel, packet);
+        enet_packet_destroy(packet);
+        packet = compressed;
+    }
+    send_or_drop(client, channel, packet);
+}
+
+static void connect_to_shard( ENetMpClient* client, int shard )
+{
+    client->shard = shard;
+    client->server_address = client->first_shard_address;
+    client->server_address.port = (enet_uint16)(client->server_address.port + shard);
+    client->server_peer = enet_host_connect(client->host,
+                                            &client->server_address,
+                                            client->user_channel_count + INTERNAL_CHANNEL_COUNT,
+                                            CLIENT_CONNECTION);
+    assert(client->server_peer);
+}
+
 ENetMpClient* enet_mp_client_create( const ENetMpClientConfiguration* config )
 {
     assert(config->channel_count >= 0);
+    assert(config->resume_timeout >= 0);
 
     ENetMpClient* client = calloc(1, sizeof(ENetMpClient));
 
     client->user_data = config->user_data;
     client->callbacks = config->callbacks;
     client->user_channel_count = config->channel_count;
+    logger_init(&client->logger, &config->log);
+    variable_registry_init(&client->variables);
+    snapshot_ring_init(&client->snapshots);
+    client->unsent_snapshot_ack = 0;
+    client->batch_messages = config->batch_messages != 0;
+    client->resume_timeout = (enet_uint32)config->resume_timeout;
+    client->session_slot = -1;
+    client->packet_pool = packet_pool_create(false);
+    compressor_init(&client->compressor,
+                    &config->compression,
+                    client->user_channel_count,
+                    get_internal_channel(SNAPSHOT_CHANNEL, client->user_channel_count),
+                    client->packet_pool);
+    peer_metrics_init(&client->metrics,
+                      client->user_channel_count + INTERNAL_CHANNEL_COUNT,
+                      NULL);
     client->host = enet_host_create(NULL, // do not bind the host to an address
                                     1, // at most one connection (the server)
-                                    client->user_channel_count,
-                                    0, // unlimited ingoing bandwidth
-                                    0); // unlimited outgoing bandwidth
+                                    client->user_channel_count + INTERNAL_CHANNEL_COUNT,
+                                    config->incoming_bandwidth,
+                                    config->outgoing_bandwidth);
     assert(client->host);
 
     if(config->auth_data)
@@ -56,11 +200,21 @@ ENetMpClient* enet_mp_client_create( const ENetMpClientConfiguration* config )
         client->auth_data_size = 0;
     }
 
-    client->server_peer = enet_host_connect(client->host,
-                                            &config->server_address,
-                                            client->user_channel_count,
-                                            CLIENT_CONNECTION);
-    assert(client->server_peer);
+    // Spread clients over the shards of the server.
+    assert(config->shard_count >= 0);
+    client->first_shard_address = config->server_address;
+    client->shard_count = config->shard_count > 1 ? config->shard_count : 1;
+    enet_uint32 random = 0;
+    if(client->shard_count > 1 && !get_random_bytes(&random, sizeof(random)))
+        random = enet_time_get();
+    connect_to_shard(client, (int)(random % (enet_uint32)client->shard_count));
+
+    message_batcher_init(&client->batcher,
+                         client->user_channel_count,
+                         get_message_batch_capacity(client->server_peer),
+                         client->packet_pool,
+                         send_batch,
+                         client);
 
     return client;
 }
@@ -68,9 +222,16 @@ ENetMpClient* enet_mp_client_create( const ENetMpClientConfiguration* config )
 void enet_mp_client_destroy( ENetMpClient* client )
 {
     enet_peer_disconnect_now(client->server_peer, ENET_MP_DISCONNECT_MANUAL);
+    message_batcher_destroy(&client->batcher);
     enet_host_destroy(client->host);
+    compressor_destroy(&client->compressor);
+    peer_metrics_destroy(&client->metrics);
+    // Destroyed after the host, which still releases queued packets.
+    packet_pool_destroy(client->packet_pool);
     if(client->auth_data)
         free(client->auth_data);
+    variable_registry_destroy(&client->variables);
+    snapshot_ring_destroy(&client->snapshots);
     free(client);
 }
 
@@ -81,27 +242,73 @@ static void handle_connect( void* context,
     ENetMpClient* client = (ENetMpClient*)context;
     assert(peer == client->server_peer);
 
-    const int size = sizeof(ClientAuthRequestHeader) +
-                     client->auth_data_size;
-    char* data = send_internal_message(client->server_peer,
-                                       CLIENT_AUTH_REQUEST_MESSAGE,
-                                       size,
-                                       client->user_channel_count);
-
-    ClientAuthRequestHeader* header = (ClientAuthRequestHeader*)data;
-    // No need to fill out header as its empty.
+    ENetMpBitWriter writer;
+    begin_internal_message(&writer,
+                           client->packet_pool,
+                           CLIENT_AUTH_REQUEST_MESSAGE,
+                           2 + 2*MAX_VARINT_SIZE +
+                           client->auth_data_size + sizeof(SessionToken));
+    enet_mp_bit_writer_write_varint(&writer, (enet_uint32)client->auth_data_size);
+    enet_mp_bit_writer_write_bytes(&writer, client->auth_data, client->auth_data_size);
+    enet_mp_bit_writer_write_bool(&writer, client->resuming);
+    if(client->resuming)
+        write_session(&writer, client->session_slot, &client->session);
+    send_internal_message(&writer, client->server_peer, client->user_channel_count);
+    peer_metrics_count_sent(&client->metrics,
+                            get_internal_channel(MESSAGE_CHANNEL, client->user_channel_count),
+                            (int)writer.packet->dataLength);
+}
 
-    if(client->auth_data)
-    {
-        assert(client->auth_data_size > 0);
+// Full shards don't mean that the server is full, so the others are tried
+// before giving up.  The auth data is kept until then.
+static bool try_next_shard( ENetMpClient* client, ENetMpDisconnectReason reason )
+{
+    if(reason != ENET_MP_DISCONNECT_SERVER_FULL ||
+       client->activated ||
+       client->tried_shard_count + 1 >= client->shard_count)
+        return false;
+
+    client->tried_shard_count++;
+    connect_to_shard(client, (client->shard + 1) % client->shard_count);
+    LOG(&client->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+        "Shard is full; trying shard %d", client->shard);
+    return true;
+}
 
-        char* auth_data_target = &data[size - client->auth_data_size];
-        memcpy(auth_data_target, client->auth_data, client->auth_data_size);
+// Connections which time out carry no reason.  Any other reason was the
+// decision of the server, which is final.
+static bool try_resume( ENetMpClient* client, ENetMpDisconnectReason reason )
+{
+    if(reason != ENET_MP_DISCONNECT_UNKNOWN ||
+       client->resume_timeout == 0 ||
+       !is_session_token_set(&client->session))
+        return false;
 
-        free(client->auth_data);
-        client->auth_data = NULL;
-        client->auth_data_size = 0;
+    const enet_uint32 time = enet_time_get();
+    if(!client->resuming)
+    {
+        client->resuming = true;
+        client->resume_deadline = time + client->resume_timeout;
+        LOG(&client->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+            "Connection dropped; trying to resume the session");
+        if(client->callbacks.connection_interrupted)
+        {
+            const enet_uint32 start_time = get_microseconds();
+            client->callbacks.connection_interrupted(client);
+            end_callback(client, start_time);
+        }
+    }
+    else if(!ENET_TIME_LESS(time, client->resume_deadline))
+    {
+        return false;
     }
+
+    client->server_peer = enet_host_connect(client->host,
+                                            &client->server_address,
+                                            client->user_channel_count + INTERNAL_CHANNEL_COUNT,
+                                            CLIENT_CONNECTION);
+    assert(client->server_peer);
+    return true;
 }
 
 static void handle_disconnect( void* context,
@@ -110,47 +317,260 @@ static void handle_disconnect( void* context,
 {
     ENetMpClient* client = (ENetMpClient*)context;
     assert(peer == client->server_peer);
-    printf("handle_disconnect: reason='%s'\n",
-            disconnect_reason_as_string(reason));
+    if(try_next_shard(client, reason) || try_resume(client, reason))
+        return;
+    client->resuming = false;
+    memset(&client->session, 0, sizeof(SessionToken));
+    LOG(&client->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+        "handle_disconnect: reason='%s'",
+        disconnect_reason_as_string(reason));
+    const enet_uint32 start_time = get_microseconds();
     client->callbacks.disconnected(client, reason);
+    end_callback(client, start_time);
 }
 
 static void handle_activation_message( ENetMpClient* client,
-                                       const char* data,
-                                       int size )
+                                       ENetMpBitReader* reader )
+{
+    const bool resumed = enet_mp_bit_reader_read_bool(reader) != 0;
+    const bool resumable = enet_mp_bit_reader_read_bool(reader) != 0;
+    SessionToken session;
+    memset(&session, 0, sizeof(SessionToken));
+    int session_slot = -1;
+    if(resumable)
+        session_slot = read_session(reader, &session);
+    if(enet_mp_bit_reader_has_error(reader) || (resumable && session_slot < 0))
+    {
+        LOG(&client->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+            "Received malformed activation message");
+        return;
+    }
+    client->session = session;
+    client->session_slot = session_slot;
+
+    if(!client->activated)
+    {
+        client->activated = true;
+        if(client->auth_data)
+        {
+            free(client->auth_data);
+            client->auth_data = NULL;
+            client->auth_data_size = 0;
+        }
+    }
+
+    if(!client->resuming)
+        return;
+    client->resuming = false;
+    LOG(&client->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+        "Session resumed");
+    if(resumed && client->callbacks.connection_resumed)
+    {
+        const enet_uint32 start_time = get_microseconds();
+        client->callbacks.connection_resumed(client);
+        end_callback(client, start_time);
+    }
+}
+
+// ENet keeps trying to connect for longer than the resume timeout.
+static void check_resume_deadline( ENetMpClient* client )
 {
-    UNIMPLEMENTED();
+    if(!client->resuming ||
+       ENET_TIME_LESS(enet_time_get(), client->resume_deadline))
+        return;
+
+    enet_peer_reset(client->server_peer);
+    client->resuming = false;
+    memset(&client->session, 0, sizeof(SessionToken));
+    LOG(&client->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+        "Giving up to resume the session");
+    const enet_uint32 start_time = get_microseconds();
+    client->callbacks.disconnected(client, ENET_MP_DISCONNECT_UNKNOWN);
+    end_callback(client, start_time);
 }
 
 static void handle_internal_message( ENetMpClient* client,
                                      const ENetPacket* packet )
 {
-    MessageType type;
-    int size;
-    const char* data = read_internal_message(packet, &type, &size);
+    ENetMpBitReader reader;
+    enet_mp_bit_reader_init_packet(&reader, packet);
+    const MessageType type = read_message_type(&reader);
 
     switch(type)
     {
         case SERVER_CLIENT_ACTIVATION_MESSAGE:
-            handle_activation_message(client, data, size);
+            handle_activation_message(client, &reader);
             break;
 
         default:
-            assert(!"Unknown internal message type!");
+            LOG(&client->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+                "Received unknown internal message type %d", (int)type);
     }
 }
 
+static void handle_variable_changed( void* context, int variable )
+{
+    ENetMpClient* client = (ENetMpClient*)context;
+    if(client->callbacks.variable_changed)
+    {
+        const enet_uint32 start_time = get_microseconds();
+        client->callbacks.variable_changed(client, variable);
+        end_callback(client, start_time);
+    }
+}
+
+static void handle_variables( ENetMpClient* client, const ENetPacket* packet )
+{
+    if(!variable_registry_decode(&client->variables,
+                                 (const char*)packet->data,
+                                 (int)packet->dataLength,
+                                 handle_variable_changed,
+                                 client))
+        LOG(&client->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+            "Received malformed variables; are they registered in the same order?");
+}
+
+static bool apply_snapshot( ENetMpClient* client, const ENetPacket* packet )
+{
+    if(packet->dataLength < sizeof(SnapshotHeader))
+        return false;
+
+    const SnapshotHeader* header = (const SnapshotHeader*)packet->data;
+    const enet_uint32 sequence = ENET_NET_TO_HOST_32(header->sequence);
+    const enet_uint32 baseline_sequence = ENET_NET_TO_HOST_32(header->baseline_sequence);
+    const enet_uint32 size = ENET_NET_TO_HOST_32(header->size);
+
+    SnapshotRing* ring = &client->snapshots;
+    if(sequence == 0 || sequence <= ring->last_sequence)
+        return true; // Outdated, but not malformed.
+
+    const Snapshot* baseline = NULL;
+    if(baseline_sequence != 0)
+    {
+        baseline = snapshot_ring_find(ring, baseline_sequence);
+        if(!baseline)
+        {
+            LOG(&client->logger, ENET_MP_LOG_DEBUG, ENET_MP_LOG_CATEGORY_PROTOCOL,
+                "Dropped snapshot %u, because baseline %u is missing",
+                sequence, baseline_sequence);
+            return true;
+        }
+    }
+
+    const char* delta = (const char*)&packet->data[sizeof(SnapshotHeader)];
+    const int delta_size = (int)(packet->dataLength - sizeof(SnapshotHeader));
+
+    if(size > MAX_SNAPSHOT_SIZE)
+        return false;
+
+    const enet_uint32 previous_sequence = ring->last_sequence;
+    Snapshot* snapshot = snapshot_ring_store(ring, sequence, NULL, (int)size);
+    if(!decode_snapshot_delta(baseline ? baseline->data : NULL,
+                              baseline ? baseline->size : 0,
+                              delta,
+                              delta_size,
+                              snapshot->data,
+                              snapshot->size))
+    {
+        snapshot->sequence = 0;
+        ring->last_sequence = previous_sequence;
+        return false;
+    }
+
+    client->unsent_snapshot_ack = sequence;
+    if(client->callbacks.received_snapshot)
+    {
+        const enet_uint32 start_time = get_microseconds();
+        client->callbacks.received_snapshot(client, snapshot->data, snapshot->size);
+        end_callback(client, start_time);
+    }
+    return true;
+}
+
+static void handle_snapshot( ENetMpClient* client, const ENetPacket* packet )
+{
+    if(!apply_snapshot(client, packet))
+        LOG(&client->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+            "Received malformed snapshot");
+}
+
+// The ack is queued at the end of a service call, so ENet can send it in the
+// same datagram as the other outgoing traffic.
+static void send_snapshot_ack( ENetMpClient* client )
+{
+    if(client->unsent_snapshot_ack == 0 || client->resuming)
+        return;
+
+    ENetPacket* packet = packet_pool_acquire(client->packet_pool,
+                                             sizeof(SnapshotAck),
+                                             0);
+    SnapshotAck* ack = (SnapshotAck*)packet->data;
+    ack->sequence = ENET_HOST_TO_NET_32(client->unsent_snapshot_ack);
+
+    const enet_uint8 channel = get_internal_channel(SNAPSHOT_CHANNEL,
+                                                    client->user_channel_count);
+    send_or_drop(client, channel, packet);
+    client->unsent_snapshot_ack = 0;
+}
+
+typedef struct _MessageContext
+{
+    ENetMpClient* client;
+    int channel;
+
+} MessageContext;
+
+static void handle_batched_message( void* context, const ENetPacket* message )
+{
+    const MessageContext* c = (const MessageContext*)context;
+    const enet_uint32 start_time = get_microseconds();
+    c->client->callbacks.received_packet(c->client, c->channel, message);
+    end_callback(c->client, start_time);
+}
+
+static void handle_user_packet( ENetMpClient* client,
+                                int channel,
+                                const ENetPacket* packet )
+{
+    if(!client->batch_messages)
+    {
+        const enet_uint32 start_time = get_microseconds();
+        client->callbacks.received_packet(client, channel, packet);
+        end_callback(client, start_time);
+        return;
+    }
+
+    MessageContext context = { client, channel };
+    if(!split_message_batch(packet, handle_batched_message, &context))
+        LOG(&client->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+            "Received malformed message batch");
+}
+
 static void handle_receive( void* context,
                             ENetPeer* peer,
                             int channel,
                             const ENetPacket* packet )
 {
     ENetMpClient* client = (ENetMpClient*)context;
+    peer_metrics_count_received(&client->metrics, channel, (int)packet->dataLength);
+
+    ENetPacket* decompressed = NULL;
+    if(compressor_is_enabled(&client->compressor, channel))
+    {
+        decompressed = decompress_packet(&client->compressor, channel, packet);
+        if(!decompressed)
+        {
+            LOG(&client->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+                "Received malformed compressed packet on channel %d", channel);
+            return;
+        }
+        packet = decompressed;
+    }
 
     const int user_channel_count = client->user_channel_count;
     if(channel < user_channel_count)
     {
-        client->callbacks.received_packet(client, channel, packet);
+        handle_user_packet(client, channel, packet);
     }
     else
     {
@@ -163,17 +583,106 @@ static void handle_receive( void* context,
                 handle_internal_message(client, packet);
                 break;
 
+            case VARIABLE_CHANNEL:
+                handle_variables(client, packet);
+                break;
+
+            case SNAPSHOT_CHANNEL:
+                handle_snapshot(client, packet);
+                break;
+
             default:
                 assert(!"Unknown internal channel!");
         }
     }
+
+    // Callbacks may have retained the packet.
+    if(decompressed && decompressed->referenceCount == 0)
+        enet_packet_destroy(decompressed);
+}
+
+// Work which follows the event handling of each service call.
+static void finish_service( ENetMpClient* client )
+{
+    check_resume_deadline(client);
+    send_snapshot_ack(client);
+    enet_mp_client_flush_messages(client);
+    peer_metrics_sample(&client->metrics, client->server_peer);
 }
 
 void enet_mp_client_service( ENetMpClient* client, int timeout )
 {
-    host_service(client->host, timeout, client, handle_connect,
-                                                handle_disconnect,
-                                                handle_receive);
+    const enet_uint32 start_time = get_microseconds();
+    host_service(client->host,
+                 timeout,
+                 &client->logger,
+                 client,
+                 handle_connect,
+                 handle_disconnect,
+                 handle_receive);
+    finish_service(client);
+    histogram_record(&client->service_duration, get_microseconds() - start_time);
+}
+
+int enet_mp_client_service_all( ENetMpClient* client,
+                                int timeout,
+                                int max_events,
+                                int time_budget )
+{
+    const enet_uint32 start_time = get_microseconds();
+    const int event_count = host_service_all(client->host,
+                                             timeout,
+                                             max_events,
+                                             time_budget,
+                                             &client->logger,
+                                             client,
+                                             handle_connect,
+                                             handle_disconnect,
+                                             handle_receive);
+    finish_service(client);
+    enet_host_flush(client->host);
+    histogram_record(&client->service_duration, get_microseconds() - start_time);
+    return event_count;
+}
+
+ENetSocket enet_mp_client_get_socket( ENetMpClient* client )
+{
+    return client->host->socket;
+}
+
+int enet_mp_client_get_timeout( ENetMpClient* client )
+{
+    const bool connected = client->server_peer->state == ENET_PEER_STATE_CONNECTED &&
+                           !client->resuming;
+    if(connected &&
+       (client->unsent_snapshot_ack != 0 ||
+        message_batcher_has_pending(&client->batcher)))
+        return 0;
+
+    int timeout = get_host_timeout(client->host, INT_MAX);
+    if(client->resuming)
+        timeout = limit_timeout(timeout, client->resume_deadline, enet_time_get());
+    return timeout;
+}
+
+int enet_mp_client_process_readable( ENetMpClient* client )
+{
+    const enet_uint32 start_time = get_microseconds();
+    const int event_count = host_process(client->host,
+                                         &client->logger,
+                                         client,
+                                         handle_connect,
+                                         handle_disconnect,
+                                         handle_receive);
+    finish_service(client);
+    enet_host_flush(client->host);
+    histogram_record(&client->service_duration, get_microseconds() - start_time);
+    return event_count;
+}
+
+void enet_mp_client_handle_timers( ENetMpClient* client )
+{
+    enet_mp_client_service_all(client, 0, 0, 0);
 }
 
 void* enet_mp_client_get_user_data( ENetMpClient* client )
@@ -190,3 +699,106 @@ ENetPeer* enet_mp_client_get_server_peer( ENetMpClient* client )
 {
     return client->server_peer;
 }
+
+ENetPacket* enet_mp_client_acquire_packet( ENetMpClient* client,
+                                           int size,
+                                           enet_uint32 flags )
+{
+    return packet_pool_acquire(client->packet_pool, size, flags);
+}
+
+int enet_mp_client_send( ENetMpClient* client,
+                         int channel,
+                         ENetPacket* packet )
+{
+    assert(is_in_bounds(channel, client->user_channel_count));
+
+    // The packet stays with the caller if the send fails, so the original
+    // is only given up once its encoded copy has been sent.
+    ENetPacket* sent_packet = encode_packet(client, (enet_uint8)channel, packet);
+    const int result = send_to_server(client, (enet_uint8)channel, sent_packet);
+
+    ENetPacket* unused_packet = result == 0 ? packet : sent_packet;
+    if(sent_packet != packet && unused_packet->referenceCount == 0)
+        enet_packet_destroy(unused_packet);
+    return result;
+}
+
+void enet_mp_client_queue_message( ENetMpClient* client,
+                                   int channel,
+                                   const void* data,
+                                   int size,
+                                   enet_uint32 flags )
+{
+    assert(is_in_bounds(channel, client->user_channel_count));
+
+    if(!client->batch_messages)
+    {
+        ENetPacket* packet = packet_pool_create_packet(client->packet_pool,
+                                                       data,
+                                                       size,
+                                                       flags);
+        packet = prepare_packet(client, (enet_uint8)channel, packet);
+        send_or_drop(client, (enet_uint8)channel, packet);
+        return;
+    }
+
+    message_batcher_add(&client->batcher,
+                        (enet_uint8)channel,
+                        data,
+                        size,
+                        flags);
+}
+
+void enet_mp_client_flush_messages( ENetMpClient* client )
+{
+    // Batches are kept until the connection can take them.
+    if(client->server_peer->state != ENET_PEER_STATE_CONNECTED ||
+       client->resuming)
+        return;
+    message_batcher_flush(&client->batcher);
+}
+
+int enet_mp_client_register_variable( ENetMpClient* client,
+                                      ENetMpVariableType type,
+                                      int size )
+{
+    return variable_registry_add(&client->variables, type, size);
+}
+
+const void* enet_mp_client_get_variable( ENetMpClient* client,
+                                         int variable )
+{
+    return variable_registry_get(&client->variables, variable);
+}
+
+void enet_mp_client_get_compression_statistics( ENetMpClient* client,
+                                                int channel,
+                                                ENetMpCompressionStatistics* statistics )
+{
+    assert(is_in_bounds(channel, client->user_channel_count));
+    compressor_get_statistics(&client->compressor, channel, statistics);
+}
+
+void enet_mp_client_get_metrics( ENetMpClient* client,
+                                 ENetMpClientMetrics* metrics )
+{
+    metrics->connection = client->metrics.connection;
+    metrics->service_duration = client->service_duration;
+    metrics->callback_duration = client->callback_duration;
+}
+
+void enet_mp_client_reset_metrics( ENetMpClient* client )
+{
+    peer_metrics_reset(&client->metrics);
+    histogram_clear(&client->service_duration);
+    histogram_clear(&client->callback_duration);
+}
+
+void enet_mp_client_get_channel_metrics( ENetMpClient* client,
+                                         int channel,
+                                         ENetMpChannelMetrics* metrics )
+{
+    assert(is_in_bounds(channel, client->user_channel_count));
+    *metrics = client->metrics.channels[channel];
+}
@@ -0,0 +1,392 @@
+#include <assert.h>
+#include <stdlib.h> // malloc, calloc, realloc, free
+#include <string.h> // memcpy, memset
+#include "enet_mp.h"
+#include "enet_mp_shared.h"
+#include "enet_mp_compression.h"
+
+
+enum
+{
+    MIN_MATCH = 4,
+    HASH_BITS = 12,
+    HASH_SIZE = 1 << HASH_BITS,
+
+    // Protects receivers against packets which decompress to huge sizes.
+    DEFAULT_MAX_DECOMPRESSED_SIZE = 1 << 24,
+
+    // Receivers only allocate this much per received byte.  Both codecs
+    // could go beyond, so data which compresses better is sent as is.
+    MAX_COMPRESSION_RATIO = 256
+};
+
+// Matches may reach this far back, including into the dictionary.
+static const int MAX_OFFSET = 65535;
+
+static enet_uint32 read_uint32( const char* data )
+{
+    enet_uint32 value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static int hash_sequence( const char* data )
+{
+    return (int)((read_uint32(data) * 2654435761u) >> (32 - HASH_BITS));
+}
+
+static void init_dictionary( Compressor* compressor,
+                             const void* dictionary,
+                             int dictionary_size )
+{
+    compressor->dictionary_size = dictionary_size;
+    compressor->window_capacity = dictionary_size + 1536;
+    compressor->window = (char*)malloc(compressor->window_capacity);
+    if(dictionary_size > 0)
+        memcpy(compressor->window, dictionary, dictionary_size);
+
+    compressor->dictionary_table = (int*)malloc(HASH_SIZE * sizeof(int));
+    compressor->table = (int*)malloc(HASH_SIZE * sizeof(int));
+    int i = 0;
+    for(; i < HASH_SIZE; i++)
+        compressor->dictionary_table[i] = -1;
+    for(i = 0; i + MIN_MATCH <= dictionary_size; i++)
+        compressor->dictionary_table[hash_sequence(&compressor->window[i])] = i;
+}
+
+void compressor_init( Compressor* compressor,
+                      const ENetMpCompressionConfiguration* config,
+                      int user_channel_count,
+                      int snapshot_channel,
+                      PacketPool* pool )
+{
+    assert(config->dictionary_size >= 0);
+    memset(compressor, 0, sizeof(Compressor));
+
+    const int channel_count = user_channel_count + INTERNAL_CHANNEL_COUNT;
+    compressor->channel_count = channel_count;
+    compressor->policies =
+        (ENetMpChannelCompression*)calloc(channel_count, sizeof(ENetMpChannelCompression));
+    compressor->statistics =
+        (ENetMpCompressionStatistics*)calloc(channel_count, sizeof(ENetMpCompressionStatistics));
+    compressor->pool = pool;
+
+    if(config->channels)
+        memcpy(compressor->policies,
+               config->channels,
+               user_channel_count * sizeof(ENetMpChannelCompression));
+    if(snapshot_channel >= 0)
+        compressor->policies[snapshot_channel] = config->snapshots;
+
+    assert(config->max_decompressed_size >= 0);
+    compressor->max_decompressed_size = config->max_decompressed_size > 0
+                                        ? config->max_decompressed_size
+                                        : DEFAULT_MAX_DECOMPRESSED_SIZE;
+
+    init_dictionary(compressor, config->dictionary, config->dictionary_size);
+}
+
+void compressor_destroy( Compressor* compressor )
+{
+    if(compressor->range_coder)
+        enet_range_coder_destroy(compressor->range_coder);
+    free(compressor->policies);
+    free(compressor->statistics);
+    free(compressor->window);
+    free(compressor->dictionary_table);
+    free(compressor->table);
+    memset(compressor, 0, sizeof(Compressor));
+}
+
+bool compressor_is_enabled( const Compressor* compressor, int channel )
+{
+    assert(is_in_bounds(channel, compressor->channel_count));
+    return compressor->policies[channel].method != ENET_MP_COMPRESSION_NONE;
+}
+
+static char* write_lz_varint( enet_uint32 value, char* destination, const char* end )
+{
+    if(end - destination < MAX_VARINT_SIZE)
+        return NULL;
+    return destination + write_varint(value, destination);
+}
+
+int lz_compress( Compressor* compressor,
+                 const char* data,
+                 int size,
+                 char* destination,
+                 int capacity )
+{
+    const int dictionary_size = compressor->dictionary_size;
+    if(dictionary_size + size > compressor->window_capacity)
+    {
+        compressor->window_capacity = dictionary_size + size;
+        compressor->window = (char*)realloc(compressor->window,
+                                            compressor->window_capacity);
+    }
+    char* window = compressor->window;
+    memcpy(&window[dictionary_size], data, size);
+    int* table = compressor->table;
+    memcpy(table, compressor->dictionary_table, HASH_SIZE * sizeof(int));
+
+    const int end = dictionary_size + size;
+    char* output = destination;
+    const char* output_end = destination + capacity;
+    int anchor = dictionary_size;
+    int position = dictionary_size;
+    while(position + MIN_MATCH <= end)
+    {
+        const int hash = hash_sequence(&window[position]);
+        const int candidate = table[hash];
+        table[hash] = position;
+
+        if(candidate < 0 ||
+           position - candidate > MAX_OFFSET ||
+           read_uint32(&window[candidate]) != read_uint32(&window[position]))
+        {
+            position++;
+            continue;
+        }
+
+        int length = MIN_MATCH;
+        while(position + length < end &&
+              window[candidate + length] == window[position + length])
+            length++;
+
+        const int literal_count = position - anchor;
+        output = write_lz_varint((enet_uint32)literal_count, output, output_end);
+        if(!output || output_end - output < literal_count)
+            return -1;
+        memcpy(output, &window[anchor], literal_count);
+        output += literal_count;
+        output = write_lz_varint((enet_uint32)(position - candidate), output, output_end);
+        if(!output)
+            return -1;
+        output = write_lz_varint((enet_uint32)(length - MIN_MATCH), output, output_end);
+        if(!output)
+            return -1;
+
+        position += length;
+        anchor = position;
+    }
+
+    const int literal_count = end - anchor;
+    output = write_lz_varint((enet_uint32)literal_count, output, output_end);
+    if(!output || output_end - output < literal_count)
+        return -1;
+    memcpy(output, &window[anchor], literal_count);
+    output += literal_count;
+    return (int)(output - destination);
+}
+
+bool lz_decompress( const Compressor* compressor,
+                    const char* data,
+                    int data_size,
+                    char* destination,
+                    int size )
+{
+    const char* dictionary = compressor->window;
+    const int dictionary_size = compressor->dictionary_size;
+    const char* end = data + data_size;
+    int position = 0;
+    for(;;)
+    {
+        enet_uint32 literal_count;
+        int length = read_varint(data, (int)(end - data), &literal_count);
+        if(length == 0)
+            return false;
+        data += length;
+        if(literal_count > (enet_uint32)(end - data) ||
+           literal_count > (enet_uint32)(size - position))
+            return false;
+        memcpy(&destination[position], data, literal_count);
+        data += literal_count;
+        position += (int)literal_count;
+
+        if(data == end)
+            return position == size;
+
+        enet_uint32 offset;
+        enet_uint32 match_length;
+        length = read_varint(data, (int)(end - data), &offset);
+        if(length == 0)
+            return false;
+        data += length;
+        length = read_varint(data, (int)(end - data), &match_length);
+        if(length == 0)
+            return false;
+        data += length;
+
+        match_length += MIN_MATCH;
+        if(offset == 0 ||
+           offset > (enet_uint32)(position + dictionary_size) ||
+           match_length > (enet_uint32)(size - position))
+            return false;
+
+        // Matches may overlap their own output, so they're copied bytewise.
+        int source = position - (int)offset;
+        const int match_end = position + (int)match_length;
+        for(; position < match_end; position++, source++)
+        {
+            if(source < 0)
+                destination[position] = dictionary[dictionary_size + source];
+            else
+                destination[position] = destination[source];
+        }
+    }
+}
+
+static int compress_payload( Compressor* compressor,
+                             ENetMpCompressionMethod method,
+                             const ENetPacket* packet,
+                             char* destination,
+                             int capacity )
+{
+    switch(method)
+    {
+        case ENET_MP_COMPRESSION_RANGE_CODER:
+        {
+            if(!compressor->range_coder)
+                compressor->range_coder = enet_range_coder_create();
+            if(!compressor->range_coder)
+                return -1;
+            ENetBuffer buffer;
+            buffer.data = packet->data;
+            buffer.dataLength = packet->dataLength;
+            const size_t size = enet_range_coder_compress(compressor->range_coder,
+                                                          &buffer,
+                                                          1,
+                                                          packet->dataLength,
+                                                          (enet_uint8*)destination,
+                                                          capacity);
+            return size > 0 ? (int)size : -1;
+        }
+
+        case ENET_MP_COMPRESSION_LZ:
+            return lz_compress(compressor,
+                               (const char*)packet->data,
+                               (int)packet->dataLength,
+                               destination,
+                               capacity);
+
+        default:
+            assert(!"Unknown compression method!");
+            return -1;
+    }
+}
+
+ENetPacket* compress_packet( Compressor* compressor,
+                             int channel,
+                             ENetPacket* packet )
+{
+    assert(compressor_is_enabled(compressor, channel));
+    const ENetMpChannelCompression* policy = &compressor->policies[channel];
+    ENetMpCompressionStatistics* statistics = &compressor->statistics[channel];
+    const int size = (int)packet->dataLength;
+    const enet_uint32 flags = packet->flags & ~ENET_PACKET_FLAG_NO_ALLOCATE;
+
+    // Compression only pays off if it saves more than the header.
+    ENetPacket* result = packet_pool_acquire(compressor->pool, 1 + size, flags);
+    char* data = (char*)result->data;
+    int result_size = -1;
+    if(size >= policy->threshold && size > MAX_VARINT_SIZE)
+    {
+        const int header_size = 1 + write_varint((enet_uint32)size, &data[1]);
+        const int payload_size = compress_payload(compressor,
+                                                  policy->method,
+                                                  packet,
+                                                  &data[header_size],
+                                                  1 + size - header_size);
+        if(payload_size >= 0 &&
+           header_size + payload_size < 1 + size &&
+           size <= compressor->max_decompressed_size &&
+           (double)size <= (double)payload_size * MAX_COMPRESSION_RATIO)
+        {
+            data[0] = (char)policy->method;
+            result_size = header_size + payload_size;
+            statistics->compressed_packet_count++;
+        }
+    }
+    if(result_size < 0)
+    {
+        data[0] = (char)ENET_MP_COMPRESSION_NONE;
+        memcpy(&data[1], packet->data, size);
+        result_size = 1 + size;
+    }
+    enet_packet_resize(result, result_size);
+
+    statistics->packet_count++;
+    statistics->uncompressed_size += (unsigned long long)size;
+    statistics->compressed_size += (unsigned long long)result_size;
+    return result;
+}
+
+ENetPacket* decompress_packet( Compressor* compressor,
+                               int channel,
+                               const ENetPacket* packet )
+{
+    assert(is_in_bounds(channel, compressor->channel_count));
+    if(packet->dataLength < 1)
+        return NULL;
+    const char* data = (const char*)packet->data;
+    const int data_size = (int)packet->dataLength;
+    const ENetMpCompressionMethod method = (ENetMpCompressionMethod)(enet_uint8)data[0];
+    const enet_uint32 flags = packet->flags & ~ENET_PACKET_FLAG_NO_ALLOCATE;
+
+    if(method == ENET_MP_COMPRESSION_NONE)
+        return packet_pool_create_packet(compressor->pool, &data[1], data_size - 1, flags);
+
+    enet_uint32 size;
+    const int length = read_varint(&data[1], data_size - 1, &size);
+    if(length == 0)
+        return NULL;
+    const char* payload = &data[1 + length];
+    const int payload_size = data_size - 1 - length;
+
+    // The claimed size is checked before it's allocated.
+    if(size > (enet_uint32)compressor->max_decompressed_size ||
+       (double)size > (double)payload_size * MAX_COMPRESSION_RATIO)
+        return NULL;
+
+    ENetPacket* result = packet_pool_acquire(compressor->pool, (int)size, flags);
+    bool success = false;
+    switch(method)
+    {
+        case ENET_MP_COMPRESSION_RANGE_CODER:
+            if(!compressor->range_coder)
+                compressor->range_coder = enet_range_coder_create();
+            success = compressor->range_coder &&
+                      enet_range_coder_decompress(compressor->range_coder,
+                                                  (const enet_uint8*)payload,
+                                                  payload_size,
+                                                  result->data,
+                                                  size) == size;
+            break;
+
+        case ENET_MP_COMPRESSION_LZ:
+            success = lz_decompress(compressor,
+                                    payload,
+                                    payload_size,
+                                    (char*)result->data,
+                                    (int)size);
+            break;
+
+        default:
+            break;
+    }
+
+    if(!success)
+    {
+        enet_packet_destroy(result);
+        return NULL;
+    }
+    return result;
+}
+
+void compressor_get_statistics( const Compressor* compressor,
+                                int channel,
+                                ENetMpCompressionStatistics* statistics )
+{
+    assert(is_in_bounds(channel, compressor->channel_count));
+    *statistics = compressor->statistics[channel];
+}
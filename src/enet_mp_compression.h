@@ -0,0 +1,102 @@
+#ifndef __ENET_MP_COMPRESSION_H__
+#define __ENET_MP_COMPRESSION_H__
+
+#include <stdbool.h>
+#include <enet/enet.h>
+#include "enet_mp.h"
+#include "enet_mp_pool.h"
+
+
+/**
+ * Compresses packets of individual channels.
+ *
+ * Packets of compressed channels start with the method byte.  Unless the
+ * method is #ENET_MP_COMPRESSION_NONE, it is followed by the varint encoded
+ * original size and the compressed data.  Packets which are below the
+ * threshold of their channel or don't get smaller are sent uncompressed.
+ */
+typedef struct _Compressor
+{
+    ENetMpChannelCompression* policies; // Indexed by ENet channel.
+    ENetMpCompressionStatistics* statistics; // Indexed by ENet channel.
+    int channel_count;
+    PacketPool* pool;
+    int max_decompressed_size;
+
+    void* range_coder; // Created on first use.
+
+    // The LZ window starts with the dictionary, which is followed by the
+    // data that is being compressed.
+    char* window;
+    int dictionary_size;
+    int window_capacity;
+    int* dictionary_table; // Hash table of the dictionary.
+    int* table; // Scratch copy of dictionary_table.
+
+} Compressor;
+
+
+/**
+ * @param snapshot_channel
+ * ENet channel which uses the snapshot policy or -1.
+ */
+void compressor_init( Compressor* compressor,
+                      const ENetMpCompressionConfiguration* config,
+                      int user_channel_count,
+                      int snapshot_channel,
+                      PacketPool* pool );
+
+void compressor_destroy( Compressor* compressor );
+
+bool compressor_is_enabled( const Compressor* compressor, int channel );
+
+/**
+ * Creates the packet which is sent for the given one on a channel with
+ * compression enabled.  The given packet is left to the caller, since it
+ * must outlive sends which may fail.
+ */
+ENetPacket* compress_packet( Compressor* compressor,
+                             int channel,
+                             ENetPacket* packet );
+
+/**
+ * @return
+ * New packet with the original data or `NULL` if the packet is malformed.
+ */
+ENetPacket* decompress_packet( Compressor* compressor,
+                               int channel,
+                               const ENetPacket* packet );
+
+void compressor_get_statistics( const Compressor* compressor,
+                                int channel,
+                                ENetMpCompressionStatistics* statistics );
+
+/**
+ * LZ77 codec which can refer back into a dictionary.
+ *
+ * Encoded data is a sequence of `varint literal count, literals,
+ * varint offset, varint match length - MIN_MATCH`, where the last sequence
+ * ends after its literals.
+ *
+ * @return
+ * Encoded size or -1 if it would exceed the capacity.
+ */
+int lz_compress( Compressor* compressor,
+                 const char* data,
+                 int size,
+                 char* destination,
+                 int capacity );
+
+/**
+ * @return
+ * `false` if the data is malformed or doesn't decode to exactly `size`
+ * bytes.
+ */
+bool lz_decompress( const Compressor* compressor,
+                    const char* data,
+                    int data_size,
+                    char* destination,
+                    int size );
+
+
+#endif
@@ -0,0 +1,295 @@
+#include <assert.h>
+#include <stdlib.h> // calloc, realloc, free
+#include <string.h> // memset, memmove
+#include "enet_mp.h"
+#include "enet_mp_shared.h" // is_in_bounds
+#include "enet_mp_interest.h"
+
+
+static const int INITIAL_BUCKET_COUNT = 64;
+
+// Guards against views which would subscribe to huge amounts of cells.
+static const int MAX_VIEW_CELLS_PER_AXIS = 64;
+
+static int get_cell_coordinate( const InterestGrid* grid, float position )
+{
+    const float quotient = position / grid->cell_size;
+    int coordinate = (int)quotient;
+    if((float)coordinate > quotient) // Round towards negative infinity.
+        coordinate--;
+    return coordinate;
+}
+
+static unsigned int hash_cell( int x, int y )
+{
+    return ((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u);
+}
+
+void interest_grid_init( InterestGrid* grid, float cell_size, int client_count )
+{
+    assert(cell_size > 0);
+    assert(client_count >= 0);
+    memset(grid, 0, sizeof(InterestGrid));
+    grid->cell_size = cell_size;
+    grid->bucket_count = INITIAL_BUCKET_COUNT;
+    grid->buckets = (InterestCell**)calloc(grid->bucket_count, sizeof(InterestCell*));
+    grid->views = (InterestView*)calloc(client_count > 0 ? client_count : 1,
+                                        sizeof(InterestView));
+    grid->view_count = client_count;
+    int i = 0;
+    for(; i < client_count; i++)
+    {
+        grid->views[i].min_x = 1;
+        grid->views[i].max_x = 0;
+    }
+}
+
+void interest_grid_destroy( InterestGrid* grid )
+{
+    int i = 0;
+    for(; i < grid->bucket_count; i++)
+    {
+        InterestCell* cell = grid->buckets[i];
+        while(cell)
+        {
+            InterestCell* next = cell->next;
+            free(cell->subscribers);
+            free(cell);
+            cell = next;
+        }
+    }
+    for(i = 0; i < grid->view_count; i++)
+        free(grid->views[i].cells);
+    free(grid->buckets);
+    free(grid->entity_cells);
+    free(grid->views);
+    memset(grid, 0, sizeof(InterestGrid));
+}
+
+static void grow_buckets( InterestGrid* grid )
+{
+    const int bucket_count = grid->bucket_count * 2;
+    InterestCell** buckets = (InterestCell**)calloc(bucket_count, sizeof(InterestCell*));
+    int i = 0;
+    for(; i < grid->bucket_count; i++)
+    {
+        InterestCell* cell = grid->buckets[i];
+        while(cell)
+        {
+            InterestCell* next = cell->next;
+            const unsigned int bucket = hash_cell(cell->x, cell->y) & (bucket_count-1);
+            cell->next = buckets[bucket];
+            buckets[bucket] = cell;
+            cell = next;
+        }
+    }
+    free(grid->buckets);
+    grid->buckets = buckets;
+    grid->bucket_count = bucket_count;
+}
+
+static InterestCell* get_cell( InterestGrid* grid, int x, int y )
+{
+    unsigned int bucket = hash_cell(x, y) & (grid->bucket_count-1);
+    InterestCell* cell = grid->buckets[bucket];
+    for(; cell; cell = cell->next)
+        if(cell->x == x && cell->y == y)
+            return cell;
+
+    if(grid->cell_count >= grid->bucket_count)
+    {
+        grow_buckets(grid);
+        bucket = hash_cell(x, y) & (grid->bucket_count-1);
+    }
+
+    cell = (InterestCell*)calloc(1, sizeof(InterestCell));
+    cell->x = x;
+    cell->y = y;
+    cell->next = grid->buckets[bucket];
+    grid->buckets[bucket] = cell;
+    grid->cell_count++;
+    return cell;
+}
+
+static void release_cell( InterestGrid* grid, InterestCell* cell )
+{
+    if(cell->entity_count > 0 || cell->subscriber_count > 0)
+        return;
+
+    const unsigned int bucket = hash_cell(cell->x, cell->y) & (grid->bucket_count-1);
+    InterestCell** link = &grid->buckets[bucket];
+    while(*link != cell)
+        link = &(*link)->next;
+    *link = cell->next;
+    grid->cell_count--;
+    free(cell->subscribers);
+    free(cell);
+}
+
+void interest_grid_set_entity( InterestGrid* grid, int entity, float x, float y )
+{
+    assert(entity >= 0);
+    if(entity >= grid->entity_capacity)
+    {
+        int capacity = grid->entity_capacity > 0 ? grid->entity_capacity : 64;
+        while(capacity <= entity)
+            capacity *= 2;
+        grid->entity_cells = (InterestCell**)realloc(grid->entity_cells,
+                                                     capacity * sizeof(InterestCell*));
+        memset(&grid->entity_cells[grid->entity_capacity],
+               0,
+               (capacity - grid->entity_capacity) * sizeof(InterestCell*));
+        grid->entity_capacity = capacity;
+    }
+
+    InterestCell* cell = grid->entity_cells[entity];
+    const int cell_x = get_cell_coordinate(grid, x);
+    const int cell_y = get_cell_coordinate(grid, y);
+    if(cell && cell->x == cell_x && cell->y == cell_y)
+        return;
+
+    InterestCell* new_cell = get_cell(grid, cell_x, cell_y);
+    new_cell->entity_count++;
+    grid->entity_cells[entity] = new_cell;
+    if(cell)
+    {
+        cell->entity_count--;
+        release_cell(grid, cell);
+    }
+}
+
+void interest_grid_remove_entity( InterestGrid* grid, int entity )
+{
+    if(!is_in_bounds(entity, grid->entity_capacity))
+        return;
+    InterestCell* cell = grid->entity_cells[entity];
+    if(!cell)
+        return;
+    grid->entity_cells[entity] = NULL;
+    cell->entity_count--;
+    release_cell(grid, cell);
+}
+
+static void subscribe( InterestView* view, int client, InterestCell* cell )
+{
+    if(cell->subscriber_count == cell->subscriber_capacity)
+    {
+        cell->subscriber_capacity = cell->subscriber_capacity > 0 ? cell->subscriber_capacity*2 : 4;
+        cell->subscribers = (int*)realloc(cell->subscribers,
+                                          cell->subscriber_capacity * sizeof(int));
+    }
+    cell->subscribers[cell->subscriber_count++] = client;
+
+    if(view->cell_count == view->cell_capacity)
+    {
+        view->cell_capacity = view->cell_capacity > 0 ? view->cell_capacity*2 : 16;
+        view->cells = (InterestCell**)realloc(view->cells,
+                                              view->cell_capacity * sizeof(InterestCell*));
+    }
+    view->cells[view->cell_count++] = cell;
+}
+
+// The order of subscribers doesn't matter, so the last one fills the gap.
+static void unsubscribe( InterestCell* cell, int client )
+{
+    int i = 0;
+    for(; i < cell->subscriber_count; i++)
+    {
+        if(cell->subscribers[i] == client)
+        {
+            cell->subscribers[i] = cell->subscribers[--cell->subscriber_count];
+            return;
+        }
+    }
+    assert(!"Client was not subscribed to cell!");
+}
+
+// Unsubscribes from the first cells of the view.
+static void unsubscribe_cells( InterestGrid* grid,
+                               InterestView* view,
+                               int client,
+                               int count )
+{
+    int i = 0;
+    for(; i < count; i++)
+    {
+        unsubscribe(view->cells[i], client);
+        release_cell(grid, view->cells[i]);
+    }
+    view->cell_count -= count;
+    memmove(view->cells, &view->cells[count], view->cell_count * sizeof(InterestCell*));
+}
+
+void interest_grid_clear_view( InterestGrid* grid, int client )
+{
+    assert(is_in_bounds(client, grid->view_count));
+    InterestView* view = &grid->views[client];
+    unsubscribe_cells(grid, view, client, view->cell_count);
+    view->min_x = 1;
+    view->max_x = 0;
+}
+
+// Limits the cell range to MAX_VIEW_CELLS_PER_AXIS around the center.
+static void clamp_view_range( int center, int* min, int* max )
+{
+    if(*max - *min < MAX_VIEW_CELLS_PER_AXIS)
+        return;
+    const int half = (MAX_VIEW_CELLS_PER_AXIS - 1) / 2;
+    *min = center - half;
+    *max = center + half;
+}
+
+void interest_grid_set_view( InterestGrid* grid,
+                             int client,
+                             float x,
+                             float y,
+                             float radius )
+{
+    assert(is_in_bounds(client, grid->view_count));
+    assert(radius >= 0);
+    InterestView* view = &grid->views[client];
+
+    int min_x = get_cell_coordinate(grid, x - radius);
+    int min_y = get_cell_coordinate(grid, y - radius);
+    int max_x = get_cell_coordinate(grid, x + radius);
+    int max_y = get_cell_coordinate(grid, y + radius);
+    clamp_view_range(get_cell_coordinate(grid, x), &min_x, &max_x);
+    clamp_view_range(get_cell_coordinate(grid, y), &min_y, &max_y);
+
+    // Views usually move less than a cell per update.
+    if(min_x == view->min_x && min_y == view->min_y &&
+       max_x == view->max_x && max_y == view->max_y)
+        return;
+
+    // The new cells are subscribed before the old ones are released, so
+    // cells which stay in view aren't freed and created again.
+    const int old_cell_count = view->cell_count;
+    int cell_y = min_y;
+    for(; cell_y <= max_y; cell_y++)
+    {
+        int cell_x = min_x;
+        for(; cell_x <= max_x; cell_x++)
+            subscribe(view, client, get_cell(grid, cell_x, cell_y));
+    }
+    unsubscribe_cells(grid, view, client, old_cell_count);
+    view->min_x = min_x;
+    view->min_y = min_y;
+    view->max_x = max_x;
+    view->max_y = max_y;
+}
+
+const int* interest_grid_get_subscribers( const InterestGrid* grid,
+                                          int entity,
+                                          int* count )
+{
+    const InterestCell* cell = NULL;
+    if(is_in_bounds(entity, grid->entity_capacity))
+        cell = grid->entity_cells[entity];
+    if(!cell)
+    {
+        *count = 0;
+        return NULL;
+    }
+    *count = cell->subscriber_count;
+    return cell->subscribers;
+}
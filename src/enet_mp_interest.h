@@ -0,0 +1,92 @@
+#ifndef __ENET_MP_INTEREST_H__
+#define __ENET_MP_INTEREST_H__
+
+#include <stdbool.h>
+
+
+typedef struct _InterestCell InterestCell;
+
+/**
+ * Grid cell which stores the clients that see it.  Freed once it has
+ * neither entities nor subscribers.
+ */
+struct _InterestCell
+{
+    int x, y;
+    InterestCell* next; // In the hash bucket.
+    int entity_count;
+    int* subscribers;
+    int subscriber_count;
+    int subscriber_capacity;
+};
+
+/**
+ * Cells which a client sees.
+ */
+typedef struct _InterestView
+{
+    InterestCell** cells;
+    int cell_count;
+    int cell_capacity;
+    int min_x, min_y, max_x, max_y; // Cell range, empty if min > max.
+
+} InterestView;
+
+/**
+ * Spatial hash grid which maps entities to the clients that see them.
+ *
+ * Entities are only tracked by their cell and clients subscribe to all
+ * cells which overlap their view.  So finding the receivers of an entity
+ * costs as much as there are receivers.
+ *
+ * Cells are created on demand and freed when they are no longer used, so
+ * memory depends on the occupied area, not on the area ever visited.
+ */
+typedef struct _InterestGrid
+{
+    float cell_size;
+    InterestCell** buckets;
+    int bucket_count; // Power of two.
+    int cell_count;
+    InterestCell** entity_cells; // Indexed by entity; `NULL` if unknown.
+    int entity_capacity;
+    InterestView* views; // Indexed by client slot.
+    int view_count;
+
+} InterestGrid;
+
+
+void interest_grid_init( InterestGrid* grid, float cell_size, int client_count );
+
+void interest_grid_destroy( InterestGrid* grid );
+
+void interest_grid_set_entity( InterestGrid* grid, int entity, float x, float y );
+
+void interest_grid_remove_entity( InterestGrid* grid, int entity );
+
+/**
+ * Subscribes the client to all cells which overlap the square around the
+ * position.  Views are clamped to a limited number of cells around the
+ * position.
+ */
+void interest_grid_set_view( InterestGrid* grid,
+                             int client,
+                             float x,
+                             float y,
+                             float radius );
+
+void interest_grid_clear_view( InterestGrid* grid, int client );
+
+/**
+ * Clients which see the entity.
+ *
+ * @return
+ * Array of client slots, which is valid until the grid is modified, or
+ * `NULL` if the entity is unknown.
+ */
+const int* interest_grid_get_subscribers( const InterestGrid* grid,
+                                          int entity,
+                                          int* count );
+
+
+#endif
@@ -0,0 +1,199 @@
+#include <assert.h>
+#include <stdlib.h> // calloc, free
+#include <string.h> // memset
+#include "enet_mp.h"
+#include "enet_mp_shared.h"
+#include "enet_mp_metrics.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h> // clock_gettime
+#endif
+
+
+enum
+{
+    SUB_BUCKET_BITS = 4,
+    SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS
+};
+
+enet_uint32 get_microseconds( void )
+{
+#if defined(_WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if(frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    // Split, so the multiplication can't overflow.
+    const LONGLONG seconds = counter.QuadPart / frequency.QuadPart;
+    const LONGLONG remainder = counter.QuadPart % frequency.QuadPart;
+    return (enet_uint32)(seconds * 1000000 + remainder * 1000000 / frequency.QuadPart);
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (enet_uint32)((unsigned long long)time.tv_sec * 1000000 +
+                         (unsigned long long)time.tv_nsec / 1000);
+#endif
+}
+
+static int find_last_set( enet_uint32 value )
+{
+#if defined(__GNUC__)
+    return 31 - __builtin_clz(value);
+#else
+    int bit = 0;
+    while(value >>= 1)
+        bit++;
+    return bit;
+#endif
+}
+
+// Values below SUB_BUCKET_COUNT get a bucket each.  Above, each power of two
+// is split into SUB_BUCKET_COUNT linear buckets.
+static int get_bucket_index( enet_uint32 value )
+{
+    if(value < SUB_BUCKET_COUNT)
+        return (int)value;
+    const int exponent = find_last_set(value);
+    const int shift = exponent - SUB_BUCKET_BITS;
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT +
+           (int)((value >> shift) & (SUB_BUCKET_COUNT - 1));
+}
+
+static enet_uint32 get_bucket_upper_bound( int index )
+{
+    if(index < SUB_BUCKET_COUNT)
+        return (enet_uint32)index;
+    const int shift = index / SUB_BUCKET_COUNT - 1;
+    const unsigned long long lower =
+        (unsigned long long)(SUB_BUCKET_COUNT + index % SUB_BUCKET_COUNT) << shift;
+    return (enet_uint32)(lower + ((unsigned long long)1 << shift) - 1);
+}
+
+void histogram_record( ENetMpHistogram* histogram, enet_uint32 value )
+{
+    const int index = get_bucket_index(value);
+    assert(index < ENET_MP_HISTOGRAM_BUCKET_COUNT);
+    histogram->buckets[index]++;
+    if(histogram->count == 0 || value < histogram->min)
+        histogram->min = value;
+    if(value > histogram->max)
+        histogram->max = value;
+    histogram->count++;
+    histogram->sum += value;
+}
+
+void histogram_clear( ENetMpHistogram* histogram )
+{
+    memset(histogram, 0, sizeof(ENetMpHistogram));
+}
+
+enet_uint32 enet_mp_histogram_get_percentile( const ENetMpHistogram* histogram,
+                                              double percentile )
+{
+    assert(percentile >= 0 && percentile <= 100);
+    if(histogram->count == 0)
+        return 0;
+
+    unsigned long long rank =
+        (unsigned long long)(percentile / 100.0 * (double)histogram->count + 0.5);
+    if(rank < 1)
+        rank = 1;
+
+    unsigned long long count = 0;
+    int i = 0;
+    for(; i < ENET_MP_HISTOGRAM_BUCKET_COUNT; i++)
+    {
+        count += histogram->buckets[i];
+        if(count >= rank)
+        {
+            const enet_uint32 bound = get_bucket_upper_bound(i);
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void peer_metrics_init( PeerMetrics* metrics,
+                        int channel_count,
+                        ENetMpChannelMetrics* totals )
+{
+    memset(metrics, 0, sizeof(PeerMetrics));
+    metrics->channels =
+        (ENetMpChannelMetrics*)calloc(channel_count, sizeof(ENetMpChannelMetrics));
+    metrics->channel_count = channel_count;
+    metrics->totals = totals;
+}
+
+void peer_metrics_destroy( PeerMetrics* metrics )
+{
+    free(metrics->channels);
+    metrics->channels = NULL;
+}
+
+void peer_metrics_reset( PeerMetrics* metrics )
+{
+    memset(&metrics->connection, 0, sizeof(ENetMpConnectionMetrics));
+    memset(metrics->channels, 0, metrics->channel_count * sizeof(ENetMpChannelMetrics));
+    metrics->last_packets_lost = 0;
+}
+
+void peer_metrics_count_sent( PeerMetrics* metrics, int channel, int size )
+{
+    assert(is_in_bounds(channel, metrics->channel_count));
+    ENetMpChannelMetrics* counters[3] = { &metrics->channels[channel],
+                                          &metrics->connection.total,
+                                          metrics->totals };
+    int i = 0;
+    for(; i < 3 && counters[i]; i++)
+    {
+        counters[i]->sent_packets++;
+        counters[i]->sent_bytes += size;
+    }
+}
+
+void peer_metrics_count_received( PeerMetrics* metrics, int channel, int size )
+{
+    assert(is_in_bounds(channel, metrics->channel_count));
+    ENetMpChannelMetrics* counters[3] = { &metrics->channels[channel],
+                                          &metrics->connection.total,
+                                          metrics->totals };
+    int i = 0;
+    for(; i < 3 && counters[i]; i++)
+    {
+        counters[i]->received_packets++;
+        counters[i]->received_bytes += size;
+    }
+}
+
+void peer_metrics_sample( PeerMetrics* metrics, const ENetPeer* peer )
+{
+    PeerStatistics statistics;
+    peer_statistics_get(&statistics, peer);
+    peer_metrics_apply(metrics, &statistics);
+}
+
+void peer_statistics_get( PeerStatistics* statistics, const ENetPeer* peer )
+{
+    statistics->round_trip_time = peer->roundTripTime;
+    statistics->round_trip_time_variance = peer->roundTripTimeVariance;
+    statistics->packet_loss = peer->packetLoss;
+    statistics->packets_lost = peer->packetsLost;
+}
+
+void peer_metrics_apply( PeerMetrics* metrics, const PeerStatistics* statistics )
+{
+    ENetMpConnectionMetrics* connection = &metrics->connection;
+    connection->round_trip_time = statistics->round_trip_time;
+    connection->round_trip_time_variance = statistics->round_trip_time_variance;
+    connection->packet_loss = (float)statistics->packet_loss / ENET_PEER_PACKET_LOSS_SCALE;
+
+    const enet_uint32 packets_lost = statistics->packets_lost;
+    if(packets_lost >= metrics->last_packets_lost)
+        connection->resent_packets += packets_lost - metrics->last_packets_lost;
+    else
+        connection->resent_packets += packets_lost; // Has been reset meanwhile.
+    metrics->last_packets_lost = packets_lost;
+}
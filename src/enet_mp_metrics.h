@@ -0,0 +1,78 @@
+#ifndef __ENET_MP_METRICS_H__
+#define __ENET_MP_METRICS_H__
+
+#include <enet/enet.h>
+#include "enet_mp.h"
+
+
+/**
+ * Counters of a single connection.
+ */
+typedef struct _PeerMetrics
+{
+    ENetMpConnectionMetrics connection;
+    ENetMpChannelMetrics* channels; // Per ENet channel.
+    int channel_count;
+
+    // Also updated by all counts, e.g. the totals of a server.  May be `NULL`.
+    ENetMpChannelMetrics* totals;
+
+    // ENet resets ENetPeer::packetsLost periodically, so resends are
+    // accumulated from the difference to the last sample.
+    enet_uint32 last_packets_lost;
+
+} PeerMetrics;
+
+/**
+ * Link statistics of a peer, taken on the thread which services its host.
+ */
+typedef struct _PeerStatistics
+{
+    enet_uint32 round_trip_time;
+    enet_uint32 round_trip_time_variance;
+    enet_uint32 packet_loss; // Scaled by ENET_PEER_PACKET_LOSS_SCALE.
+    enet_uint32 packets_lost;
+
+} PeerStatistics;
+
+
+/**
+ * Microseconds of a monotonic clock.  Wraps around after about 71 minutes,
+ * so only differences are meaningful.
+ */
+enet_uint32 get_microseconds( void );
+
+void histogram_record( ENetMpHistogram* histogram, enet_uint32 value );
+
+void histogram_clear( ENetMpHistogram* histogram );
+
+void peer_metrics_init( PeerMetrics* metrics,
+                        int channel_count,
+                        ENetMpChannelMetrics* totals );
+
+void peer_metrics_destroy( PeerMetrics* metrics );
+
+/**
+ * Clears all counters, e.g. when a client slot is reused.
+ */
+void peer_metrics_reset( PeerMetrics* metrics );
+
+void peer_metrics_count_sent( PeerMetrics* metrics, int channel, int size );
+
+void peer_metrics_count_received( PeerMetrics* metrics, int channel, int size );
+
+/**
+ * Takes round trip time, packet loss and resends from the peer.
+ */
+void peer_metrics_sample( PeerMetrics* metrics, const ENetPeer* peer );
+
+void peer_statistics_get( PeerStatistics* statistics, const ENetPeer* peer );
+
+/**
+ * Like #peer_metrics_sample, but with statistics which have been taken
+ * on another thread.
+ */
+void peer_metrics_apply( PeerMetrics* metrics, const PeerStatistics* statistics );
+
+
+#endif
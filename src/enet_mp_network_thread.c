@@ -0,0 +1,275 @@
+#include <assert.h>
+#include <string.h> // memset
+#include "enet_mp.h"
+#include "enet_mp_shared.h"
+#include "enet_mp_network_thread.h"
+
+
+// Waiting on the socket is also limited by the next resend or ping of ENet
+// and by the statistics, so this only bounds idle hosts.
+static const int MAX_WAIT_TIMEOUT = 1000;
+
+// Full queues are usually drained quickly by the other thread, so waiting
+// threads yield first and then sleep in steps of a millisecond.
+static const int MAX_YIELD_COUNT = 64;
+
+// Milliseconds between statistics of the connected peers.
+static const enet_uint32 STATISTICS_INTERVAL = 500;
+
+static void wait_for_room( int attempt )
+{
+    if(attempt < MAX_YIELD_COUNT)
+        thread_yield();
+    else
+        thread_sleep(1);
+}
+
+static void send_query_reply( NetworkThread* thread,
+                              const ENetAddress* address,
+                              const ENetPacket* packet )
+{
+    ENetBuffer buffers[2];
+    buffers[0].data = (void*)QUERY_REPLY_MAGIC;
+    buffers[0].dataLength = QUERY_MAGIC_SIZE;
+    buffers[1].data = packet->data;
+    buffers[1].dataLength = packet->dataLength;
+    enet_socket_send(thread->host->socket, address, buffers, 2);
+}
+
+static void execute_command( NetworkThread* thread, const NetworkCommand* command )
+{
+    ENetPeer* peer = command->peer;
+    switch(command->type)
+    {
+        case NETWORK_COMMAND_SEND:
+            if(is_peer_current(peer, command->connect_id) &&
+               enet_peer_send(peer, command->channel, command->packet) == 0)
+                break;
+            if(command->packet->referenceCount == 0)
+                enet_packet_destroy(command->packet);
+            break;
+
+        case NETWORK_COMMAND_DISCONNECT_NOW:
+            if(is_peer_current(peer, command->connect_id))
+                enet_peer_disconnect_now(peer, command->data);
+            break;
+
+        case NETWORK_COMMAND_DISCONNECT_LATER:
+            if(is_peer_current(peer, command->connect_id))
+                enet_peer_disconnect_later(peer, command->data);
+            break;
+
+        case NETWORK_COMMAND_RELEASE_PACKET:
+            enet_mp_packet_release(command->packet);
+            break;
+
+        case NETWORK_COMMAND_SEND_QUERY_REPLY:
+            send_query_reply(thread, &command->address, command->packet);
+            break;
+
+        default:
+            assert(!"Unknown network command!");
+    }
+}
+
+static void execute_commands( NetworkThread* thread )
+{
+    NetworkCommand command;
+    while(spsc_queue_pop(&thread->commands, &command))
+        execute_command(thread, &command);
+}
+
+static bool is_stop_requested( NetworkThread* thread )
+{
+    return atomic_load_explicit(&thread->stop_requested, memory_order_acquire);
+}
+
+// Keeps executing commands while the game thread catches up, since it may
+// wait for room in the command queue itself.
+static void push_event( NetworkThread* thread, const ENetEvent* enet_event )
+{
+    NetworkEvent event;
+    memset(&event, 0, sizeof(event));
+    event.type = NETWORK_EVENT_ENET;
+    event.enet_event = *enet_event;
+    event.connect_id = enet_event->peer->connectID;
+    event.address = enet_event->peer->address;
+
+    int attempt = 0;
+    while(!spsc_queue_push(&thread->events, &event))
+    {
+        if(is_stop_requested(thread))
+        {
+            if(enet_event->type == ENET_EVENT_TYPE_RECEIVE)
+                enet_packet_destroy(enet_event->packet);
+            return;
+        }
+        execute_commands(thread);
+        wait_for_room(attempt++);
+    }
+}
+
+// The statistics belong to this thread, so they are sent along with the
+// events.  Samples which don't fit into the queue are dropped, since the
+// next ones replace them anyway.
+static void push_peer_statistics( NetworkThread* thread )
+{
+    const enet_uint32 time = enet_time_get();
+    if(ENET_TIME_DIFFERENCE(time, thread->statistics_time) < STATISTICS_INTERVAL)
+        return;
+    thread->statistics_time = time;
+
+    NetworkEvent event;
+    memset(&event, 0, sizeof(event));
+    event.type = NETWORK_EVENT_PEER_STATISTICS;
+
+    ENetHost* host = thread->host;
+    size_t i = 0;
+    for(; i < host->peerCount; i++)
+    {
+        ENetPeer* peer = &host->peers[i];
+        if(peer->state != ENET_PEER_STATE_CONNECTED)
+            continue;
+        event.enet_event.peer = peer;
+        event.connect_id = peer->connectID;
+        event.address = peer->address;
+        peer_statistics_get(&event.statistics, peer);
+        if(!spsc_queue_push(&thread->events, &event))
+            return;
+    }
+}
+
+static void service_host( NetworkThread* thread )
+{
+    ENetEvent event;
+    int event_occured = enet_host_service(thread->host, &event, 0);
+    assert(event_occured >= 0);
+    while(event_occured > 0)
+    {
+        push_event(thread, &event);
+        event_occured = enet_host_check_events(thread->host, &event);
+        assert(event_occured >= 0);
+    }
+}
+
+// enet_host_service keeps waiting when datagrams arrive which don't cause an
+// event, like the wakeup datagram, so the thread waits on the socket itself.
+// The game thread sees the waiting flag or the thread sees the command,
+// since both sides fence between their store and load.
+static void wait_for_work( NetworkThread* thread )
+{
+    const int statistics_timeout = limit_timeout(MAX_WAIT_TIMEOUT,
+                                                 thread->statistics_time + STATISTICS_INTERVAL,
+                                                 enet_time_get());
+    int timeout = get_host_timeout(thread->host, statistics_timeout);
+    // Commands which ENet couldn't send yet, e.g. due to a full window,
+    // must not make this spin.
+    if(timeout < 1)
+        timeout = 1;
+
+    atomic_store_explicit(&thread->waiting, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if(spsc_queue_is_empty(&thread->commands) && !is_stop_requested(thread))
+    {
+        enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+        enet_socket_wait(thread->host->socket, &condition, (enet_uint32)timeout);
+    }
+    atomic_store_explicit(&thread->waiting, false, memory_order_relaxed);
+}
+
+static void run_network_thread( void* context )
+{
+    NetworkThread* thread = (NetworkThread*)context;
+    set_service_context(thread->context);
+
+    while(!is_stop_requested(thread))
+    {
+        execute_commands(thread);
+        service_host(thread);
+        push_peer_statistics(thread);
+        wait_for_work(thread);
+    }
+
+    execute_commands(thread);
+    enet_host_flush(thread->host);
+    set_service_context(NULL);
+}
+
+void network_thread_start( NetworkThread* thread,
+                           ENetHost* host,
+                           void* context,
+                           int queue_capacity )
+{
+    thread->host = host;
+    thread->context = context;
+    spsc_queue_init(&thread->events, sizeof(NetworkEvent), queue_capacity);
+    spsc_queue_init(&thread->commands, sizeof(NetworkCommand), queue_capacity);
+    atomic_init(&thread->stop_requested, false);
+    atomic_init(&thread->waiting, false);
+    thread->statistics_time = enet_time_get();
+
+    // A wildcard address can't be sent to, but the host listens on
+    // loopback as well.
+    thread->wakeup_socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+    assert(thread->wakeup_socket != ENET_SOCKET_NULL);
+    enet_socket_set_option(thread->wakeup_socket, ENET_SOCKOPT_NONBLOCK, 1);
+    thread->wakeup_address = host->address;
+    if(thread->wakeup_address.host == ENET_HOST_ANY)
+        thread->wakeup_address.host = ENET_HOST_TO_NET_32(0x7F000001);
+    const bool started = thread_start(&thread->thread, run_network_thread, thread);
+    assert(started);
+}
+
+// A lost datagram only delays the thread until its timeout.
+static void wake( NetworkThread* thread )
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if(!atomic_exchange_explicit(&thread->waiting, false, memory_order_relaxed))
+        return;
+    ENetBuffer buffer;
+    buffer.data = (void*)WAKEUP_MAGIC;
+    buffer.dataLength = QUERY_MAGIC_SIZE;
+    enet_socket_send(thread->wakeup_socket, &thread->wakeup_address, &buffer, 1);
+}
+
+void network_thread_stop( NetworkThread* thread )
+{
+    atomic_store_explicit(&thread->stop_requested, true, memory_order_release);
+    wake(thread);
+    thread_join(&thread->thread);
+}
+
+void network_thread_destroy( NetworkThread* thread )
+{
+    NetworkEvent event;
+    while(spsc_queue_pop(&thread->events, &event))
+        if(event.type == NETWORK_EVENT_ENET &&
+           event.enet_event.type == ENET_EVENT_TYPE_RECEIVE)
+            enet_packet_destroy(event.enet_event.packet);
+    spsc_queue_destroy(&thread->events);
+    spsc_queue_destroy(&thread->commands);
+    enet_socket_destroy(thread->wakeup_socket);
+}
+
+void network_thread_push_command( NetworkThread* thread,
+                                  const NetworkCommand* command )
+{
+    int attempt = 0;
+    while(!spsc_queue_push(&thread->commands, command))
+    {
+        wake(thread);
+        wait_for_room(attempt++);
+    }
+    wake(thread);
+}
+
+bool network_thread_pop_event( NetworkThread* thread, NetworkEvent* event )
+{
+    return spsc_queue_pop(&thread->events, event);
+}
+
+bool network_thread_try_push_event( NetworkThread* thread,
+                                    const NetworkEvent* event )
+{
+    return spsc_queue_push(&thread->events, event);
+}
@@ -0,0 +1,135 @@
+#ifndef __ENET_MP_NETWORK_THREAD_H__
+#define __ENET_MP_NETWORK_THREAD_H__
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <enet/enet.h>
+#include "enet_mp_metrics.h"
+#include "enet_mp_queue.h"
+#include "enet_mp_thread.h"
+
+
+typedef enum _NetworkEventType
+{
+    NETWORK_EVENT_ENET,
+    NETWORK_EVENT_QUERY, // Connectionless query from address.
+    NETWORK_EVENT_PEER_STATISTICS // Of the connected peer in enet_event.
+
+} NetworkEventType;
+
+/**
+ * Passed from the network thread to the game thread.
+ */
+typedef struct _NetworkEvent
+{
+    NetworkEventType type;
+    ENetEvent enet_event;
+
+    // ENetPeer::connectID and ENetPeer::address at the time of the event.
+    // The network thread may reuse the peer before the game thread handles
+    // the event.
+    enet_uint32 connect_id;
+    ENetAddress address;
+
+    PeerStatistics statistics;
+
+} NetworkEvent;
+
+typedef enum _NetworkCommandType
+{
+    NETWORK_COMMAND_SEND,
+    NETWORK_COMMAND_DISCONNECT_NOW,
+    NETWORK_COMMAND_DISCONNECT_LATER,
+    NETWORK_COMMAND_RELEASE_PACKET,
+    NETWORK_COMMAND_SEND_QUERY_REPLY
+
+} NetworkCommandType;
+
+/**
+ * Passed from the game thread to the network thread.
+ *
+ * Peer commands are dropped if the peer is no longer connected with
+ * connect_id.  Packets of dropped sends are destroyed unless they are
+ * referenced elsewhere.
+ */
+typedef struct _NetworkCommand
+{
+    NetworkCommandType type;
+    ENetPeer* peer;
+    enet_uint32 connect_id;
+    enet_uint8 channel;
+    enet_uint32 data; // Disconnect reason.
+    ENetPacket* packet;
+    ENetAddress address; // Receiver of query replies.
+
+} NetworkCommand;
+
+/**
+ * Owns an ENet host while it is running: services the host and executes
+ * commands of the game thread.
+ *
+ * The game thread must not touch the host, its peers or packets which it
+ * has passed to the network thread.  Packet reference counts may only be
+ * changed with a release command.
+ *
+ * While idle, the thread waits on the socket of the host until ENet has
+ * work to do.  Commands wake it with a datagram to that socket, which must
+ * be dropped by the intercept callback of the host (see #WAKEUP_MAGIC).
+ */
+typedef struct _NetworkThread
+{
+    ENetHost* host;
+    void* context; // Service context of the network thread.
+    SpscQueue events;
+    SpscQueue commands;
+    atomic_bool stop_requested;
+    atomic_bool waiting; // On the socket, so commands must wake the thread.
+    ENetSocket wakeup_socket; // Used by the game thread.
+    ENetAddress wakeup_address;
+    Thread thread;
+    enet_uint32 statistics_time; // When peer statistics were pushed last.
+
+} NetworkThread;
+
+
+void network_thread_start( NetworkThread* thread,
+                           ENetHost* host,
+                           void* context,
+                           int queue_capacity );
+
+/**
+ * Executes the remaining commands, flushes the host and joins the thread.
+ *
+ * Events which have not been popped yet are left in the queue.
+ */
+void network_thread_stop( NetworkThread* thread );
+
+/**
+ * Frees the queues.  Packets of unhandled events are destroyed.
+ */
+void network_thread_destroy( NetworkThread* thread );
+
+/**
+ * Must be called by the game thread.  Waits if the queue is full.
+ *
+ * Wakes the network thread, so the command is executed right away.
+ */
+void network_thread_push_command( NetworkThread* thread,
+                                  const NetworkCommand* command );
+
+/**
+ * Must be called by the game thread.
+ */
+bool network_thread_pop_event( NetworkThread* thread, NetworkEvent* event );
+
+/**
+ * Must be called on the network thread.  Doesn't wait for the game thread.
+ *
+ * @return
+ * `false` if the queue is full.
+ */
+bool network_thread_try_push_event( NetworkThread* thread,
+                                    const NetworkEvent* event );
+
+
+#endif
@@ -0,0 +1,205 @@
+#include <assert.h>
+#include <stdlib.h> // malloc, calloc, free
+#include <string.h> // memcpy
+#include <stdbool.h>
+#include "enet_mp_pool.h"
+#include "enet_mp_thread.h"
+
+
+enum
+{
+    SIZE_CLASS_COUNT = 6,
+
+    // Idle buffers beyond this are freed instead of being kept.
+    MAX_IDLE_BUFFERS_PER_CLASS = 1024
+};
+
+static const int SIZE_CLASSES[SIZE_CLASS_COUNT] =
+{
+    64,
+    256,
+    1024,
+    1536, // A full datagram.
+    4096,
+    16384
+};
+
+typedef struct _PoolBuffer PoolBuffer;
+
+struct _PoolBuffer
+{
+    PoolBuffer* next_idle;
+    PacketPool* pool;
+    int size_class;
+    // Packet data follows.
+};
+
+typedef struct _SizeClass
+{
+    PoolBuffer* idle_buffers;
+    int idle_buffer_count;
+
+} SizeClass;
+
+struct _PacketPool
+{
+    SizeClass size_classes[SIZE_CLASS_COUNT];
+    int used_buffer_count;
+    bool destroyed;
+    bool synchronized;
+    Mutex mutex; // Only used if synchronized.
+};
+
+
+// Keeps the packet data aligned.
+static const size_t BUFFER_HEADER_SIZE =
+    (sizeof(PoolBuffer) + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+
+static enet_uint8* get_buffer_data( PoolBuffer* buffer )
+{
+    return (enet_uint8*)buffer + BUFFER_HEADER_SIZE;
+}
+
+static int find_size_class( int size )
+{
+    int i = 0;
+    for(; i < SIZE_CLASS_COUNT; i++)
+        if(size <= SIZE_CLASSES[i])
+            return i;
+    return -1;
+}
+
+static void free_idle_buffers( PacketPool* pool )
+{
+    int i = 0;
+    for(; i < SIZE_CLASS_COUNT; i++)
+    {
+        SizeClass* size_class = &pool->size_classes[i];
+        while(size_class->idle_buffers)
+        {
+            PoolBuffer* buffer = size_class->idle_buffers;
+            size_class->idle_buffers = buffer->next_idle;
+            free(buffer);
+        }
+        size_class->idle_buffer_count = 0;
+    }
+}
+
+static void lock_pool( PacketPool* pool )
+{
+    if(pool->synchronized)
+        mutex_lock(&pool->mutex);
+}
+
+static void unlock_pool( PacketPool* pool )
+{
+    if(pool->synchronized)
+        mutex_unlock(&pool->mutex);
+}
+
+static void free_pool( PacketPool* pool )
+{
+    if(pool->synchronized)
+        mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+PacketPool* packet_pool_create( bool synchronized )
+{
+    PacketPool* pool = (PacketPool*)calloc(1, sizeof(PacketPool));
+    pool->synchronized = synchronized;
+    if(synchronized)
+        mutex_init(&pool->mutex);
+    return pool;
+}
+
+void packet_pool_destroy( PacketPool* pool )
+{
+    lock_pool(pool);
+    free_idle_buffers(pool);
+    const bool unused = pool->used_buffer_count == 0;
+    pool->destroyed = true;
+    unlock_pool(pool);
+    if(unused)
+        free_pool(pool);
+}
+
+static void ENET_CALLBACK release_buffer( ENetPacket* packet )
+{
+    PoolBuffer* buffer = (PoolBuffer*)packet->userData;
+    PacketPool* pool = buffer->pool;
+    SizeClass* size_class = &pool->size_classes[buffer->size_class];
+
+    lock_pool(pool);
+    pool->used_buffer_count--;
+    assert(pool->used_buffer_count >= 0);
+
+    if(pool->destroyed)
+    {
+        free(buffer);
+        const bool unused = pool->used_buffer_count == 0;
+        unlock_pool(pool);
+        if(unused)
+            free_pool(pool);
+        return;
+    }
+    else if(size_class->idle_buffer_count >= MAX_IDLE_BUFFERS_PER_CLASS)
+    {
+        free(buffer);
+    }
+    else
+    {
+        buffer->next_idle = size_class->idle_buffers;
+        size_class->idle_buffers = buffer;
+        size_class->idle_buffer_count++;
+    }
+    unlock_pool(pool);
+}
+
+ENetPacket* packet_pool_acquire( PacketPool* pool, int size, enet_uint32 flags )
+{
+    assert(!pool->destroyed);
+    assert(size >= 0);
+
+    const int size_class_index = find_size_class(size);
+    if(size_class_index < 0)
+        return enet_packet_create(NULL, size, flags);
+
+    SizeClass* size_class = &pool->size_classes[size_class_index];
+    lock_pool(pool);
+    PoolBuffer* buffer = size_class->idle_buffers;
+    if(buffer)
+    {
+        size_class->idle_buffers = buffer->next_idle;
+        size_class->idle_buffer_count--;
+    }
+    pool->used_buffer_count++;
+    unlock_pool(pool);
+
+    if(!buffer)
+    {
+        buffer = (PoolBuffer*)malloc(BUFFER_HEADER_SIZE +
+                                     SIZE_CLASSES[size_class_index]);
+        buffer->pool = pool;
+        buffer->size_class = size_class_index;
+    }
+    buffer->next_idle = NULL;
+
+    ENetPacket* packet = enet_packet_create(get_buffer_data(buffer),
+                                            size,
+                                            flags | ENET_PACKET_FLAG_NO_ALLOCATE);
+    packet->freeCallback = release_buffer;
+    packet->userData = buffer;
+    return packet;
+}
+
+ENetPacket* packet_pool_create_packet( PacketPool* pool,
+                                       const void* data,
+                                       int size,
+                                       enet_uint32 flags )
+{
+    ENetPacket* packet = packet_pool_acquire(pool, size, flags);
+    if(size > 0)
+        memcpy(packet->data, data, size);
+    return packet;
+}
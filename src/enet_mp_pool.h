@@ -0,0 +1,48 @@
+#ifndef __ENET_MP_POOL_H__
+#define __ENET_MP_POOL_H__
+
+#include <stdbool.h>
+#include <enet/enet.h>
+
+
+/**
+ * Recycles packet buffers in a few size classes.
+ *
+ * Packets are created with `ENET_PACKET_FLAG_NO_ALLOCATE` and return their
+ * buffer to the pool in their `freeCallback`.  The `ENetPacket` structure
+ * itself is still allocated by ENet; applications can route that through
+ * `enet_initialize_with_callbacks`.
+ */
+typedef struct _PacketPool PacketPool;
+
+
+/**
+ * @param synchronized
+ * Guard the pool with a mutex, so packets may be destroyed on another
+ * thread than the one which acquires them.
+ */
+PacketPool* packet_pool_create( bool synchronized );
+
+/**
+ * Frees all idle buffers.  If packets of this pool are still alive, the
+ * pool itself is freed when the last one is destroyed.
+ */
+void packet_pool_destroy( PacketPool* pool );
+
+/**
+ * Creates a packet of the given size.  Its content is undefined.
+ *
+ * Packets which exceed the largest size class are allocated by ENet.
+ */
+ENetPacket* packet_pool_acquire( PacketPool* pool, int size, enet_uint32 flags );
+
+/**
+ * Like #packet_pool_acquire, but copies the data into the packet.
+ */
+ENetPacket* packet_pool_create_packet( PacketPool* pool,
+                                       const void* data,
+                                       int size,
+                                       enet_uint32 flags );
+
+
+#endif
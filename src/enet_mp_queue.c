@@ -0,0 +1,63 @@
+#include <assert.h>
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcpy
+#include "enet_mp_queue.h"
+
+
+void spsc_queue_init( SpscQueue* queue, int element_size, int capacity )
+{
+    assert(element_size > 0);
+    assert(capacity > 0);
+
+    unsigned int rounded_capacity = 1;
+    while(rounded_capacity < (unsigned int)capacity)
+        rounded_capacity *= 2;
+
+    queue->elements = (char*)malloc(rounded_capacity * element_size);
+    queue->element_size = element_size;
+    queue->capacity_mask = rounded_capacity - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+void spsc_queue_destroy( SpscQueue* queue )
+{
+    free(queue->elements);
+    queue->elements = NULL;
+}
+
+// Head and tail are free running counters, which are masked on access.
+bool spsc_queue_push( SpscQueue* queue, const void* element )
+{
+    const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    const unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if(tail - head > queue->capacity_mask)
+        return false;
+
+    memcpy(&queue->elements[(tail & queue->capacity_mask) * queue->element_size],
+           element,
+           queue->element_size);
+    atomic_store_explicit(&queue->tail, tail+1, memory_order_release);
+    return true;
+}
+
+bool spsc_queue_pop( SpscQueue* queue, void* element )
+{
+    const unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if(head == tail)
+        return false;
+
+    memcpy(element,
+           &queue->elements[(head & queue->capacity_mask) * queue->element_size],
+           queue->element_size);
+    atomic_store_explicit(&queue->head, head+1, memory_order_release);
+    return true;
+}
+
+bool spsc_queue_is_empty( SpscQueue* queue )
+{
+    const unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    return head == tail;
+}
@@ -0,0 +1,63 @@
+#ifndef __ENET_MP_QUEUE_H__
+#define __ENET_MP_QUEUE_H__
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+
+enum
+{
+    CACHE_LINE_SIZE = 64
+};
+
+/**
+ * Lock-free bounded queue for exactly one producer and one consumer thread.
+ *
+ * Elements are copied in and out.
+ */
+typedef struct _SpscQueue
+{
+    char* elements;
+    int element_size;
+    unsigned int capacity_mask;
+
+    // Written by the consumer; kept apart to avoid false sharing.
+    _Alignas(CACHE_LINE_SIZE) atomic_uint head;
+
+    // Written by the producer.
+    _Alignas(CACHE_LINE_SIZE) atomic_uint tail;
+
+} SpscQueue;
+
+
+/**
+ * @param capacity
+ * Rounded up to the next power of two.
+ */
+void spsc_queue_init( SpscQueue* queue, int element_size, int capacity );
+
+void spsc_queue_destroy( SpscQueue* queue );
+
+/**
+ * May only be called by the producer.
+ *
+ * @return
+ * `false` if the queue is full.
+ */
+bool spsc_queue_push( SpscQueue* queue, const void* element );
+
+/**
+ * May only be called by the consumer.
+ *
+ * @return
+ * `false` if the queue is empty.
+ */
+bool spsc_queue_pop( SpscQueue* queue, void* element );
+
+/**
+ * May only be called by the consumer.
+ */
+bool spsc_queue_is_empty( SpscQueue* queue );
+
+
+#endif
@@ -0,0 +1,127 @@
+#include <assert.h>
+#include <stdlib.h> // calloc, free
+#include "enet_mp_rate_limit.h"
+
+
+enum
+{
+    ASSOCIATIVITY = 4
+};
+
+void token_bucket_init( TokenBucket* bucket, int burst, enet_uint32 time )
+{
+    bucket->milli_tokens = (enet_uint32)burst * 1000;
+    bucket->last_time = time;
+}
+
+bool token_bucket_take( TokenBucket* bucket,
+                        int rate,
+                        int burst,
+                        enet_uint32 time )
+{
+    const enet_uint32 max_milli_tokens = (enet_uint32)burst * 1000;
+
+    // Milliseconds times tokens per second gives milli tokens.
+    enet_uint32 elapsed = ENET_TIME_DIFFERENCE(time, bucket->last_time);
+    if(elapsed > max_milli_tokens)
+        elapsed = max_milli_tokens; // Prevents overflows; the bucket is full anyway.
+    enet_uint32 milli_tokens = bucket->milli_tokens + elapsed * (enet_uint32)rate;
+    if(milli_tokens > max_milli_tokens)
+        milli_tokens = max_milli_tokens;
+    bucket->last_time = time;
+
+    if(milli_tokens < 1000)
+    {
+        bucket->milli_tokens = milli_tokens;
+        return false;
+    }
+    bucket->milli_tokens = milli_tokens - 1000;
+    return true;
+}
+
+void address_rate_limiter_init( AddressRateLimiter* limiter,
+                                int entry_count,
+                                int rate,
+                                int burst,
+                                enet_uint32 block_time )
+{
+    assert(rate > 0);
+    assert(burst > 0);
+
+    int set_count = 1;
+    while(set_count*ASSOCIATIVITY < entry_count)
+        set_count *= 2;
+
+    limiter->entries = (AddressBucket*)calloc(set_count*ASSOCIATIVITY,
+                                              sizeof(AddressBucket));
+    limiter->set_count = set_count;
+    limiter->rate = rate;
+    limiter->burst = burst;
+    limiter->block_time = block_time;
+}
+
+void address_rate_limiter_destroy( AddressRateLimiter* limiter )
+{
+    free(limiter->entries);
+    limiter->entries = NULL;
+}
+
+static enet_uint32 hash_address( enet_uint32 address )
+{
+    // Fibonacci hashing spreads neighbouring addresses.
+    return (address * 2654435769u) >> 16;
+}
+
+bool address_rate_limiter_take( AddressRateLimiter* limiter,
+                                enet_uint32 address,
+                                enet_uint32 time )
+{
+    const enet_uint32 set = hash_address(address) & (enet_uint32)(limiter->set_count-1);
+    AddressBucket* entries = &limiter->entries[set*ASSOCIATIVITY];
+
+    AddressBucket* entry = NULL;
+    AddressBucket* victim = &entries[0];
+    int i = 0;
+    for(; i < ASSOCIATIVITY; i++)
+    {
+        AddressBucket* candidate = &entries[i];
+        if(candidate->used && candidate->address == address)
+        {
+            entry = candidate;
+            break;
+        }
+
+        if(!candidate->used)
+            victim = candidate;
+        else if(victim->used &&
+                ENET_TIME_LESS(candidate->bucket.last_time, victim->bucket.last_time))
+            victim = candidate;
+    }
+
+    if(!entry)
+    {
+        entry = victim;
+        entry->address = address;
+        entry->used = true;
+        entry->blocked = false;
+        token_bucket_init(&entry->bucket, limiter->burst, time);
+    }
+
+    // Always taken, so the entry stays recently used while blocked.
+    const bool allowed = token_bucket_take(&entry->bucket,
+                                           limiter->rate,
+                                           limiter->burst,
+                                           time);
+    if(entry->blocked)
+    {
+        if(ENET_TIME_LESS(time, entry->blocked_until))
+            return false;
+        entry->blocked = false;
+    }
+    if(!allowed && limiter->block_time > 0)
+    {
+        entry->blocked = true;
+        entry->blocked_until = time + limiter->block_time;
+    }
+    return allowed;
+}
@@ -0,0 +1,85 @@
+#ifndef __ENET_MP_RATE_LIMIT_H__
+#define __ENET_MP_RATE_LIMIT_H__
+
+#include <stdbool.h>
+#include <enet/enet.h>
+
+
+/**
+ * Token bucket which is refilled with `rate` tokens per second and holds
+ * at most `burst` tokens.
+ */
+typedef struct _TokenBucket
+{
+    enet_uint32 milli_tokens; // Tokens in 1/1000.
+    enet_uint32 last_time;
+
+} TokenBucket;
+
+typedef struct _AddressBucket
+{
+    enet_uint32 address; // IPv4 address in network byte order.
+    bool used;
+    bool blocked;
+    enet_uint32 blocked_until;
+    TokenBucket bucket;
+
+} AddressBucket;
+
+/**
+ * Token buckets per address in a fixed size set associative hash table.
+ *
+ * If all entries an address hashes to are taken, the least recently used
+ * one is evicted, so memory stays constant no matter how many addresses
+ * are seen.
+ *
+ * Addresses which run out of tokens can be blocked for a while, so
+ * offenders are held off entirely instead of being let through at the
+ * refill rate.
+ */
+typedef struct _AddressRateLimiter
+{
+    AddressBucket* entries;
+    int set_count; // Always a power of two.
+    int rate;
+    int burst;
+    enet_uint32 block_time; // Milliseconds; zero doesn't block.
+
+} AddressRateLimiter;
+
+
+void token_bucket_init( TokenBucket* bucket, int burst, enet_uint32 time );
+
+/**
+ * @return
+ * Whether a token was available.
+ */
+bool token_bucket_take( TokenBucket* bucket,
+                        int rate,
+                        int burst,
+                        enet_uint32 time );
+
+/**
+ * @param entry_count
+ * Rounded up to a multiple of the associativity and a power of two.
+ */
+void address_rate_limiter_init( AddressRateLimiter* limiter,
+                                int entry_count,
+                                int rate,
+                                int burst,
+                                enet_uint32 block_time );
+
+void address_rate_limiter_destroy( AddressRateLimiter* limiter );
+
+/**
+ * Takes a token from the addresses bucket.
+ *
+ * @return
+ * Whether a token was available and the address isn't blocked.
+ */
+bool address_rate_limiter_take( AddressRateLimiter* limiter,
+                                enet_uint32 address,
+                                enet_uint32 time );
+
+
+#endif
@@ -0,0 +1,165 @@
+#include <assert.h>
+#include <stdlib.h> // realloc, free
+#include "enet_mp_scheduler.h"
+
+
+// Budget which may accrue while a peer has nothing to send.
+static const int MAX_BURST_TIME = 100;
+
+void send_scheduler_init( SendScheduler* scheduler, enet_uint32 time )
+{
+    scheduler->heap = NULL;
+    scheduler->count = 0;
+    scheduler->capacity = 0;
+    scheduler->next_sequence = 0;
+    scheduler->epoch = time;
+    scheduler->last_run = time;
+    scheduler->budget = 0;
+}
+
+static void release( ENetPacket* packet )
+{
+    assert(packet->referenceCount > 0);
+    packet->referenceCount--;
+    if(packet->referenceCount == 0)
+        enet_packet_destroy(packet);
+}
+
+void send_scheduler_destroy( SendScheduler* scheduler )
+{
+    int i = 0;
+    for(; i < scheduler->count; i++)
+        release(scheduler->heap[i].packet);
+    free(scheduler->heap);
+    scheduler->heap = NULL;
+    scheduler->count = 0;
+    scheduler->capacity = 0;
+}
+
+static bool has_precedence( const ScheduledPacket* a, const ScheduledPacket* b )
+{
+    if(a->key != b->key)
+        return a->key > b->key;
+    // Sequence numbers may wrap around.
+    return (int)(a->sequence - b->sequence) < 0;
+}
+
+static void swap( ScheduledPacket* a, ScheduledPacket* b )
+{
+    const ScheduledPacket temporary = *a;
+    *a = *b;
+    *b = temporary;
+}
+
+void send_scheduler_push( SendScheduler* scheduler,
+                          enet_uint8 channel,
+                          ENetPacket* packet,
+                          int priority,
+                          float age_boost,
+                          enet_uint32 time )
+{
+    assert(age_boost >= 0);
+    if(scheduler->count == scheduler->capacity)
+    {
+        scheduler->capacity = scheduler->capacity > 0 ? scheduler->capacity*2 : 16;
+        scheduler->heap = (ScheduledPacket*)realloc(scheduler->heap,
+                                                    scheduler->capacity * sizeof(ScheduledPacket));
+    }
+
+    // priority + age_boost*(now - time) orders like priority - age_boost*time.
+    const double age = (double)ENET_TIME_DIFFERENCE(time, scheduler->epoch) / 1000.0;
+    int index = scheduler->count++;
+    ScheduledPacket* entry = &scheduler->heap[index];
+    entry->packet = packet;
+    packet->referenceCount++;
+    entry->key = (double)priority - age_boost*age;
+    entry->sequence = scheduler->next_sequence++;
+    entry->channel = channel;
+
+    while(index > 0)
+    {
+        const int parent = (index-1) / 2;
+        if(!has_precedence(&scheduler->heap[index], &scheduler->heap[parent]))
+            break;
+        swap(&scheduler->heap[index], &scheduler->heap[parent]);
+        index = parent;
+    }
+}
+
+bool send_scheduler_is_empty( const SendScheduler* scheduler )
+{
+    return scheduler->count == 0;
+}
+
+static ScheduledPacket pop( SendScheduler* scheduler )
+{
+    assert(scheduler->count > 0);
+    ScheduledPacket* heap = scheduler->heap;
+    const ScheduledPacket top = heap[0];
+    heap[0] = heap[--scheduler->count];
+
+    int index = 0;
+    for(;;)
+    {
+        const int left = index*2 + 1;
+        const int right = left + 1;
+        int best = index;
+        if(left < scheduler->count && has_precedence(&heap[left], &heap[best]))
+            best = left;
+        if(right < scheduler->count && has_precedence(&heap[right], &heap[best]))
+            best = right;
+        if(best == index)
+            break;
+        swap(&heap[index], &heap[best]);
+        index = best;
+    }
+    return top;
+}
+
+int send_scheduler_run( SendScheduler* scheduler,
+                        int rate,
+                        enet_uint32 time,
+                        ScheduledSendFunction send_function,
+                        void* context )
+{
+    assert(rate >= 0);
+
+    if(rate > 0)
+    {
+        const enet_uint32 elapsed = ENET_TIME_DIFFERENCE(time, scheduler->last_run);
+        const double max_budget = (double)rate * MAX_BURST_TIME / 1000.0 + 1;
+        scheduler->budget += (double)rate * elapsed / 1000.0;
+        if(scheduler->budget > max_budget)
+            scheduler->budget = max_budget;
+    }
+    scheduler->last_run = time;
+
+    int sent_count = 0;
+    while(scheduler->count > 0 &&
+          (rate == 0 || scheduler->budget > 0))
+    {
+        const ScheduledPacket entry = pop(scheduler);
+        const int size = send_function(context, entry.channel, entry.packet);
+        if(rate > 0)
+            scheduler->budget -= (double)size;
+        release(entry.packet);
+        sent_count++;
+    }
+    return sent_count;
+}
+
+int send_scheduler_get_delay( const SendScheduler* scheduler,
+                              int rate,
+                              enet_uint32 time )
+{
+    assert(rate >= 0);
+    if(rate == 0)
+        return 0;
+
+    const enet_uint32 elapsed = ENET_TIME_DIFFERENCE(time, scheduler->last_run);
+    const double budget = scheduler->budget + (double)rate * elapsed / 1000.0;
+    if(budget > 0)
+        return 0;
+    // The budget has to become positive, not just zero.
+    return (int)(-budget * 1000.0 / rate) + 1;
+}
@@ -0,0 +1,95 @@
+#ifndef __ENET_MP_SCHEDULER_H__
+#define __ENET_MP_SCHEDULER_H__
+
+#include <stdbool.h>
+#include <enet/enet.h>
+
+
+typedef struct _ScheduledPacket
+{
+    ENetPacket* packet;
+    double key; // Priority at the time the scheduler was created.
+    enet_uint32 sequence; // Keeps equal keys in FIFO order.
+    enet_uint8 channel;
+
+} ScheduledPacket;
+
+/**
+ * Queues packets of a single peer and sends them highest priority first,
+ * as far as its byte budget allows.
+ *
+ * The priority of waiting packets grows by `age_boost` per second, so low
+ * priority packets can't starve.  As all packets grow equally fast, the
+ * boost is folded into a constant heap key.
+ */
+typedef struct _SendScheduler
+{
+    ScheduledPacket* heap; // Binary max heap.
+    int count;
+    int capacity;
+    enet_uint32 next_sequence;
+    enet_uint32 epoch;
+    enet_uint32 last_run;
+    double budget; // Bytes; negative after a large packet has been sent.
+
+} SendScheduler;
+
+/**
+ * Sends the packet or a copy of it.  The scheduler drops its reference
+ * afterwards.
+ *
+ * @return
+ * Number of bytes which were sent, which is taken from the budget.
+ */
+typedef int (*ScheduledSendFunction)( void* context,
+                                      enet_uint8 channel,
+                                      ENetPacket* packet );
+
+
+void send_scheduler_init( SendScheduler* scheduler, enet_uint32 time );
+
+/**
+ * Drops the references of all queued packets.
+ */
+void send_scheduler_destroy( SendScheduler* scheduler );
+
+/**
+ * Queues a reference to the packet, so one packet may be queued in
+ * several schedulers.
+ */
+void send_scheduler_push( SendScheduler* scheduler,
+                          enet_uint8 channel,
+                          ENetPacket* packet,
+                          int priority,
+                          float age_boost,
+                          enet_uint32 time );
+
+bool send_scheduler_is_empty( const SendScheduler* scheduler );
+
+/**
+ * Adds the budget which accrued since the last run and sends packets until
+ * it is used up.  A packet is sent as long as any budget is left, so large
+ * packets can't get stuck.
+ *
+ * @param rate
+ * Bytes per second or 0 to send everything.
+ *
+ * @return
+ * Number of sent packets.
+ */
+int send_scheduler_run( SendScheduler* scheduler,
+                        int rate,
+                        enet_uint32 time,
+                        ScheduledSendFunction send_function,
+                        void* context );
+
+/**
+ * @return
+ * Milliseconds until #send_scheduler_run has budget to send again.
+ */
+int send_scheduler_get_delay( const SendScheduler* scheduler,
+                              int rate,
+                              enet_uint32 time );
+
+
+#endif
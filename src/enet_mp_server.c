@@ -1,46 +1,208 @@
 #include <assert.h>
-#include <stdlib.h> // calloc, free
-#include <string.h> // memset
+#include <stdatomic.h>
+#include <limits.h> // INT_MAX
+#include <stdlib.h> // malloc, calloc, free
+#include <string.h> // memset, memcpy, memcmp
 #include "enet_mp.h"
 #include "enet_mp_shared.h"
+#include "enet_mp_timer.h"
+#include "enet_mp_bitset.h"
+#include "enet_mp_variables.h"
+#include "enet_mp_snapshot.h"
+#include "enet_mp_batch.h"
+#include "enet_mp_rate_limit.h"
+#include "enet_mp_network_thread.h"
+#include "enet_mp_interest.h"
+#include "enet_mp_scheduler.h"
+#include "enet_mp_compression.h"
+#include "enet_mp_metrics.h"
+#include "enet_mp_auth_queue.h"
 
 
 typedef enum _ClientSlotState
 {
     CLIENT_SLOT_UNUSED,
     CLIENT_SLOT_UNAUTHENTICATED,
-    CLIENT_SLOT_ACTIVE
+    CLIENT_SLOT_ACTIVE,
+    CLIENT_SLOT_SUSPENDED // Connection dropped; kept until the session expires.
 
 } ClientSlotState;
 
+// An ENet host and the client slots it serves.  Servers which are not
+// sharded have exactly one.
+typedef struct _Shard
+{
+    ENetHost* host;
+    NetworkThread* network_thread; // Owns the host in threaded mode.
+    int first_client_slot;
+    int client_slot_count;
+
+    // Cached query reply or `NULL`.  Each shard has its own, since packets
+    // may only be referenced by one network thread.
+    ENetPacket* information_packet;
+
+    // Admission control of connection attempts.  Used by the thread which
+    // services the host, i.e. the network thread in threaded mode.
+    AddressRateLimiter connect_rate_limiter;
+    TokenBucket connect_bucket;
+    int connect_rate; // Of all addresses, zero means unlimited.
+
+} Shard;
+
 typedef struct _ClientSlot
 {
     ClientSlotState state;
     void* user_data;
+    Shard* shard;
     ENetPeer* peer;
-    enet_uint32 reply_time; // Client will be disconnected if it has not
-                            // replied before reply_timeout.
+    enet_uint32 connect_id;
+    Timer reply_timer; // Client will be disconnected if it has not
+                       // replied before reply_timeout.
+    SnapshotRing* snapshots; // Allocated when the first snapshot is sent.
+    MessageBatcher batcher;
+    SendScheduler* scheduler; // Allocated when the first packet is scheduled.
+    PeerMetrics metrics; // Kept when the slot is released.
+    SessionToken session; // Zero if the client can't resume.
+    Timer session_timer; // Releases suspended slots.
+    bool auth_requested; // The client has sent its auth request.
+    bool disconnecting; // The server asked the client to disconnect.
+    ENetMpDisconnectReason disconnect_reason; // Given by the server.
 } ClientSlot;
 
 struct _ENetMpServer
 {
     void* user_data;
     ENetMpServerCallbacks callbacks;
-    ENetHost* host;
+    Shard* shards;
+    int shard_count;
+    bool threaded;
     int user_channel_count;
     int client_slot_count;
     ClientSlot* client_slots;
+    Bitset free_client_slots;
+    Bitset active_client_slots;
+    Bitset batching_client_slots; // Slots with pending message batches.
+    Bitset scheduling_client_slots; // Slots with scheduled packets.
+    int client_send_rate;
+    float schedule_age_boost;
+    bool batch_messages;
     enet_uint32 reply_timeout;
+    bool deferred_auth;
+    AuthQueue auth_decisions; // Filled by any thread in deferred auth mode.
+    bool auth_batch_open; // client_connecting was called during this service.
+    enet_uint32 session_timeout; // Zero disables sessions.
+    enet_uint32 tick_interval; // Microseconds; zero if there is no tick rate.
+    atomic_bool stop_requested; // Ends enet_mp_server_run.
+    TimerWheel timers;
+    Logger logger;
+    VariableRegistry variables;
+    PacketPool* packet_pool;
+    Compressor compressor;
+
+    char* information; // Set by the application.
+    int information_size;
+    AddressRateLimiter query_rate_limiter;
+    int max_pending_clients; // Zero means unlimited.
+    int pending_client_count; // Unauthenticated client slots.
+
+    InterestGrid interest;
+    int* interest_recipients; // Scratch space of entity updates.
+
+    // Of the event which is being dispatched, if it has been queued.
+    enet_uint32 event_connect_id;
+    ENetAddress event_address;
+    bool event_queued;
+
+    // ENet events which enet_mp_server_run received while waiting for the
+    // next tick.  Bounded, so a flood of events can't grow it.
+    NetworkEvent* pending_events;
+    int pending_event_count;
+    int pending_event_capacity;
+    int max_pending_event_count;
+
+    ENetMpServerMetrics metrics;
 };
 
+static const enet_uint32 DEFAULT_REPLY_TIMEOUT = 1000;
+static const int DEFAULT_QUERY_RATE_LIMIT = 4;
+static const int QUERY_RATE_LIMITER_SIZE = 1024;
+static const int DEFAULT_CONNECT_RATE_LIMIT = 4;
+static const enet_uint32 DEFAULT_CONNECT_BLOCK_TIME = 5000;
+static const int CONNECT_RATE_LIMITER_SIZE = 4096;
+static const int TIMER_BUCKET_COUNT = 256;
+static const enet_uint32 TIMER_RESOLUTION = 16;
+static const int NETWORK_QUEUE_SIZE = 4096;
+static const int MAX_RUN_POLL_INTERVAL = 4;
+static const float DEFAULT_INTEREST_CELL_SIZE = 64;
+static const float DEFAULT_SCHEDULE_AGE_BOOST = 1;
+
+
+static int get_client_slot_index( const ENetMpServer* server, const ClientSlot* slot );
+static void release_client_slot( ENetMpServer* server, ClientSlot* slot );
+static int ENET_CALLBACK intercept_datagram( ENetHost* host, ENetEvent* event );
+
 
-static int find_client_slot_by_peer( const ENetMpServer* server, const ENetPeer* peer );
+// Shard i listens on the configured port + i and gets an equal share of the
+// client slots.
+static void create_shards( ENetMpServer* server,
+                           const ENetMpServerConfiguration* config )
+{
+    server->shards = (Shard*)calloc(server->shard_count, sizeof(Shard));
+    int i = 0;
+    for(; i < server->shard_count; i++)
+    {
+        Shard* shard = &server->shards[i];
+        shard->first_client_slot = server->client_slot_count * i / server->shard_count;
+        shard->client_slot_count =
+            server->client_slot_count * (i+1) / server->shard_count -
+            shard->first_client_slot;
+
+        ENetAddress address = config->address;
+        if(address.port != ENET_PORT_ANY)
+            address.port = (enet_uint16)(address.port + i);
+        shard->host = enet_host_create(&address,
+                                       shard->client_slot_count,
+                                       server->user_channel_count + INTERNAL_CHANNEL_COUNT,
+                                       config->incoming_bandwidth,
+                                       config->outgoing_bandwidth);
+        assert(shard->host);
+        shard->host->intercept = intercept_datagram;
 
+        const int connect_rate_limit =
+            config->connect_rate_limit > 0 ? config->connect_rate_limit
+                                           : DEFAULT_CONNECT_RATE_LIMIT;
+        enet_uint32 connect_block_time = DEFAULT_CONNECT_BLOCK_TIME;
+        if(config->connect_block_time > 0)
+            connect_block_time = (enet_uint32)config->connect_block_time;
+        else if(config->connect_block_time < 0)
+            connect_block_time = 0;
+        address_rate_limiter_init(&shard->connect_rate_limiter,
+                                  CONNECT_RATE_LIMITER_SIZE,
+                                  connect_rate_limit,
+                                  connect_rate_limit*2,
+                                  connect_block_time);
+        shard->connect_rate = config->global_connect_rate_limit;
+        token_bucket_init(&shard->connect_bucket, shard->connect_rate*2, enet_time_get());
+    }
+}
 
 ENetMpServer* enet_mp_server_create( const ENetMpServerConfiguration* config )
 {
     assert(config->max_clients >= 0);
     assert(config->channel_count >= 0);
+    assert(config->reply_timeout >= 0);
+    assert(config->query_rate_limit >= 0);
+    assert(config->connect_rate_limit >= 0);
+    assert(config->global_connect_rate_limit >= 0);
+    assert(config->max_pending_clients >= 0);
+    assert(config->session_timeout >= 0);
+    assert(config->tick_rate >= 0 && config->tick_rate <= 1000000);
+    assert(config->shard_count >= 0);
+    assert(config->client_send_rate >= 0);
+    assert(config->schedule_age_boost >= 0);
+    // Shards are only useful if each of them has its own thread.
+    assert(config->shard_count <= 1 || config->threaded);
+    assert(config->shard_count <= 1 || config->shard_count <= config->max_clients);
 
     ENetMpServer* server = (ENetMpServer*)calloc(1, sizeof(ENetMpServer));
 
@@ -48,28 +210,262 @@ ENetMpServer* enet_mp_server_create( const ENetMpServerConfiguration* config )
     server->client_slot_count = config->max_clients;
     server->callbacks = config->callbacks;
     server->user_channel_count = config->channel_count;
-    server->host = enet_host_create(&config->address,
-                                    server->client_slot_count,
-                                    server->user_channel_count + INTERNAL_CHANNEL_COUNT,
-                                    0, // unlimited ingoing bandwidth
-                                    0); // unlimited outgoing bandwidth
-    assert(server->host);
+    server->shard_count = config->shard_count > 0 ? config->shard_count : 1;
+    server->max_pending_event_count = NETWORK_QUEUE_SIZE * server->shard_count;
+    server->threaded = config->threaded != 0;
+    logger_init(&server->logger, &config->log);
+    create_shards(server, config);
     server->client_slots = (ClientSlot*)calloc(server->client_slot_count,
                                                sizeof(ClientSlot));
-    server->reply_timeout = 1000;
+    int i = 0;
+    for(; i < server->client_slot_count; i++)
+        peer_metrics_init(&server->client_slots[i].metrics,
+                          server->user_channel_count + INTERNAL_CHANNEL_COUNT,
+                          &server->metrics.total);
+    bitset_init(&server->free_client_slots, server->client_slot_count);
+    bitset_set_all(&server->free_client_slots);
+    bitset_init(&server->active_client_slots, server->client_slot_count);
+    bitset_init(&server->batching_client_slots, server->client_slot_count);
+    bitset_init(&server->scheduling_client_slots, server->client_slot_count);
+    server->client_send_rate = config->client_send_rate;
+    server->schedule_age_boost = config->schedule_age_boost > 0 ? config->schedule_age_boost
+                                                                : DEFAULT_SCHEDULE_AGE_BOOST;
+    server->batch_messages = config->batch_messages != 0;
+    if(config->reply_timeout > 0)
+        server->reply_timeout = config->reply_timeout;
+    else
+        server->reply_timeout = DEFAULT_REPLY_TIMEOUT;
+    server->deferred_auth = config->deferred_auth != 0;
+    server->max_pending_clients = config->max_pending_clients;
+    server->session_timeout = (enet_uint32)config->session_timeout;
+    if(config->tick_rate > 0)
+        server->tick_interval = 1000000 / (enet_uint32)config->tick_rate;
+    atomic_init(&server->stop_requested, false);
+    auth_queue_init(&server->auth_decisions);
+    timer_wheel_init(&server->timers,
+                     TIMER_BUCKET_COUNT,
+                     TIMER_RESOLUTION,
+                     enet_time_get());
+    variable_registry_init(&server->variables);
+    // In threaded mode packets are destroyed on the network thread.
+    server->packet_pool = packet_pool_create(config->threaded != 0);
+    compressor_init(&server->compressor,
+                    &config->compression,
+                    server->user_channel_count,
+                    get_internal_channel(SNAPSHOT_CHANNEL, server->user_channel_count),
+                    server->packet_pool);
+
+    const int query_rate_limit = config->query_rate_limit > 0 ? config->query_rate_limit
+                                                              : DEFAULT_QUERY_RATE_LIMIT;
+    address_rate_limiter_init(&server->query_rate_limiter,
+                              QUERY_RATE_LIMITER_SIZE,
+                              query_rate_limit,
+                              query_rate_limit*2,
+                              0);
+
+    interest_grid_init(&server->interest,
+                       config->interest_cell_size > 0 ? config->interest_cell_size
+                                                      : DEFAULT_INTEREST_CELL_SIZE,
+                       server->client_slot_count);
+    server->interest_recipients = (int*)calloc(server->client_slot_count > 0 ? server->client_slot_count : 1,
+                                               sizeof(int));
+
+    if(server->threaded)
+    {
+        for(i = 0; i < server->shard_count; i++)
+        {
+            Shard* shard = &server->shards[i];
+            shard->network_thread = (NetworkThread*)malloc(sizeof(NetworkThread));
+            network_thread_start(shard->network_thread,
+                                 shard->host,
+                                 server,
+                                 NETWORK_QUEUE_SIZE);
+        }
+    }
 
     return server;
 }
 
+static Shard* get_host_shard( ENetMpServer* server, const ENetHost* host )
+{
+    int i = 0;
+    for(; i < server->shard_count; i++)
+        if(server->shards[i].host == host)
+            return &server->shards[i];
+    assert(!"Host belongs to no shard!");
+    return NULL;
+}
+
+// ENetPeer::host never changes, so this is safe in threaded mode.
+static Shard* get_peer_shard( ENetMpServer* server, const ENetPeer* peer )
+{
+    return get_host_shard(server, peer->host);
+}
+
+static void push_network_command( Shard* shard,
+                                  NetworkCommandType type,
+                                  ENetPeer* peer,
+                                  enet_uint32 connect_id,
+                                  enet_uint8 channel,
+                                  enet_uint32 data,
+                                  ENetPacket* packet )
+{
+    NetworkCommand command;
+    memset(&command, 0, sizeof(command));
+    command.type = type;
+    command.peer = peer;
+    command.connect_id = connect_id;
+    command.channel = channel;
+    command.data = data;
+    command.packet = packet;
+    network_thread_push_command(shard->network_thread, &command);
+}
+
+// All packets leave the server through here, so that they are handed to the
+// network thread in threaded mode.  Takes ownership of unreferenced packets.
+// Peers whose events are queued may have been reused meanwhile, so sends to
+// peers which are no longer connected with connect_id fail.
+static int send_to_peer( Shard* shard,
+                         ENetPeer* peer,
+                         enet_uint32 connect_id,
+                         enet_uint8 channel,
+                         ENetPacket* packet )
+{
+    if(shard->network_thread)
+    {
+        push_network_command(shard, NETWORK_COMMAND_SEND,
+                             peer, connect_id, channel, 0, packet);
+        return 0;
+    }
+    if(!is_peer_current(peer, connect_id))
+        return -1;
+    return enet_peer_send(peer, channel, packet);
+}
+
+// The peer may already be disconnecting while its events wait behind the
+// event budget of a service call.  Such sends fail and the packet is dropped.
+static void send_to_client( ClientSlot* slot,
+                            enet_uint8 channel,
+                            ENetPacket* packet )
+{
+    // The packet may be gone once it's sent in threaded mode.
+    const int size = (int)packet->dataLength;
+    if(send_to_peer(slot->shard, slot->peer, slot->connect_id, channel, packet) == 0)
+        peer_metrics_count_sent(&slot->metrics, channel, size);
+    else if(packet->referenceCount == 0)
+        enet_packet_destroy(packet);
+}
+
+static void disconnect_peer( Shard* shard,
+                             ENetPeer* peer,
+                             enet_uint32 connect_id,
+                             ENetMpDisconnectReason reason,
+                             bool later )
+{
+    if(shard->network_thread)
+        push_network_command(shard,
+                             later ? NETWORK_COMMAND_DISCONNECT_LATER
+                                   : NETWORK_COMMAND_DISCONNECT_NOW,
+                             peer, connect_id, 0, (enet_uint32)reason, NULL);
+    else if(!is_peer_current(peer, connect_id))
+        return;
+    else if(later)
+        enet_peer_disconnect_later(peer, (enet_uint32)reason);
+    else
+        enet_peer_disconnect_now(peer, (enet_uint32)reason);
+}
+
+// Drops a reference which the server holds.  Once a packet has been passed
+// to the network thread, only that thread may change its reference count.
+static void release_packet( Shard* shard, ENetPacket* packet )
+{
+    if(shard->network_thread)
+        push_network_command(shard, NETWORK_COMMAND_RELEASE_PACKET,
+                             NULL, 0, 0, 0, packet);
+    else
+        enet_mp_packet_release(packet);
+}
+
+// Creates the packet which is sent for the given one, which is left to the
+// caller.  While batching is enabled, clients expect frames on user
+// channels, so packets are framed as single messages first.  Then the
+// compression policy of the channel is applied.  May return the given
+// packet if neither applies.
+static ENetPacket* encode_packet( ENetMpServer* server,
+                                  enet_uint8 channel,
+                                  ENetPacket* packet )
+{
+    ENetPacket* framed = packet;
+    if(server->batch_messages && channel < server->user_channel_count)
+        framed = frame_single_message(server->packet_pool, packet);
+    if(!compressor_is_enabled(&server->compressor, channel))
+        return framed;
+    ENetPacket* compressed = compress_packet(&server->compressor, channel, framed);
+    if(framed != packet)
+        enet_packet_destroy(framed);
+    return compressed;
+}
+
+// Like encode_packet, but for packets which the server owns from here on;
+// the original is destroyed unless it is referenced elsewhere.
+static ENetPacket* prepare_packet( ENetMpServer* server,
+                                   enet_uint8 channel,
+                                   ENetPacket* packet )
+{
+    ENetPacket* encoded = encode_packet(server, channel, packet);
+    if(encoded != packet && packet->referenceCount == 0)
+        enet_packet_destroy(packet);
+    return encoded;
+}
+
+// Peers may be reused before queued events are dispatched, so the connect
+// ID and address are taken from the event.
+static enet_uint32 get_event_connect_id( const ENetMpServer* server,
+                                         const ENetPeer* peer )
+{
+    if(server->event_queued)
+        return server->event_connect_id;
+    else
+        return peer->connectID;
+}
+
+static const ENetAddress* get_event_address( const ENetMpServer* server,
+                                             const ENetPeer* peer )
+{
+    if(server->event_queued)
+        return &server->event_address;
+    else
+        return &peer->address;
+}
+
+static bool is_client_connected( const ClientSlot* slot )
+{
+    return slot->state == CLIENT_SLOT_UNAUTHENTICATED ||
+           slot->state == CLIENT_SLOT_ACTIVE;
+}
+
+// Reasons are passed by the application or sent by clients, so unknown
+// ones are counted as ENET_MP_DISCONNECT_UNKNOWN.
+static ENetMpDisconnectReason get_known_reason( ENetMpDisconnectReason reason )
+{
+    if(is_in_bounds((int)reason, ENET_MP_DISCONNECT_REASON_COUNT))
+        return reason;
+    else
+        return ENET_MP_DISCONNECT_UNKNOWN;
+}
+
 static void disconnect_client_later( ENetMpServer* server,
                                      ClientSlot* slot,
                                      ENetMpDisconnectReason reason )
 {
     assert(slot->state != CLIENT_SLOT_UNUSED);
-    printf("disconnect_client_later: client=%d reason='%s'\n",
-           find_client_slot_by_peer(server, slot->peer),
-           disconnect_reason_as_string(reason));
-    enet_peer_disconnect_later(slot->peer, (int)reason);
+    LOG(&server->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+        "disconnect_client_later: client=%d reason='%s'",
+        get_client_slot_index(server, slot),
+        disconnect_reason_as_string(reason));
+    slot->disconnecting = true;
+    slot->disconnect_reason = reason;
+    disconnect_peer(slot->shard, slot->peer, slot->connect_id, reason, true);
 }
 
 static void disconnect_client_now( ENetMpServer* server,
@@ -77,11 +473,15 @@ static void disconnect_client_now( ENetMpServer* server,
                                    ENetMpDisconnectReason reason )
 {
     assert(slot->state != CLIENT_SLOT_UNUSED);
-    printf("disconnect_client_now: client=%d reason='%s'\n",
-           find_client_slot_by_peer(server, slot->peer),
-           disconnect_reason_as_string(reason));
-    enet_peer_disconnect_now(slot->peer, (int)reason);
-    slot->state = CLIENT_SLOT_UNUSED;
+    LOG(&server->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+        "disconnect_client_now: client=%d reason='%s'",
+        get_client_slot_index(server, slot),
+        disconnect_reason_as_string(reason));
+    if(is_client_connected(slot))
+        disconnect_peer(slot->shard, slot->peer, slot->connect_id, reason, false);
+    server->metrics.disconnects[get_known_reason(reason)]++;
+    // No disconnect event will be generated, so the slot must be released here.
+    release_client_slot(server, slot);
 }
 
 void enet_mp_server_destroy( ENetMpServer* server )
@@ -94,63 +494,354 @@ void enet_mp_server_destroy( ENetMpServer* server )
             disconnect_client_now(server, slot, ENET_MP_DISCONNECT_SERVER_SHUTDOWN);
     }
 
-    enet_host_destroy(server->host);
+    for(i = 0; i < server->pending_event_count; i++)
+    {
+        const ENetEvent* event = &server->pending_events[i].enet_event;
+        if(event->type == ENET_EVENT_TYPE_RECEIVE)
+            enet_packet_destroy(event->packet);
+    }
+
+    for(i = 0; i < server->shard_count; i++)
+    {
+        Shard* shard = &server->shards[i];
+        if(shard->information_packet)
+            release_packet(shard, shard->information_packet);
+        if(shard->network_thread)
+        {
+            network_thread_stop(shard->network_thread);
+            network_thread_destroy(shard->network_thread);
+            free(shard->network_thread);
+        }
+        enet_host_destroy(shard->host);
+        address_rate_limiter_destroy(&shard->connect_rate_limiter);
+    }
+    compressor_destroy(&server->compressor);
+    // Destroyed after the host, which still releases queued packets.
+    packet_pool_destroy(server->packet_pool);
+    timer_wheel_destroy(&server->timers);
+    auth_queue_destroy(&server->auth_decisions);
+    variable_registry_destroy(&server->variables);
+    address_rate_limiter_destroy(&server->query_rate_limiter);
+    interest_grid_destroy(&server->interest);
+    free(server->interest_recipients);
+    free(server->pending_events);
+    free(server->information);
+    bitset_destroy(&server->free_client_slots);
+    bitset_destroy(&server->active_client_slots);
+    bitset_destroy(&server->batching_client_slots);
+    bitset_destroy(&server->scheduling_client_slots);
+    for(i = 0; i < server->client_slot_count; i++)
+        peer_metrics_destroy(&server->client_slots[i].metrics);
     free(server->client_slots);
+    free(server->shards);
     free(server);
 }
 
-static ClientSlot* find_unused_client_slot( ENetMpServer* server )
+// Must be called whenever the content of the query reply changes.
+static void discard_information_packets( ENetMpServer* server )
 {
     int i = 0;
-    for(; i < server->client_slot_count; i++)
+    for(; i < server->shard_count; i++)
     {
-        ClientSlot* slot = &server->client_slots[i];
-        if(slot->state == CLIENT_SLOT_UNUSED)
-            return slot;
+        Shard* shard = &server->shards[i];
+        if(shard->information_packet)
+        {
+            release_packet(shard, shard->information_packet);
+            shard->information_packet = NULL;
+        }
     }
-    return NULL;
 }
 
-static void handle_query( const ENetMpServer* server, ENetPeer* peer )
+// The query reply is encoded once and then shared by all replies until it
+// is discarded.  The server holds a reference, so ENet won't destroy it.
+static ENetPacket* get_information_packet( ENetMpServer* server, Shard* shard )
+{
+    if(shard->information_packet)
+        return shard->information_packet;
+
+    const int max_size = 1 +
+                         3*MAX_VARINT_SIZE +
+                         server->information_size;
+    ENetPacket* packet = packet_pool_acquire(server->packet_pool,
+                                             max_size,
+                                             ENET_PACKET_FLAG_RELIABLE);
+    ENetMpBitWriter writer;
+    enet_mp_bit_writer_init_packet(&writer, packet);
+    write_message_type(&writer, SERVER_INFORMATION_MESSAGE);
+
+    const int used_slots = enet_mp_server_get_used_client_slot_count(server);
+    enet_mp_bit_writer_write_varint(&writer, (enet_uint32)(server->client_slot_count - used_slots));
+    enet_mp_bit_writer_write_varint(&writer, (enet_uint32)used_slots);
+    enet_mp_bit_writer_write_varint(&writer, (enet_uint32)server->information_size);
+    enet_mp_bit_writer_write_bytes(&writer, server->information, server->information_size);
+    const int size = enet_mp_bit_writer_finish(&writer);
+    assert(size >= 0);
+
+    packet->referenceCount++;
+    shard->information_packet = packet;
+    return packet;
+}
+
+static ClientSlot* allocate_client_slot( ENetMpServer* server, Shard* shard )
+{
+    const int index = bitset_find_first_set(&server->free_client_slots,
+                                            shard->first_client_slot);
+    if(index < 0 ||
+       index >= shard->first_client_slot + shard->client_slot_count)
+        return NULL;
+    bitset_clear(&server->free_client_slots, index);
+    discard_information_packets(server);
+    return &server->client_slots[index];
+}
+
+// Drops messages and packets which wait for being sent to the client.
+static void discard_client_queues( ENetMpServer* server, ClientSlot* slot )
+{
+    const int index = get_client_slot_index(server, slot);
+    if(slot->batcher.batches)
+        message_batcher_destroy(&slot->batcher);
+    if(slot->scheduler)
+    {
+        send_scheduler_destroy(slot->scheduler);
+        free(slot->scheduler);
+        slot->scheduler = NULL;
+    }
+    bitset_clear(&server->batching_client_slots, index);
+    bitset_clear(&server->scheduling_client_slots, index);
+}
+
+static void release_client_slot( ENetMpServer* server, ClientSlot* slot )
+{
+    assert(slot->state != CLIENT_SLOT_UNUSED);
+    const int index = get_client_slot_index(server, slot);
+    if(slot->state == CLIENT_SLOT_UNAUTHENTICATED)
+        server->pending_client_count--;
+    if(is_client_connected(slot))
+        slot->peer->data = NULL;
+    slot->state = CLIENT_SLOT_UNUSED;
+    timer_wheel_cancel(&server->timers, &slot->reply_timer);
+    timer_wheel_cancel(&server->timers, &slot->session_timer);
+    if(slot->snapshots)
+    {
+        snapshot_ring_destroy(slot->snapshots);
+        free(slot->snapshots);
+        slot->snapshots = NULL;
+    }
+    discard_client_queues(server, slot);
+    interest_grid_clear_view(&server->interest, index);
+    bitset_clear(&server->active_client_slots, index);
+    bitset_set(&server->free_client_slots, index);
+    discard_information_packets(server);
+}
+
+static bool take_query_token( ENetMpServer* server, const ENetAddress* address )
+{
+    // The service time of the host belongs to the network thread.
+    return address_rate_limiter_take(&server->query_rate_limiter,
+                                     address->host,
+                                     enet_time_get());
+}
+
+// Queries which use an ENet connection get the reply on channel 0, since
+// they don't know how many channels the server has.
+static void handle_query( ENetMpServer* server, ENetPeer* peer )
+{
+    peer->data = NULL;
+    Shard* shard = get_peer_shard(server, peer);
+    const enet_uint32 connect_id = get_event_connect_id(server, peer);
+    if(!take_query_token(server, get_event_address(server, peer)))
+    {
+        disconnect_peer(shard, peer, connect_id, ENET_MP_DISCONNECT_UNKNOWN, false);
+        return;
+    }
+
+    // Fails if the peer is already gone, which the cached packet survives.
+    send_to_peer(shard,
+                 peer,
+                 connect_id,
+                 0,
+                 get_information_packet(server, shard));
+    disconnect_peer(shard, peer, connect_id, ENET_MP_DISCONNECT_MANUAL, true);
+}
+
+static void handle_connectionless_query( ENetMpServer* server,
+                                         Shard* shard,
+                                         const ENetAddress* address )
+{
+    if(!take_query_token(server, address))
+        return;
+
+    ENetPacket* packet = get_information_packet(server, shard);
+    if(shard->network_thread)
+    {
+        // The server's reference keeps the packet alive until the command
+        // has been executed.
+        NetworkCommand command;
+        memset(&command, 0, sizeof(command));
+        command.type = NETWORK_COMMAND_SEND_QUERY_REPLY;
+        command.packet = packet;
+        command.address = *address;
+        network_thread_push_command(shard->network_thread, &command);
+        return;
+    }
+
+    ENetBuffer buffers[2];
+    buffers[0].data = (void*)QUERY_REPLY_MAGIC;
+    buffers[0].dataLength = QUERY_MAGIC_SIZE;
+    buffers[1].data = packet->data;
+    buffers[1].dataLength = packet->dataLength;
+    enet_socket_send(shard->host->socket, address, buffers, 2);
+}
+
+// ENet only accepts connect commands in datagrams which are addressed to
+// the maximum peer ID, so the header tells them apart from all others.
+static bool is_connect_datagram( const ENetHost* host )
+{
+    if(host->receivedDataLength < 2)
+        return false;
+    const enet_uint16 peer_id = (enet_uint16)((host->receivedData[0] << 8) |
+                                              host->receivedData[1]);
+    return (peer_id & ~(ENET_PROTOCOL_HEADER_FLAG_MASK |
+                        ENET_PROTOCOL_HEADER_SESSION_MASK)) == ENET_PROTOCOL_MAXIMUM_PEER_ID;
+}
+
+// Runs before ENet allocates a peer, so dropped attempts cost nothing
+// but the lookup.  Each shard admits independently.
+static bool admit_connect( Shard* shard, const ENetHost* host )
+{
+    const enet_uint32 time = host->serviceTime;
+    if(!address_rate_limiter_take(&shard->connect_rate_limiter,
+                                  host->receivedAddress.host,
+                                  time))
+        return false;
+    return shard->connect_rate == 0 ||
+           token_bucket_take(&shard->connect_bucket,
+                             shard->connect_rate,
+                             shard->connect_rate*2,
+                             time);
+}
+
+// Is called by ENet for every received datagram, so anything which is
+// neither a query nor a connection attempt must be passed on as cheaply
+// as possible.
+static int ENET_CALLBACK intercept_datagram( ENetHost* host, ENetEvent* event )
+{
+    if(host->receivedDataLength != QUERY_MAGIC_SIZE ||
+       memcmp(host->receivedData, QUERY_REQUEST_MAGIC, QUERY_MAGIC_SIZE) != 0)
+    {
+        if(host->receivedDataLength == QUERY_MAGIC_SIZE &&
+           memcmp(host->receivedData, WAKEUP_MAGIC, QUERY_MAGIC_SIZE) == 0)
+            return 1; // Has woken the network thread by arriving.
+        if(!is_connect_datagram(host))
+            return 0;
+        ENetMpServer* server = (ENetMpServer*)get_service_context();
+        if(!server || admit_connect(get_host_shard(server, host), host))
+            return 0;
+        return 1; // Dropped.
+    }
+
+    ENetMpServer* server = (ENetMpServer*)get_service_context();
+    if(!server)
+        return 1;
+
+    Shard* shard = get_host_shard(server, host);
+    if(shard->network_thread)
+    {
+        // Runs on the network thread: the query is answered by the game
+        // thread.  Queries are dropped while the game thread lags behind.
+        NetworkEvent query;
+        memset(&query, 0, sizeof(query));
+        query.type = NETWORK_EVENT_QUERY;
+        query.address = host->receivedAddress;
+        network_thread_try_push_event(shard->network_thread, &query);
+    }
+    else
+    {
+        handle_connectionless_query(server, shard, &host->receivedAddress);
+    }
+    return 1; // The datagram has been handled.
+}
+
+static void handle_reply_timeout( void* context, Timer* timer )
 {
-    enet_peer_disconnect_now(peer, ENET_MP_DISCONNECT_UNKNOWN);
-    UNIMPLEMENTED();
+    ENetMpServer* server = (ENetMpServer*)context;
+    ClientSlot* slot = CONTAINER_OF(timer, ClientSlot, reply_timer);
+    disconnect_client_later(server, slot, ENET_MP_DISCONNECT_REPLY_TIMEOUT);
 }
 
 static void handle_new_client( ENetMpServer* server, ENetPeer* peer )
 {
-    ClientSlot* slot = find_unused_client_slot(server);
+    Shard* shard = get_peer_shard(server, peer);
+    if(server->max_pending_clients > 0 &&
+       server->pending_client_count >= server->max_pending_clients)
+    {
+        peer->data = NULL;
+        server->metrics.disconnects[ENET_MP_DISCONNECT_RATE_LIMITED]++;
+        disconnect_peer(shard,
+                        peer,
+                        get_event_connect_id(server, peer),
+                        ENET_MP_DISCONNECT_RATE_LIMITED,
+                        false);
+        return;
+    }
+
+    ClientSlot* slot = allocate_client_slot(server, shard);
     if(slot)
     {
+        const PeerMetrics metrics = slot->metrics;
         memset(slot, 0, sizeof(ClientSlot));
+        slot->metrics = metrics;
+        peer_metrics_reset(&slot->metrics);
+        server->metrics.connects++;
         slot->state = CLIENT_SLOT_UNAUTHENTICATED;
+        server->pending_client_count++;
+        slot->shard = shard;
         slot->peer = peer;
-        slot->reply_time = enet_time_get() + server->reply_timeout;
+        slot->connect_id = get_event_connect_id(server, peer);
+        timer_init(&slot->reply_timer, handle_reply_timeout, server);
+        timer_wheel_schedule(&server->timers,
+                             &slot->reply_timer,
+                             enet_time_get() + server->reply_timeout);
+        peer->data = slot;
     }
     else
     {
-        enet_peer_disconnect_now(peer, ENET_MP_DISCONNECT_SERVER_FULL);
-        UNIMPLEMENTED();
+        peer->data = NULL;
+        server->metrics.disconnects[ENET_MP_DISCONNECT_SERVER_FULL]++;
+        disconnect_peer(shard,
+                        peer,
+                        get_event_connect_id(server, peer),
+                        ENET_MP_DISCONNECT_SERVER_FULL,
+                        false);
     }
 }
 
-static void handle_unknown_connection( const ENetMpServer* server, ENetPeer* peer )
+static void handle_unknown_connection( ENetMpServer* server, ENetPeer* peer )
 {
-    enet_peer_disconnect_now(peer, ENET_MP_DISCONNECT_UNKNOWN);
+    peer->data = NULL;
+    disconnect_peer(get_peer_shard(server, peer),
+                    peer,
+                    get_event_connect_id(server, peer),
+                    ENET_MP_DISCONNECT_UNKNOWN,
+                    false);
     assert(!"Unknown connection type!");
 }
 
+static int get_client_slot_index( const ENetMpServer* server, const ClientSlot* slot )
+{
+    return (int)(slot - server->client_slots);
+}
+
+// The client slot is stamped into ENetPeer::data when a client connects.
+// Returns -1 for peers without a client slot (e.g. query connections).
 static int find_client_slot_by_peer( const ENetMpServer* server, const ENetPeer* peer )
 {
-    int i = 0;
-    for(; i < server->client_slot_count; i++)
+    const ClientSlot* slot = (const ClientSlot*)peer->data;
+    if(slot)
     {
-        ClientSlot* slot = &server->client_slots[i];
-        if(slot->peer == peer)
-        {
-            assert(slot->state != CLIENT_SLOT_UNUSED);
-            return i;
-        }
+        assert(slot->peer == peer);
+        assert(slot->state != CLIENT_SLOT_UNUSED);
+        return get_client_slot_index(server, slot);
     }
     return -1;
 }
@@ -176,6 +867,80 @@ static void handle_connect( void* context,
     }
 }
 
+static void end_callback( ENetMpServer* server, enet_uint32 start_time )
+{
+    histogram_record(&server->metrics.callback_duration,
+                     get_microseconds() - start_time);
+}
+
+static void count_disconnect( ENetMpServer* server,
+                              const ClientSlot* slot,
+                              ENetMpDisconnectReason reason )
+{
+    ENetMpServerMetrics* metrics = &server->metrics;
+    if(slot->disconnecting)
+    {
+        metrics->disconnects[get_known_reason(slot->disconnect_reason)]++;
+        return;
+    }
+    reason = get_known_reason(reason);
+    if(reason == ENET_MP_DISCONNECT_UNKNOWN)
+        metrics->timeouts++;
+    metrics->disconnects[reason]++;
+}
+
+static void handle_session_timeout( void* context, Timer* timer )
+{
+    ENetMpServer* server = (ENetMpServer*)context;
+    ClientSlot* slot = CONTAINER_OF(timer, ClientSlot, session_timer);
+    const int slot_index = get_client_slot_index(server, slot);
+    count_disconnect(server, slot, ENET_MP_DISCONNECT_UNKNOWN);
+    release_client_slot(server, slot);
+    LOG(&server->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+        "handle_session_timeout: client=%d", slot_index);
+    const enet_uint32 start_time = get_microseconds();
+    server->callbacks.client_disconnected(server, slot_index, ENET_MP_DISCONNECT_UNKNOWN);
+    end_callback(server, start_time);
+}
+
+// Only connections which timed out are suspended.  Clients which left on
+// purpose send a reason.
+static bool can_suspend_client( const ENetMpServer* server,
+                                const ClientSlot* slot,
+                                ENetMpDisconnectReason reason )
+{
+    return server->session_timeout > 0 &&
+           slot->state == CLIENT_SLOT_ACTIVE &&
+           !slot->disconnecting &&
+           reason == ENET_MP_DISCONNECT_UNKNOWN &&
+           is_session_token_set(&slot->session);
+}
+
+// Keeps user data, snapshot baselines and the interest view, but drops
+// everything which was about to be sent.
+static void suspend_client( ENetMpServer* server, ClientSlot* slot )
+{
+    const int slot_index = get_client_slot_index(server, slot);
+    slot->peer->data = NULL;
+    slot->peer = NULL;
+    slot->state = CLIENT_SLOT_SUSPENDED;
+    bitset_clear(&server->active_client_slots, slot_index);
+    discard_client_queues(server, slot);
+    timer_init(&slot->session_timer, handle_session_timeout, server);
+    timer_wheel_schedule(&server->timers,
+                         &slot->session_timer,
+                         enet_time_get() + server->session_timeout);
+    server->metrics.suspends++;
+    LOG(&server->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+        "suspend_client: client=%d", slot_index);
+    if(server->callbacks.client_suspended)
+    {
+        const enet_uint32 start_time = get_microseconds();
+        server->callbacks.client_suspended(server, slot_index);
+        end_callback(server, start_time);
+    }
+}
+
 static void handle_disconnect( void* context,
                                ENetPeer* peer,
                                ENetMpDisconnectReason reason )
@@ -186,132 +951,997 @@ static void handle_disconnect( void* context,
     if(slot_index >= 0)
     {
         ClientSlot* slot = &server->client_slots[slot_index];
-        slot->state = CLIENT_SLOT_UNUSED;
-        printf("handle_disconnect: client=%d reason='%s'\n",
-               slot_index,
-               disconnect_reason_as_string(reason));
+        if(can_suspend_client(server, slot, reason))
+        {
+            suspend_client(server, slot);
+            return;
+        }
+        count_disconnect(server, slot, reason);
+        release_client_slot(server, slot);
+        LOG(&server->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+            "handle_disconnect: client=%d reason='%s'",
+            slot_index,
+            disconnect_reason_as_string(reason));
+        const enet_uint32 start_time = get_microseconds();
         server->callbacks.client_disconnected(server, slot_index, reason);
+        end_callback(server, start_time);
     }
 }
 
-static void handle_auth_request( ENetMpServer* server,
-                                 int client_slot,
-                                 const char* data,
-                                 int size )
+static ENetPacket* create_variable_packet( const ENetMpServer* server,
+                                          bool changes_only )
 {
-    assert(is_in_bounds(client_slot, server->client_slot_count));
-    ClientSlot* slot = &server->client_slots[client_slot];
-    assert(slot->state == CLIENT_SLOT_UNAUTHENTICATED);
-
-    const ClientAuthRequestHeader* header = (const ClientAuthRequestHeader*)data;
-    const char* auth_data = &data[sizeof(ClientAuthRequestHeader)];
-    const int auth_data_size = size - sizeof(ClientAuthRequestHeader);
-
-    if(auth_data_size == 0)
-        auth_data = NULL;
+    const int size = variable_registry_get_encoded_size(&server->variables,
+                                                        changes_only);
+    ENetPacket* packet = packet_pool_acquire(server->packet_pool,
+                                             size,
+                                             ENET_PACKET_FLAG_RELIABLE);
+    variable_registry_encode(&server->variables,
+                             changes_only,
+                             (char*)packet->data);
+    return packet;
+}
 
-    server->callbacks.client_connecting(server,
-                                        client_slot,
-                                        auth_data,
-                                        auth_data_size);
+static void send_all_variables( ENetMpServer* server, ClientSlot* slot )
+{
+    if(server->variables.variable_count == 0)
+        return;
 
-    // client_connecting callback could have disconnected the client
-    if(slot->state == CLIENT_SLOT_UNAUTHENTICATED)
-    {
-        slot->state = CLIENT_SLOT_ACTIVE;
-        slot->reply_time = 0;
-    }
+    ENetPacket* packet = create_variable_packet(server, false);
+    const enet_uint8 channel = get_internal_channel(VARIABLE_CHANNEL,
+                                                    server->user_channel_count);
+    send_to_client(slot, channel, packet);
 }
 
-static void handle_internal_message( ENetMpServer* server,
-                                     const ENetPacket* packet,
-                                     int client_slot )
+// Sends a packet by reference to clients in slot order.
+//
+// Each shard gets its own copy, since only one network thread may change the
+// reference count of a packet.  Client slots are partitioned in order, so the
+// shards are visited one after another.  The copies are made from the
+// original, so the broadcast of the first shard ends last.
+//
+// In threaded mode the reference count is owned by the network thread as
+// soon as the first send command has been queued.  A reference held until
+// all commands are queued keeps the packet alive meanwhile, and also keeps
+// failed sends from destroying it.
+typedef struct _Broadcast
 {
-    MessageType type;
-    int size;
-    const char* data = read_internal_message(packet, &type, &size);
+    ENetMpServer* server;
+    enet_uint8 channel;
+    ENetPacket* packet; // The original, which the first shard gets.
+    Shard* first_shard;
+    Shard* shard;
+    ENetPacket* shard_packet;
 
-    switch(type)
-    {
-        case CLIENT_AUTH_REQUEST_MESSAGE:
-            handle_auth_request(server, client_slot, data, size);
-            break;
+} Broadcast;
 
-        default:
-            assert(!"Unknown internal message type!");
-    }
+static void begin_broadcast( Broadcast* broadcast,
+                             ENetMpServer* server,
+                             enet_uint8 channel,
+                             ENetPacket* packet )
+{
+    memset(broadcast, 0, sizeof(Broadcast));
+    broadcast->server = server;
+    broadcast->channel = channel;
+    broadcast->packet = packet;
 }
 
-static void handle_receive( void* context,
-                            ENetPeer* peer,
-                            int channel,
-                            const ENetPacket* packet )
+static void broadcast_to_client( Broadcast* broadcast, int client_slot )
 {
-    ENetMpServer* server = (ENetMpServer*)context;
-    const int client_slot = find_client_slot_by_peer(server, peer);
-
-    const int user_channel_count = server->user_channel_count;
-    if(channel < user_channel_count)
+    ClientSlot* slot = &broadcast->server->client_slots[client_slot];
+    assert(slot->state == CLIENT_SLOT_ACTIVE);
+    if(slot->shard != broadcast->shard)
     {
-        assert(client_slot >= 0);
-        server->callbacks.client_sent_packet(server, client_slot, channel, packet);
-    }
-    else
-    {
-        const InternalChannel internal_channel =
-            (InternalChannel)(channel-user_channel_count);
-
-        switch(internal_channel)
+        ENetPacket* packet = broadcast->packet;
+        ENetPacket* shard_packet = broadcast->shard_packet;
+        if(shard_packet)
         {
-            case MESSAGE_CHANNEL:
-                handle_internal_message(server, packet, client_slot);
-                break;
-
-            default:
-                assert(!"Unknown internal channel!");
+            if(shard_packet != packet)
+                release_packet(broadcast->shard, shard_packet);
+            shard_packet = packet_pool_create_packet(broadcast->server->packet_pool,
+                                                     packet->data,
+                                                     (int)packet->dataLength,
+                                                     packet->flags & ~ENET_PACKET_FLAG_NO_ALLOCATE);
+        }
+        else
+        {
+            shard_packet = packet;
+            broadcast->first_shard = slot->shard;
         }
+        shard_packet->referenceCount++;
+        broadcast->shard = slot->shard;
+        broadcast->shard_packet = shard_packet;
     }
+    send_to_client(slot, broadcast->channel, broadcast->shard_packet);
 }
 
-static void disconnect_clients_with_reply_timeout( ENetMpServer* server )
+static void end_broadcast( Broadcast* broadcast )
 {
-    int i = 0;
-    for(; i < server->client_slot_count; i++)
+    ENetPacket* packet = broadcast->packet;
+    if(!broadcast->shard_packet)
     {
-        ClientSlot* slot = &server->client_slots[i];
-        if(slot->state != CLIENT_SLOT_UNUSED &&
-           slot->reply_time != 0 &&
-           enet_time_get() > slot->reply_time)
-        {
-            disconnect_client_later(server, slot, ENET_MP_DISCONNECT_REPLY_TIMEOUT);
-        }
+        if(packet->referenceCount == 0)
+            enet_packet_destroy(packet); // Nobody received it.
+        return;
     }
+    if(broadcast->shard_packet != packet)
+        release_packet(broadcast->shard, broadcast->shard_packet);
+    release_packet(broadcast->first_shard, packet);
 }
 
-void enet_mp_server_service( ENetMpServer* server, int timeout )
+// Sends the packet by reference to the given active clients which pass the
+// filter.
+static void send_to_recipients( ENetMpServer* server,
+                                enet_uint8 channel,
+                                ENetPacket* packet,
+                                const Bitset* recipients,
+                                ENetMpClientFilter filter,
+                                void* user_data )
 {
-    host_service(server->host, timeout, server, handle_connect,
-                                                handle_disconnect,
-                                                handle_receive);
-    disconnect_clients_with_reply_timeout(server);
+    Broadcast broadcast;
+    begin_broadcast(&broadcast, server, channel, packet);
+    int i = bitset_find_first_set(recipients, 0);
+    for(; i >= 0; i = bitset_find_first_set(recipients, i+1))
+        if(!filter || filter(server, i, user_data))
+            broadcast_to_client(&broadcast, i);
+    end_broadcast(&broadcast);
 }
 
-void* enet_mp_server_get_user_data( ENetMpServer* server )
+static void broadcast_packet( ENetMpServer* server,
+                              enet_uint8 channel,
+                              ENetPacket* packet,
+                              ENetMpClientFilter filter,
+                              void* user_data )
 {
-    return server->user_data;
+    send_to_recipients(server,
+                       channel,
+                       packet,
+                       &server->active_client_slots,
+                       filter,
+                       user_data);
 }
 
-ENetHost* enet_mp_server_get_host( ENetMpServer* server )
+static void send_variable_changes( ENetMpServer* server )
 {
-    return server->host;
+    if(!variable_registry_has_changes(&server->variables))
+        return;
+
+    ENetPacket* packet = create_variable_packet(server, true);
+    const enet_uint8 channel = get_internal_channel(VARIABLE_CHANNEL,
+                                                    server->user_channel_count);
+    broadcast_packet(server, channel, packet, NULL, NULL);
+    variable_registry_clear_changes(&server->variables);
 }
 
-int enet_mp_server_get_client_slot_count( ENetMpServer* server )
+// Issues a new session token with each activation, so tokens which may
+// have leaked during a previous connection become useless.
+static void send_activation( ENetMpServer* server, ClientSlot* slot, bool resumed )
 {
-    return server->client_slot_count;
+    memset(&slot->session, 0, sizeof(SessionToken));
+    if(server->session_timeout > 0 &&
+       !get_random_bytes(&slot->session, sizeof(SessionToken)))
+    {
+        memset(&slot->session, 0, sizeof(SessionToken));
+        LOG(&server->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_CONNECTION,
+            "Can't generate session token, so client=%d can't resume",
+            get_client_slot_index(server, slot));
+    }
+
+    ENetMpBitWriter writer;
+    begin_internal_message(&writer,
+                           server->packet_pool,
+                           SERVER_CLIENT_ACTIVATION_MESSAGE,
+                           2 + MAX_VARINT_SIZE + sizeof(SessionToken));
+    enet_mp_bit_writer_write_bool(&writer, resumed);
+    const bool resumable = is_session_token_set(&slot->session);
+    enet_mp_bit_writer_write_bool(&writer, resumable);
+    if(resumable)
+        write_session(&writer, get_client_slot_index(server, slot), &slot->session);
+    const int size = enet_mp_bit_writer_finish(&writer);
+    assert(size >= 0);
+    send_to_client(slot,
+                   get_internal_channel(MESSAGE_CHANNEL, server->user_channel_count),
+                   writer.packet);
 }
 
-static ClientSlot* get_client_slot( ENetMpServer* server, int index )
+static void activate_client( ENetMpServer* server, ClientSlot* slot )
+{
+    assert(slot->state == CLIENT_SLOT_UNAUTHENTICATED);
+    server->pending_client_count--;
+    slot->state = CLIENT_SLOT_ACTIVE;
+    bitset_set(&server->active_client_slots, get_client_slot_index(server, slot));
+    timer_wheel_cancel(&server->timers, &slot->reply_timer);
+    send_activation(server, slot, false);
+    send_all_variables(server, slot);
+}
+
+static bool is_same_session( const SessionToken* a, const SessionToken* b )
+{
+    // Doesn't stop at the first difference, so timing reveals nothing.
+    return ((a->words[0] ^ b->words[0]) | (a->words[1] ^ b->words[1])) == 0;
+}
+
+// Client and server time out independently, so a client may come back
+// before the server has noticed that the old connection is dead.
+static bool is_resumable( const ClientSlot* slot )
+{
+    return slot->state == CLIENT_SLOT_SUSPENDED ||
+           (slot->state == CLIENT_SLOT_ACTIVE &&
+            !slot->disconnecting &&
+            is_session_token_set(&slot->session));
+}
+
+// The connection moves from the slot it got when it connected to the
+// suspended slot.  The former was never announced to the application.
+static void resume_session( ENetMpServer* server,
+                            ClientSlot* slot,
+                            int session_slot,
+                            const SessionToken* token )
+{
+    ClientSlot* suspended = NULL;
+    if(is_in_bounds(session_slot, server->client_slot_count))
+        suspended = &server->client_slots[session_slot];
+    if(!suspended ||
+       suspended == slot ||
+       !is_resumable(suspended) ||
+       suspended->shard != slot->shard ||
+       !is_same_session(&suspended->session, token))
+    {
+        disconnect_client_later(server, slot, ENET_MP_DISCONNECT_SESSION_EXPIRED);
+        return;
+    }
+
+    if(suspended->state == CLIENT_SLOT_ACTIVE)
+    {
+        // The stale connection is dropped as if it had timed out just now.
+        disconnect_peer(suspended->shard,
+                        suspended->peer,
+                        suspended->connect_id,
+                        ENET_MP_DISCONNECT_UNKNOWN,
+                        false);
+        suspend_client(server, suspended);
+    }
+
+    ENetPeer* peer = slot->peer;
+    const enet_uint32 connect_id = slot->connect_id;
+    release_client_slot(server, slot);
+
+    timer_wheel_cancel(&server->timers, &suspended->session_timer);
+    suspended->state = CLIENT_SLOT_ACTIVE;
+    suspended->peer = peer;
+    suspended->connect_id = connect_id;
+    suspended->auth_requested = true;
+    peer->data = suspended;
+    bitset_set(&server->active_client_slots, session_slot);
+    server->metrics.resumes++;
+    LOG(&server->logger, ENET_MP_LOG_INFO, ENET_MP_LOG_CATEGORY_CONNECTION,
+        "resume_session: client=%d", session_slot);
+
+    // Variable changes which were sent meanwhile are lost.
+    send_activation(server, suspended, true);
+    send_all_variables(server, suspended);
+    if(server->callbacks.client_resumed)
+    {
+        const enet_uint32 start_time = get_microseconds();
+        server->callbacks.client_resumed(server, session_slot);
+        end_callback(server, start_time);
+    }
+}
+
+static void handle_auth_request( ENetMpServer* server,
+                                 int client_slot,
+                                 ENetMpBitReader* reader )
+{
+    assert(is_in_bounds(client_slot, server->client_slot_count));
+    ClientSlot* slot = &server->client_slots[client_slot];
+    if(slot->state != CLIENT_SLOT_UNAUTHENTICATED || slot->auth_requested)
+    {
+        LOG(&server->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+            "client=%d sent another auth request", client_slot);
+        return;
+    }
+    slot->auth_requested = true;
+
+    const enet_uint32 auth_data_size = enet_mp_bit_reader_read_varint(reader);
+    const void* auth_data = NULL;
+    if(auth_data_size <= (enet_uint32)reader->size)
+        auth_data = enet_mp_bit_reader_read_bytes(reader, (int)auth_data_size);
+    const bool resume = enet_mp_bit_reader_read_bool(reader) != 0;
+    SessionToken token;
+    int session_slot = -1;
+    if(resume)
+        session_slot = read_session(reader, &token);
+    if(!auth_data ||
+       enet_mp_bit_reader_has_error(reader) ||
+       (resume && session_slot < 0))
+    {
+        LOG(&server->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+            "client=%d sent malformed auth request", client_slot);
+        return;
+    }
+
+    if(resume)
+    {
+        resume_session(server, slot, session_slot, &token);
+        return;
+    }
+
+    if(auth_data_size == 0)
+        auth_data = NULL;
+
+    const enet_uint32 start_time = get_microseconds();
+    server->callbacks.client_connecting(server,
+                                        client_slot,
+                                        auth_data,
+                                        auth_data_size);
+    end_callback(server, start_time);
+
+    // The reply timer keeps running until the decision arrives.
+    if(server->deferred_auth)
+    {
+        server->auth_batch_open = true;
+        return;
+    }
+
+    // client_connecting callback could have disconnected the client
+    if(slot->state == CLIENT_SLOT_UNAUTHENTICATED)
+        activate_client(server, slot);
+}
+
+static void handle_internal_message( ENetMpServer* server,
+                                     const ENetPacket* packet,
+                                     int client_slot )
+{
+    ENetMpBitReader reader;
+    enet_mp_bit_reader_init_packet(&reader, packet);
+    const MessageType type = read_message_type(&reader);
+
+    switch(type)
+    {
+        case CLIENT_AUTH_REQUEST_MESSAGE:
+            handle_auth_request(server, client_slot, &reader);
+            break;
+
+        default:
+            LOG(&server->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+                "client=%d sent unknown internal message type %d",
+                client_slot, (int)type);
+    }
+}
+
+static void handle_snapshot_ack( ENetMpServer* server,
+                                 const ENetPacket* packet,
+                                 int client_slot )
+{
+    ClientSlot* slot = &server->client_slots[client_slot];
+    if(!slot->snapshots || packet->dataLength != sizeof(SnapshotAck))
+        return;
+
+    const SnapshotAck* ack = (const SnapshotAck*)packet->data;
+    const enet_uint32 sequence = ENET_NET_TO_HOST_32(ack->sequence);
+
+    // Acks may arrive out of order and only snapshots which are still
+    // stored can be used as baseline.
+    SnapshotRing* ring = slot->snapshots;
+    if(sequence > ring->acked_sequence &&
+       snapshot_ring_find(ring, sequence))
+        ring->acked_sequence = sequence;
+}
+
+typedef struct _MessageContext
+{
+    ENetMpServer* server;
+    int client_slot;
+    int channel;
+
+} MessageContext;
+
+static void handle_batched_message( void* context, const ENetPacket* message )
+{
+    const MessageContext* c = (const MessageContext*)context;
+    const enet_uint32 start_time = get_microseconds();
+    c->server->callbacks.client_sent_packet(c->server,
+                                            c->client_slot,
+                                            c->channel,
+                                            message);
+    end_callback(c->server, start_time);
+}
+
+static void handle_user_packet( ENetMpServer* server,
+                                int client_slot,
+                                int channel,
+                                const ENetPacket* packet )
+{
+    if(!server->batch_messages)
+    {
+        const enet_uint32 start_time = get_microseconds();
+        server->callbacks.client_sent_packet(server, client_slot, channel, packet);
+        end_callback(server, start_time);
+        return;
+    }
+
+    MessageContext context = { server, client_slot, channel };
+    if(!split_message_batch(packet, handle_batched_message, &context))
+        LOG(&server->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+            "client=%d sent malformed message batch", client_slot);
+}
+
+static void handle_receive( void* context,
+                            ENetPeer* peer,
+                            int channel,
+                            const ENetPacket* packet )
+{
+    ENetMpServer* server = (ENetMpServer*)context;
+    const int client_slot = find_client_slot_by_peer(server, peer);
+    if(client_slot < 0)
+    {
+        // E.g. the client has been disconnected while its packets were
+        // still queued.
+        LOG(&server->logger, ENET_MP_LOG_DEBUG, ENET_MP_LOG_CATEGORY_PACKET,
+            "dropping packet of peer without client slot");
+        return;
+    }
+    peer_metrics_count_received(&server->client_slots[client_slot].metrics,
+                                channel,
+                                (int)packet->dataLength);
+
+    const int user_channel_count = server->user_channel_count;
+    if(channel < user_channel_count)
+    {
+        if(!compressor_is_enabled(&server->compressor, channel))
+        {
+            handle_user_packet(server, client_slot, channel, packet);
+            return;
+        }
+
+        ENetPacket* decompressed = decompress_packet(&server->compressor,
+                                                     channel,
+                                                     packet);
+        if(!decompressed)
+        {
+            LOG(&server->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+                "client=%d sent malformed compressed packet", client_slot);
+            return;
+        }
+        handle_user_packet(server, client_slot, channel, decompressed);
+        // Callbacks may have retained the packet.
+        if(decompressed->referenceCount == 0)
+            enet_packet_destroy(decompressed);
+    }
+    else
+    {
+        const InternalChannel internal_channel =
+            (InternalChannel)(channel-user_channel_count);
+
+        switch(internal_channel)
+        {
+            case MESSAGE_CHANNEL:
+                handle_internal_message(server, packet, client_slot);
+                break;
+
+            case SNAPSHOT_CHANNEL:
+                handle_snapshot_ack(server, packet, client_slot);
+                break;
+
+            case VARIABLE_CHANNEL:
+                LOG(&server->logger, ENET_MP_LOG_WARNING, ENET_MP_LOG_CATEGORY_PROTOCOL,
+                    "client=%d sent variables, which only the server may do",
+                    client_slot);
+                break;
+
+            default:
+                assert(!"Unknown internal channel!");
+        }
+    }
+}
+
+typedef struct _ScheduleContext
+{
+    ENetMpServer* server;
+    ClientSlot* slot;
+
+} ScheduleContext;
+
+// Scheduled packets may be queued for several clients, so the scheduler
+// keeps its reference until here.  Threaded sends use a copy, since the
+// reference count of the original belongs to the game thread.
+static int send_scheduled_packet( void* context,
+                                  enet_uint8 channel,
+                                  ENetPacket* packet )
+{
+    const ScheduleContext* schedule = (const ScheduleContext*)context;
+    ENetMpServer* server = schedule->server;
+    ClientSlot* slot = schedule->slot;
+
+    ENetPacket* sent_packet = encode_packet(server, channel, packet);
+    if(sent_packet == packet && slot->shard->network_thread)
+        sent_packet = packet_pool_create_packet(server->packet_pool,
+                                                packet->data,
+                                                (int)packet->dataLength,
+                                                packet->flags & ~ENET_PACKET_FLAG_NO_ALLOCATE);
+    const int size = (int)sent_packet->dataLength;
+    send_to_client(slot, channel, sent_packet);
+    return size;
+}
+
+// Lossy links get a smaller budget.  The statistics of the peer belong to
+// the network thread in threaded mode, so the last sample is used there.
+static int get_client_send_rate( const ENetMpServer* server, const ClientSlot* slot )
+{
+    const int rate = server->client_send_rate;
+    if(rate == 0)
+        return rate;
+
+    const double loss = server->threaded ?
+        (double)slot->metrics.connection.packet_loss :
+        (double)slot->peer->packetLoss / ENET_PEER_PACKET_LOSS_SCALE;
+    int scaled_rate = (int)((double)rate * (1.0 - loss));
+    if(scaled_rate < rate / 4)
+        scaled_rate = rate / 4;
+    return scaled_rate > 0 ? scaled_rate : 1;
+}
+
+static void send_scheduled_packets( ENetMpServer* server, enet_uint32 time )
+{
+    Bitset* scheduling_slots = &server->scheduling_client_slots;
+    int i = bitset_find_first_set(scheduling_slots, 0);
+    for(; i >= 0; i = bitset_find_first_set(scheduling_slots, i+1))
+    {
+        ClientSlot* slot = &server->client_slots[i];
+        ScheduleContext context = { server, slot };
+        send_scheduler_run(slot->scheduler,
+                           get_client_send_rate(server, slot),
+                           time,
+                           send_scheduled_packet,
+                           &context);
+        if(send_scheduler_is_empty(slot->scheduler))
+            bitset_clear(scheduling_slots, i);
+    }
+}
+
+// The statistics of the peers belong to the network thread in threaded mode,
+// which sends them with its events instead.
+static void sample_peer_metrics( ENetMpServer* server )
+{
+    if(server->threaded)
+        return;
+
+    int i = 0;
+    for(; i < server->client_slot_count; i++)
+    {
+        ClientSlot* slot = &server->client_slots[i];
+        if(is_client_connected(slot) &&
+           is_peer_current(slot->peer, slot->connect_id))
+            peer_metrics_sample(&slot->metrics, slot->peer);
+    }
+}
+
+// Decisions for clients which are gone or have been replaced are dropped.
+static void apply_auth_decisions( ENetMpServer* server )
+{
+    if(!server->deferred_auth)
+        return;
+
+    if(server->auth_batch_open)
+    {
+        server->auth_batch_open = false;
+        if(server->callbacks.client_auth_batch_complete)
+        {
+            const enet_uint32 start_time = get_microseconds();
+            server->callbacks.client_auth_batch_complete(server);
+            end_callback(server, start_time);
+        }
+    }
+
+    int count;
+    const AuthDecision* decisions = auth_queue_take(&server->auth_decisions, &count);
+    int i = 0;
+    for(; i < count; i++)
+    {
+        const AuthDecision* decision = &decisions[i];
+        ClientSlot* slot = &server->client_slots[decision->client_slot];
+        if(slot->state != CLIENT_SLOT_UNAUTHENTICATED ||
+           !slot->auth_requested ||
+           slot->disconnecting ||
+           slot->connect_id != decision->ticket)
+            continue;
+
+        if(decision->accepted)
+            activate_client(server, slot);
+        else
+            disconnect_client_later(server, slot, decision->reason);
+    }
+}
+
+// Work which follows the event handling of each service call.
+static void finish_service( ENetMpServer* server )
+{
+    apply_auth_decisions(server);
+    const enet_uint32 time = enet_time_get();
+    timer_wheel_advance(&server->timers, time);
+    send_variable_changes(server);
+    send_scheduled_packets(server, time);
+    enet_mp_server_flush_messages(server);
+    sample_peer_metrics(server);
+}
+
+static void dispatch_queued_event( ENetMpServer* server, NetworkEvent* event )
+{
+    server->event_connect_id = event->connect_id;
+    server->event_address = event->address;
+    server->event_queued = true;
+    dispatch_event(&event->enet_event,
+                   &server->logger,
+                   server,
+                   handle_connect,
+                   handle_disconnect,
+                   handle_receive);
+    server->event_queued = false;
+}
+
+// Pending events are older than anything ENet or the network threads still
+// hold, so they are dispatched first.
+static int dispatch_pending_events( ENetMpServer* server )
+{
+    const int event_count = server->pending_event_count;
+    int i = 0;
+    for(; i < event_count; i++)
+        dispatch_queued_event(server, &server->pending_events[i]);
+    server->pending_event_count = 0;
+    return event_count;
+}
+
+static bool can_queue_event( const ENetMpServer* server )
+{
+    return server->pending_event_count < server->max_pending_event_count;
+}
+
+static void queue_event( ENetMpServer* server, const NetworkEvent* event )
+{
+    assert(can_queue_event(server));
+    if(server->pending_event_count == server->pending_event_capacity)
+    {
+        server->pending_event_capacity =
+            server->pending_event_capacity > 0 ? server->pending_event_capacity*2 : 64;
+        server->pending_events =
+            (NetworkEvent*)realloc(server->pending_events,
+                                   server->pending_event_capacity * sizeof(NetworkEvent));
+    }
+    server->pending_events[server->pending_event_count++] = *event;
+}
+
+void enet_mp_server_service( ENetMpServer* server, int timeout )
+{
+    assert(!server->threaded);
+    const enet_uint32 start_time = get_microseconds();
+    dispatch_pending_events(server);
+    host_service(server->shards[0].host,
+                 timeout,
+                 &server->logger,
+                 server,
+                 handle_connect,
+                 handle_disconnect,
+                 handle_receive);
+    finish_service(server);
+    histogram_record(&server->metrics.service_duration,
+                     get_microseconds() - start_time);
+}
+
+int enet_mp_server_service_all( ENetMpServer* server,
+                                int timeout,
+                                int max_events,
+                                int time_budget )
+{
+    assert(!server->threaded);
+    const enet_uint32 start_time = get_microseconds();
+    int event_count = dispatch_pending_events(server);
+    event_count += host_service_all(server->shards[0].host,
+                                    timeout,
+                                    max_events,
+                                    time_budget,
+                                    &server->logger,
+                                    server,
+                                    handle_connect,
+                                    handle_disconnect,
+                                    handle_receive);
+    finish_service(server);
+    enet_host_flush(server->shards[0].host);
+    histogram_record(&server->metrics.service_duration,
+                     get_microseconds() - start_time);
+    return event_count;
+}
+
+// Statistics of peers which have been replaced or aren't clients are dropped.
+static void handle_peer_statistics( const NetworkEvent* event )
+{
+    ClientSlot* slot = (ClientSlot*)event->enet_event.peer->data;
+    if(slot &&
+       slot->peer == event->enet_event.peer &&
+       slot->connect_id == event->connect_id &&
+       is_client_connected(slot))
+        peer_metrics_apply(&slot->metrics, &event->statistics);
+}
+
+// Bounded, so a flood of events can't keep the game thread in here.  If
+// deferred, ENet events are queued for the next tick instead of being
+// dispatched.  Queries and statistics don't reach the application, so they
+// are handled right away.
+static int poll_shard( ENetMpServer* server, Shard* shard, bool deferred )
+{
+    int event_count = 0;
+    NetworkEvent event;
+    while(event_count < NETWORK_QUEUE_SIZE &&
+          (!deferred || can_queue_event(server)) &&
+          network_thread_pop_event(shard->network_thread, &event))
+    {
+        if(event.type == NETWORK_EVENT_QUERY)
+            handle_connectionless_query(server, shard, &event.address);
+        else if(event.type == NETWORK_EVENT_PEER_STATISTICS)
+            handle_peer_statistics(&event);
+        else if(deferred)
+            queue_event(server, &event);
+        else
+            dispatch_queued_event(server, &event);
+        event_count++;
+    }
+    return event_count;
+}
+
+static int poll_shards( ENetMpServer* server, bool deferred )
+{
+    int event_count = 0;
+    int i = 0;
+    for(; i < server->shard_count; i++)
+        event_count += poll_shard(server, &server->shards[i], deferred);
+    return event_count;
+}
+
+int enet_mp_server_poll( ENetMpServer* server )
+{
+    if(!server->threaded)
+        return enet_mp_server_service_all(server, 0, 0, 0);
+
+    const enet_uint32 start_time = get_microseconds();
+    int event_count = dispatch_pending_events(server);
+    event_count += poll_shards(server, false);
+    finish_service(server);
+    histogram_record(&server->metrics.service_duration,
+                     get_microseconds() - start_time);
+    return event_count;
+}
+
+// Microsecond timestamps wrap around after about 71 minutes, so they are
+// compared by their difference.
+static int get_microseconds_until( enet_uint32 deadline, enet_uint32 time )
+{
+    if(deadline - time < 0x80000000u)
+        return (int)(deadline - time);
+    else
+        return -(int)(time - deadline);
+}
+
+// Lets ENet acknowledge, resend and ping until the next resend or ping is
+// due, but queues its events, so the callbacks only run in the tick.
+static void service_host_until( ENetMpServer* server, int timeout )
+{
+    ENetHost* host = server->shards[0].host;
+    set_service_context(server);
+    ENetEvent event;
+    int event_occured = enet_host_service(host, &event, timeout);
+    assert(event_occured >= 0);
+    while(event_occured > 0)
+    {
+        NetworkEvent queued;
+        memset(&queued, 0, sizeof(queued));
+        queued.type = NETWORK_EVENT_ENET;
+        queued.enet_event = event;
+        queued.connect_id = event.peer->connectID;
+        queued.address = event.peer->address;
+        queue_event(server, &queued);
+        if(!can_queue_event(server))
+            break;
+        event_occured = enet_host_check_events(host, &event);
+        assert(event_occured >= 0);
+    }
+    set_service_context(NULL);
+}
+
+// Only the callbacks and the flush are aligned to ticks; the protocol keeps
+// running in between.  Timeouts are rounded up, so a tick may start up to a
+// millisecond late instead of spinning before it.  Once the pending events
+// are full, the rest waits in ENet or the network threads.
+static void wait_for_tick( ENetMpServer* server, int remaining_time )
+{
+    int timeout = (remaining_time + 999) / 1000;
+    if(server->threaded)
+    {
+        // Keeps the event queues of the network threads from filling up, so
+        // they don't stall at low tick rates.
+        poll_shards(server, true);
+        thread_sleep(timeout < MAX_RUN_POLL_INTERVAL ? timeout : MAX_RUN_POLL_INTERVAL);
+    }
+    else if(can_queue_event(server))
+    {
+        timeout = get_host_timeout(server->shards[0].host, timeout);
+        // Packets which ENet couldn't send yet, e.g. due to a full window,
+        // must not make this spin.
+        service_host_until(server, timeout > 0 ? timeout : 1);
+    }
+    else
+    {
+        thread_sleep(timeout);
+    }
+}
+
+static void run_tick( ENetMpServer* server, unsigned long long tick )
+{
+    // Events which arrived since the last tick belong to this one.
+    dispatch_pending_events(server);
+    if(server->threaded)
+        poll_shards(server, false);
+    else
+        host_service_all(server->shards[0].host,
+                         0,
+                         0,
+                         0,
+                         &server->logger,
+                         server,
+                         handle_connect,
+                         handle_disconnect,
+                         handle_receive);
+
+    const enet_uint32 start_time = get_microseconds();
+    server->callbacks.tick(server, tick);
+    end_callback(server, start_time);
+
+    finish_service(server);
+    if(!server->threaded)
+        enet_host_flush(server->shards[0].host);
+}
+
+void enet_mp_server_run( ENetMpServer* server )
+{
+    assert(server->tick_interval > 0);
+    assert(server->callbacks.tick);
+
+    ENetMpServerMetrics* metrics = &server->metrics;
+    const enet_uint32 interval = server->tick_interval;
+    enet_uint32 deadline = get_microseconds();
+    unsigned long long tick = 0;
+    while(!atomic_load_explicit(&server->stop_requested, memory_order_acquire))
+    {
+        const int remaining_time = get_microseconds_until(deadline, get_microseconds());
+        if(remaining_time > 0)
+        {
+            wait_for_tick(server, remaining_time);
+            continue;
+        }
+
+        histogram_record(&metrics->tick_lateness, (enet_uint32)-remaining_time);
+        const enet_uint32 start_time = get_microseconds();
+        run_tick(server, tick);
+        const enet_uint32 end_time = get_microseconds();
+        histogram_record(&metrics->tick_duration, end_time - start_time);
+        metrics->ticks++;
+
+        deadline += interval;
+        tick++;
+        const int lag = -get_microseconds_until(deadline, end_time);
+        if(lag >= 0)
+        {
+            // Running the missed ticks back to back would only make the
+            // following ones late as well.
+            metrics->tick_overruns++;
+            const enet_uint32 skipped = (enet_uint32)lag / interval;
+            deadline += skipped * interval;
+            tick += skipped;
+            metrics->skipped_ticks += skipped;
+        }
+    }
+    atomic_store_explicit(&server->stop_requested, false, memory_order_relaxed);
+}
+
+void enet_mp_server_stop( ENetMpServer* server )
+{
+    atomic_store_explicit(&server->stop_requested, true, memory_order_release);
+}
+
+ENetSocket enet_mp_server_get_socket( ENetMpServer* server )
+{
+    assert(!server->threaded);
+    return server->shards[0].host->socket;
+}
+
+static int get_scheduler_timeout( const ENetMpServer* server,
+                                  int timeout,
+                                  enet_uint32 time )
+{
+    const Bitset* scheduling_slots = &server->scheduling_client_slots;
+    int i = bitset_find_first_set(scheduling_slots, 0);
+    for(; i >= 0 && timeout > 0; i = bitset_find_first_set(scheduling_slots, i+1))
+    {
+        const ClientSlot* slot = &server->client_slots[i];
+        const int delay = send_scheduler_get_delay(slot->scheduler,
+                                                   get_client_send_rate(server, slot),
+                                                   time);
+        if(delay < timeout)
+            timeout = delay;
+    }
+    return timeout;
+}
+
+int enet_mp_server_get_timeout( ENetMpServer* server )
+{
+    assert(!server->threaded);
+    if(server->auth_batch_open ||
+       variable_registry_has_changes(&server->variables) ||
+       bitset_find_first_set(&server->batching_client_slots, 0) >= 0)
+        return 0;
+
+    const enet_uint32 time = enet_time_get();
+    int timeout = get_host_timeout(server->shards[0].host, INT_MAX);
+    enet_uint32 deadline;
+    if(timer_wheel_get_next_deadline(&server->timers, &deadline))
+        timeout = limit_timeout(timeout, deadline, time);
+    return get_scheduler_timeout(server, timeout, time);
+}
+
+int enet_mp_server_process_readable( ENetMpServer* server )
+{
+    assert(!server->threaded);
+    const enet_uint32 start_time = get_microseconds();
+    const int event_count = host_process(server->shards[0].host,
+                                         &server->logger,
+                                         server,
+                                         handle_connect,
+                                         handle_disconnect,
+                                         handle_receive);
+    finish_service(server);
+    enet_host_flush(server->shards[0].host);
+    histogram_record(&server->metrics.service_duration,
+                     get_microseconds() - start_time);
+    return event_count;
+}
+
+void enet_mp_server_handle_timers( ENetMpServer* server )
+{
+    // A service without timeout is the only way to make ENet check its
+    // timeouts.  It may read datagrams as well, which does no harm.
+    enet_mp_server_service_all(server, 0, 0, 0);
+}
+
+void* enet_mp_server_get_user_data( ENetMpServer* server )
+{
+    return server->user_data;
+}
+
+ENetHost* enet_mp_server_get_host( ENetMpServer* server )
+{
+    return server->shards[0].host;
+}
+
+int enet_mp_server_get_shard_count( ENetMpServer* server )
+{
+    return server->shard_count;
+}
+
+ENetHost* enet_mp_server_get_shard_host( ENetMpServer* server, int shard )
+{
+    assert(is_in_bounds(shard, server->shard_count));
+    return server->shards[shard].host;
+}
+
+int enet_mp_server_get_client_slot_count( ENetMpServer* server )
+{
+    return server->client_slot_count;
+}
+
+int enet_mp_server_get_used_client_slot_count( ENetMpServer* server )
+{
+    return server->client_slot_count - server->free_client_slots.set_count;
+}
+
+static ClientSlot* get_client_slot( ENetMpServer* server, int index )
 {
     assert(index >= 0);
     if(index < server->client_slot_count)
@@ -326,18 +1956,400 @@ static ClientSlot* get_client_slot( ENetMpServer* server, int index )
 ENetPeer* enet_mp_server_get_client_peer( ENetMpServer* server,
                                           int client_slot )
 {
+    assert(!server->threaded);
     const ClientSlot* slot = get_client_slot(server, client_slot);
-    if(slot)
+    if(slot && is_client_connected(slot))
         return slot->peer;
     else
         return NULL;
 }
 
+void enet_mp_server_set_information( ENetMpServer* server,
+                                     const void* data,
+                                     int size )
+{
+    assert(size >= 0);
+    free(server->information);
+    server->information = NULL;
+    server->information_size = 0;
+    if(size > 0)
+    {
+        server->information = (char*)malloc(size);
+        memcpy(server->information, data, size);
+        server->information_size = size;
+    }
+    discard_information_packets(server);
+}
+
 void enet_mp_server_disconnect_client( ENetMpServer* server,
                                        int client_slot,
                                        ENetMpDisconnectReason reason )
 {
+    assert(is_in_bounds((int)reason, ENET_MP_DISCONNECT_REASON_COUNT));
     ClientSlot* slot = get_client_slot(server, client_slot);
     if(slot)
         disconnect_client_now(server, slot, reason);
 }
+
+enet_uint32 enet_mp_server_get_auth_ticket( ENetMpServer* server,
+                                            int client_slot )
+{
+    const ClientSlot* slot = get_client_slot(server, client_slot);
+    assert(slot);
+    return slot->connect_id;
+}
+
+static void push_auth_decision( ENetMpServer* server,
+                                int client_slot,
+                                enet_uint32 ticket,
+                                bool accepted,
+                                ENetMpDisconnectReason reason )
+{
+    assert(server->deferred_auth);
+    assert(is_in_bounds(client_slot, server->client_slot_count));
+    AuthDecision decision;
+    decision.client_slot = client_slot;
+    decision.ticket = ticket;
+    decision.accepted = accepted;
+    decision.reason = reason;
+    auth_queue_push(&server->auth_decisions, &decision);
+}
+
+void enet_mp_server_accept_client( ENetMpServer* server,
+                                   int client_slot,
+                                   enet_uint32 ticket )
+{
+    push_auth_decision(server, client_slot, ticket, true, ENET_MP_DISCONNECT_UNKNOWN);
+}
+
+void enet_mp_server_reject_client( ENetMpServer* server,
+                                   int client_slot,
+                                   enet_uint32 ticket,
+                                   ENetMpDisconnectReason reason )
+{
+    assert(is_in_bounds((int)reason, ENET_MP_DISCONNECT_REASON_COUNT));
+    push_auth_decision(server, client_slot, ticket, false, reason);
+}
+
+void enet_mp_server_broadcast( ENetMpServer* server,
+                               int channel,
+                               ENetPacket* packet )
+{
+    enet_mp_server_broadcast_filtered(server, channel, packet, NULL, NULL);
+}
+
+void enet_mp_server_broadcast_filtered( ENetMpServer* server,
+                                        int channel,
+                                        ENetPacket* packet,
+                                        ENetMpClientFilter filter,
+                                        void* user_data )
+{
+    assert(is_in_bounds(channel, server->user_channel_count));
+    packet = prepare_packet(server, (enet_uint8)channel, packet);
+    broadcast_packet(server, (enet_uint8)channel, packet, filter, user_data);
+}
+
+ENetPacket* enet_mp_server_acquire_packet( ENetMpServer* server,
+                                           int size,
+                                           enet_uint32 flags )
+{
+    return packet_pool_acquire(server->packet_pool, size, flags);
+}
+
+int enet_mp_server_send( ENetMpServer* server,
+                         int client_slot,
+                         int channel,
+                         ENetPacket* packet )
+{
+    assert(is_in_bounds(channel, server->user_channel_count));
+    ClientSlot* slot = get_client_slot(server, client_slot);
+    if(!slot || !is_client_connected(slot))
+        return -1;
+
+    // The packet stays with the caller if the send fails, so the original
+    // is only given up once its encoded copy has been sent.
+    ENetPacket* sent_packet = encode_packet(server, (enet_uint8)channel, packet);
+    const int size = (int)sent_packet->dataLength;
+    const int result = send_to_peer(slot->shard, slot->peer, slot->connect_id, (enet_uint8)channel, sent_packet);
+    if(result == 0)
+        peer_metrics_count_sent(&slot->metrics, channel, size);
+
+    ENetPacket* unused_packet = result == 0 ? packet : sent_packet;
+    if(sent_packet != packet && unused_packet->referenceCount == 0)
+        enet_packet_destroy(unused_packet);
+    return result;
+}
+
+static void send_batch( void* context,
+                        MessageBatcher* batcher,
+                        enet_uint8 channel,
+                        ENetPacket* packet )
+{
+    ENetMpServer* server = (ENetMpServer*)context;
+    ClientSlot* slot = CONTAINER_OF(batcher, ClientSlot, batcher);
+    // Batches are framed already.
+    if(compressor_is_enabled(&server->compressor, channel))
+    {
+        ENetPacket* compressed = compress_packet(&server->compressor, channel, packet);
+        enet_packet_destroy(packet);
+        packet = compressed;
+    }
+    send_to_client(slot, channel, packet);
+}
+
+void enet_mp_server_queue_message( ENetMpServer* server,
+                                   int client_slot,
+                                   int channel,
+                                   const void* data,
+                                   int size,
+                                   enet_uint32 flags )
+{
+    assert(is_in_bounds(channel, server->user_channel_count));
+    ClientSlot* slot = get_client_slot(server, client_slot);
+    if(!slot || !is_client_connected(slot))
+        return;
+
+    if(!server->batch_messages)
+    {
+        ENetPacket* packet = packet_pool_create_packet(server->packet_pool,
+                                                       data,
+                                                       size,
+                                                       flags);
+        packet = prepare_packet(server, (enet_uint8)channel, packet);
+        send_to_client(slot, (enet_uint8)channel, packet);
+        return;
+    }
+
+    if(!slot->batcher.batches)
+        message_batcher_init(&slot->batcher,
+                             server->user_channel_count,
+                             get_message_batch_capacity(slot->peer),
+                             server->packet_pool,
+                             send_batch,
+                             server);
+    message_batcher_add(&slot->batcher,
+                        (enet_uint8)channel,
+                        data,
+                        size,
+                        flags);
+    if(message_batcher_has_pending(&slot->batcher))
+        bitset_set(&server->batching_client_slots, client_slot);
+}
+
+void enet_mp_server_flush_messages( ENetMpServer* server )
+{
+    Bitset* batching_slots = &server->batching_client_slots;
+    int i = bitset_find_first_set(batching_slots, 0);
+    for(; i >= 0; i = bitset_find_first_set(batching_slots, i+1))
+    {
+        ClientSlot* slot = &server->client_slots[i];
+        message_batcher_flush(&slot->batcher);
+    }
+    bitset_clear_all(batching_slots);
+}
+
+int enet_mp_server_register_variable( ENetMpServer* server,
+                                      ENetMpVariableType type,
+                                      int size )
+{
+    return variable_registry_add(&server->variables, type, size);
+}
+
+void enet_mp_server_set_variable( ENetMpServer* server,
+                                  int variable,
+                                  const void* value )
+{
+    variable_registry_set(&server->variables, variable, value);
+}
+
+const void* enet_mp_server_get_variable( ENetMpServer* server,
+                                         int variable )
+{
+    return variable_registry_get(&server->variables, variable);
+}
+
+int enet_mp_server_send_snapshot( ENetMpServer* server,
+                                  int client_slot,
+                                  const void* data,
+                                  int size )
+{
+    assert(size >= 0 && size <= MAX_SNAPSHOT_SIZE);
+    ClientSlot* slot = get_client_slot(server, client_slot);
+    if(!slot || slot->state != CLIENT_SLOT_ACTIVE)
+        return -1;
+
+    if(!slot->snapshots)
+    {
+        slot->snapshots = (SnapshotRing*)malloc(sizeof(SnapshotRing));
+        snapshot_ring_init(slot->snapshots);
+    }
+    SnapshotRing* ring = slot->snapshots;
+    const enet_uint32 sequence = ring->last_sequence + 1;
+
+    // The baseline must not share its ring entry with the new snapshot,
+    // as the client would overwrite the baseline while decoding.
+    const Snapshot* baseline = snapshot_ring_find(ring, ring->acked_sequence);
+    if(baseline && sequence - baseline->sequence >= SNAPSHOT_RING_SIZE)
+        baseline = NULL;
+
+    ENetPacket* packet =
+        packet_pool_acquire(server->packet_pool,
+                            sizeof(SnapshotHeader) + get_max_snapshot_delta_size(size),
+                            ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT);
+
+    SnapshotHeader* header = (SnapshotHeader*)packet->data;
+    header->sequence = ENET_HOST_TO_NET_32(sequence);
+    header->baseline_sequence = ENET_HOST_TO_NET_32(baseline ? baseline->sequence : 0);
+    header->size = ENET_HOST_TO_NET_32((enet_uint32)size);
+
+    const int delta_size =
+        encode_snapshot_delta(baseline ? baseline->data : NULL,
+                              baseline ? baseline->size : 0,
+                              (const char*)data,
+                              size,
+                              (char*)&packet->data[sizeof(SnapshotHeader)]);
+    enet_packet_resize(packet, sizeof(SnapshotHeader) + delta_size);
+
+    snapshot_ring_store(ring, sequence, (const char*)data, size);
+
+    const enet_uint8 channel = get_internal_channel(SNAPSHOT_CHANNEL,
+                                                    server->user_channel_count);
+    send_to_client(slot, channel, prepare_packet(server, channel, packet));
+    return (int)sequence;
+}
+
+void enet_mp_server_get_compression_statistics( ENetMpServer* server,
+                                                int channel,
+                                                ENetMpCompressionStatistics* statistics )
+{
+    if(channel == ENET_MP_SNAPSHOT_CHANNEL)
+        channel = get_internal_channel(SNAPSHOT_CHANNEL, server->user_channel_count);
+    else
+        assert(is_in_bounds(channel, server->user_channel_count));
+    compressor_get_statistics(&server->compressor, channel, statistics);
+}
+
+void enet_mp_server_set_entity_position( ENetMpServer* server,
+                                         int entity,
+                                         float x,
+                                         float y )
+{
+    interest_grid_set_entity(&server->interest, entity, x, y);
+}
+
+void enet_mp_server_remove_entity( ENetMpServer* server, int entity )
+{
+    interest_grid_remove_entity(&server->interest, entity);
+}
+
+void enet_mp_server_set_client_view( ENetMpServer* server,
+                                     int client_slot,
+                                     float x,
+                                     float y,
+                                     float radius )
+{
+    if(get_client_slot(server, client_slot))
+        interest_grid_set_view(&server->interest, client_slot, x, y, radius);
+}
+
+static int compare_client_slots( const void* a, const void* b )
+{
+    return *(const int*)a - *(const int*)b;
+}
+
+void enet_mp_server_send_entity_update( ENetMpServer* server,
+                                        int entity,
+                                        int channel,
+                                        ENetPacket* packet )
+{
+    assert(is_in_bounds(channel, server->user_channel_count));
+
+    packet = prepare_packet(server, (enet_uint8)channel, packet);
+
+    int subscriber_count;
+    const int* subscribers = interest_grid_get_subscribers(&server->interest,
+                                                           entity,
+                                                           &subscriber_count);
+
+    // Sorted, so they are sent to in slot order like broadcasts.  Only the
+    // subscribers are visited, not all client slots.
+    int* recipients = server->interest_recipients;
+    int recipient_count = 0;
+    int i = 0;
+    for(; i < subscriber_count; i++)
+        if(bitset_test(&server->active_client_slots, subscribers[i]))
+            recipients[recipient_count++] = subscribers[i];
+    qsort(recipients, recipient_count, sizeof(int), compare_client_slots);
+
+    Broadcast broadcast;
+    begin_broadcast(&broadcast, server, (enet_uint8)channel, packet);
+    for(i = 0; i < recipient_count; i++)
+        broadcast_to_client(&broadcast, recipients[i]);
+    end_broadcast(&broadcast);
+}
+
+void enet_mp_server_schedule_packet( ENetMpServer* server,
+                                     int client_slot,
+                                     int channel,
+                                     ENetPacket* packet,
+                                     int priority )
+{
+    assert(is_in_bounds(channel, server->user_channel_count));
+    ClientSlot* slot = get_client_slot(server, client_slot);
+    if(!slot || !is_client_connected(slot))
+    {
+        if(packet->referenceCount == 0)
+            enet_packet_destroy(packet);
+        return;
+    }
+
+    // Compressed when it's sent, so other clients can share the packet.
+    const enet_uint32 time = enet_time_get();
+    if(!slot->scheduler)
+    {
+        slot->scheduler = (SendScheduler*)malloc(sizeof(SendScheduler));
+        send_scheduler_init(slot->scheduler, time);
+    }
+    send_scheduler_push(slot->scheduler,
+                        (enet_uint8)channel,
+                        packet,
+                        priority,
+                        server->schedule_age_boost,
+                        time);
+    bitset_set(&server->scheduling_client_slots, client_slot);
+}
+
+void enet_mp_server_get_metrics( ENetMpServer* server,
+                                 ENetMpServerMetrics* metrics )
+{
+    *metrics = server->metrics;
+}
+
+void enet_mp_server_reset_metrics( ENetMpServer* server )
+{
+    memset(&server->metrics, 0, sizeof(ENetMpServerMetrics));
+}
+
+int enet_mp_server_get_client_metrics( ENetMpServer* server,
+                                       int client_slot,
+                                       ENetMpConnectionMetrics* metrics )
+{
+    const ClientSlot* slot = get_client_slot(server, client_slot);
+    if(!slot)
+        return -1;
+    *metrics = slot->metrics.connection;
+    return 0;
+}
+
+int enet_mp_server_get_client_channel_metrics( ENetMpServer* server,
+                                               int client_slot,
+                                               int channel,
+                                               ENetMpChannelMetrics* metrics )
+{
+    assert(is_in_bounds(channel, server->user_channel_count));
+    const ClientSlot* slot = get_client_slot(server, client_slot);
+    if(!slot)
+        return -1;
+    *metrics = slot->metrics.channels[channel];
+    return 0;
+}
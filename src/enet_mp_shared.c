@@ -1,9 +1,25 @@
+#if defined(_WIN32)
+#define _CRT_RAND_S
+#include <stdlib.h> // rand_s
+#endif
 #include <assert.h>
+#include <stdarg.h>
+#include <stdio.h> // vsnprintf, fopen
 #include <string.h> // strlen, strncpy
 #include "enet_mp.h"
 #include "enet_mp_shared.h"
+#include "enet_mp_batch.h"
 
 
+const enet_uint8 QUERY_REQUEST_MAGIC[QUERY_MAGIC_SIZE] =
+    { 0xFF, 0xFF, 'E', 'N', 'M', 'P', 'Q', '?' };
+const enet_uint8 QUERY_REPLY_MAGIC[QUERY_MAGIC_SIZE] =
+    { 0xFF, 0xFF, 'E', 'N', 'M', 'P', 'Q', '!' };
+const enet_uint8 WAKEUP_MAGIC[QUERY_MAGIC_SIZE] =
+    { 0xFF, 0xFF, 'E', 'N', 'M', 'P', 'W', '!' };
+
+static THREAD_LOCAL void* service_context = NULL;
+
 bool copy_string( const char* source, char* destination, int destination_size )
 {
     assert(source && destination && destination_size > 0);
@@ -25,6 +41,35 @@ bool is_in_bounds( int index, int array_size )
            index < array_size;
 }
 
+int write_varint( enet_uint32 value, char* destination )
+{
+    int size = 0;
+    while(value >= 0x80)
+    {
+        destination[size++] = (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    destination[size++] = (char)value;
+    return size;
+}
+
+int read_varint( const char* source, int size, enet_uint32* value )
+{
+    enet_uint32 result = 0;
+    int i = 0;
+    for(; i < size && i < MAX_VARINT_SIZE; i++)
+    {
+        const enet_uint8 byte = (enet_uint8)source[i];
+        result |= (enet_uint32)(byte & 0x7F) << (7*i);
+        if(!(byte & 0x80))
+        {
+            *value = result;
+            return i+1;
+        }
+    }
+    return 0;
+}
+
 const char* disconnect_reason_as_string( ENetMpDisconnectReason reason )
 {
     switch(reason)
@@ -35,52 +80,280 @@ const char* disconnect_reason_as_string( ENetMpDisconnectReason reason )
         case ENET_MP_DISCONNECT_SERVER_SHUTDOWN: return "server shutdown";
         case ENET_MP_DISCONNECT_SERVER_FULL: return "server is full";
         case ENET_MP_DISCONNECT_REPLY_TIMEOUT: return "reply timeout";
-        default: assert(!"Unknown reason!");
+        case ENET_MP_DISCONNECT_RATE_LIMITED: return "rate limited";
+        case ENET_MP_DISCONNECT_SESSION_EXPIRED: return "session expired";
+        default: return "invalid"; // Sent by a peer or passed by the application.
+    }
+}
+
+bool get_random_bytes( void* destination, int size )
+{
+    assert(size >= 0);
+#if defined(_WIN32)
+    enet_uint8* bytes = (enet_uint8*)destination;
+    int i = 0;
+    for(; i < size; i++)
+    {
+        unsigned int value;
+        if(rand_s(&value) != 0)
+            return false;
+        bytes[i] = (enet_uint8)value;
+    }
+    return true;
+#else
+    FILE* file = fopen("/dev/urandom", "rb");
+    if(!file)
+        return false;
+    const bool success = fread(destination, 1, size, file) == (size_t)size;
+    fclose(file);
+    return success;
+#endif
+}
+
+void logger_init( Logger* logger, const ENetMpLogConfiguration* config )
+{
+    logger->sink = config->sink;
+    logger->user_data = config->user_data;
+    logger->level = config->sink ? config->level : ENET_MP_LOG_OFF;
+    logger->categories = config->categories ? config->categories
+                                            : ENET_MP_LOG_CATEGORY_ALL;
+}
+
+void log_message( const Logger* logger,
+                  ENetMpLogLevel level,
+                  ENetMpLogCategory category,
+                  const char* format,
+                  ... )
+{
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    logger->sink(logger->user_data, level, category, message);
+}
+
+void* get_service_context( void )
+{
+    return service_context;
+}
+
+void set_service_context( void* context )
+{
+    service_context = context;
+}
+
+void dispatch_event( ENetEvent* event,
+                     const Logger* logger,
+                     void* context,
+                     ConnectHandler connect_handler,
+                     DisconnectHandler disconnect_handler,
+                     ReceiveHandler receive_handler )
+{
+    switch(event->type)
+    {
+        case ENET_EVENT_TYPE_CONNECT:
+            LOG(logger, ENET_MP_LOG_DEBUG, ENET_MP_LOG_CATEGORY_CONNECTION,
+                "connect: peer=%u", (unsigned int)event->peer->incomingPeerID);
+            connect_handler(context,
+                            event->peer,
+                            (ConnectionType)event->data);
+            break;
+
+        case ENET_EVENT_TYPE_DISCONNECT:
+            LOG(logger, ENET_MP_LOG_DEBUG, ENET_MP_LOG_CATEGORY_CONNECTION,
+                "disconnect: peer=%u", (unsigned int)event->peer->incomingPeerID);
+            disconnect_handler(context,
+                               event->peer,
+                               (ENetMpDisconnectReason)event->data);
+            break;
+
+        case ENET_EVENT_TYPE_RECEIVE:
+            LOG(logger, ENET_MP_LOG_TRACE, ENET_MP_LOG_CATEGORY_PACKET,
+                "receive: peer=%u channel=%d size=%u",
+                (unsigned int)event->peer->incomingPeerID,
+                (int)event->channelID,
+                (unsigned int)event->packet->dataLength);
+            receive_handler(context,
+                            event->peer,
+                            event->channelID,
+                            event->packet);
+            // Callbacks may have retained the packet.
+            if(event->packet->referenceCount == 0)
+                enet_packet_destroy(event->packet);
+            break;
+
+        default:
+            assert(!"Unknown event!");
     }
 }
 
 void host_service( ENetHost* host,
                    int timeout,
+                   const Logger* logger,
                    void* context,
                    ConnectHandler connect_handler,
                    DisconnectHandler disconnect_handler,
                    ReceiveHandler receive_handler )
 {
     ENetEvent event;
+    service_context = context;
     int event_occured = enet_host_service(host, &event, timeout);
+    service_context = NULL;
     assert(event_occured >= 0);
     if(event_occured > 0)
+        dispatch_event(&event,
+                       logger,
+                       context,
+                       connect_handler,
+                       disconnect_handler,
+                       receive_handler);
+}
+
+int host_service_all( ENetHost* host,
+                      int timeout,
+                      int max_events,
+                      int time_budget,
+                      const Logger* logger,
+                      void* context,
+                      ConnectHandler connect_handler,
+                      DisconnectHandler disconnect_handler,
+                      ReceiveHandler receive_handler )
+{
+    assert(max_events >= 0);
+    assert(time_budget >= 0);
+
+    const enet_uint32 start_time = time_budget > 0 ? enet_time_get() : 0;
+    int event_count = 0;
+
+    // enet_host_service sends queued packets and reads all datagrams which
+    // are waiting on the socket.  The remaining events can then be pulled
+    // with enet_host_check_events, which does not touch the socket again.
+    ENetEvent event;
+    service_context = context;
+    int event_occured = enet_host_service(host, &event, timeout);
+    service_context = NULL;
+    assert(event_occured >= 0);
+    while(event_occured > 0)
+    {
+        dispatch_event(&event,
+                       logger,
+                       context,
+                       connect_handler,
+                       disconnect_handler,
+                       receive_handler);
+        event_count++;
+
+        if(max_events > 0 &&
+           event_count >= max_events)
+            break;
+
+        if(time_budget > 0 &&
+           enet_time_get() - start_time >= (enet_uint32)time_budget)
+            break;
+
+        event_occured = enet_host_check_events(host, &event);
+        assert(event_occured >= 0);
+    }
+
+    return event_count;
+}
+
+int host_process( ENetHost* host,
+                  const Logger* logger,
+                  void* context,
+                  ConnectHandler connect_handler,
+                  DisconnectHandler disconnect_handler,
+                  ReceiveHandler receive_handler )
+{
+    // enet_host_service stops reading at the first event, so datagrams
+    // may be left on the socket.
+    int event_count = 0;
+    for(;;)
+    {
+        event_count += host_service_all(host,
+                                        0,
+                                        0,
+                                        0,
+                                        logger,
+                                        context,
+                                        connect_handler,
+                                        disconnect_handler,
+                                        receive_handler);
+        enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+        if(enet_socket_wait(host->socket, &condition, 0) != 0 ||
+           !(condition & ENET_SOCKET_WAIT_RECEIVE))
+            break;
+    }
+    return event_count;
+}
+
+bool is_peer_current( const ENetPeer* peer, enet_uint32 connect_id )
+{
+    return peer->connectID == connect_id &&
+           peer->state != ENET_PEER_STATE_DISCONNECTED &&
+           peer->state != ENET_PEER_STATE_ZOMBIE;
+}
+
+int limit_timeout( int timeout, enet_uint32 deadline, enet_uint32 time )
+{
+    if(!ENET_TIME_LESS(time, deadline))
+        return 0;
+    const enet_uint32 remaining = ENET_TIME_DIFFERENCE(deadline, time);
+    return remaining < (enet_uint32)timeout ? (int)remaining : timeout;
+}
+
+// ENet 1.3.14 merged the reliable and unreliable outgoing commands.
+static bool has_outgoing_commands( const ENetPeer* peer )
+{
+#if ENET_VERSION >= ENET_VERSION_CREATE(1, 3, 14)
+    return !enet_list_empty(&peer->outgoingCommands);
+#else
+    return !enet_list_empty(&peer->outgoingReliableCommands) ||
+           !enet_list_empty(&peer->outgoingUnreliableCommands);
+#endif
+}
+
+int get_host_timeout( const ENetHost* host, int max_timeout )
+{
+    if(!enet_list_empty(&host->dispatchQueue))
+        return 0;
+
+    const enet_uint32 time = enet_time_get();
+    int timeout = limit_timeout(max_timeout,
+                                host->bandwidthThrottleEpoch + ENET_HOST_BANDWIDTH_THROTTLE_INTERVAL,
+                                time);
+    size_t i = 0;
+    for(; i < host->peerCount && timeout > 0; i++)
     {
-        switch(event.type)
+        const ENetPeer* peer = &host->peers[i];
+        if(peer->state == ENET_PEER_STATE_DISCONNECTED ||
+           peer->state == ENET_PEER_STATE_ZOMBIE)
+            continue;
+
+        // Packets which were queued outside of a service call, and acks
+        // for what was received, wait for the next service.
+        if(has_outgoing_commands(peer) ||
+           !enet_list_empty(&peer->acknowledgements))
+            return 0;
+
+        // Mirrors the resend and ping conditions of ENet's service.
+        if(!enet_list_empty(&peer->sentReliableCommands))
+        {
+            const ENetOutgoingCommand* command =
+                (const ENetOutgoingCommand*)enet_list_begin(&peer->sentReliableCommands);
+            timeout = limit_timeout(timeout,
+                                    command->sentTime + command->roundTripTimeout,
+                                    time);
+        }
+        else if(peer->state == ENET_PEER_STATE_CONNECTED)
         {
-            case ENET_EVENT_TYPE_CONNECT:
-                printf("ENET_EVENT_TYPE_CONNECT\n");
-                connect_handler(context,
-                                event.peer,
-                                (ConnectionType)event.data);
-                break;
-
-            case ENET_EVENT_TYPE_DISCONNECT:
-                printf("ENET_EVENT_TYPE_DISCONNECT\n");
-                disconnect_handler(context,
-                                   event.peer,
-                                   (ENetMpDisconnectReason)event.data);
-                break;
-
-            case ENET_EVENT_TYPE_RECEIVE:
-                printf("ENET_EVENT_TYPE_RECEIVE\n");
-                receive_handler(context,
-                                event.peer,
-                                event.channelID,
-                                event.packet);
-                enet_packet_destroy(event.packet);
-                break;
-
-            default:
-                assert(!"Unknown event!");
+            timeout = limit_timeout(timeout,
+                                    peer->lastReceiveTime + peer->pingInterval,
+                                    time);
         }
     }
-    // TODO: Maybe use enet_host_check_events and enet_host_flush instead.
+    return timeout;
 }
 
 enet_uint8 get_internal_channel( InternalChannel channel, int user_channel_count )
@@ -88,34 +361,115 @@ enet_uint8 get_internal_channel( InternalChannel channel, int user_channel_count
     return (enet_uint8)(user_channel_count + (int)channel);
 }
 
-char* send_internal_message( ENetPeer* peer,
+void write_message_type( ENetMpBitWriter* writer, MessageType type )
+{
+    enet_mp_bit_writer_write_bits(writer, (enet_uint32)type, MESSAGE_TYPE_BITS);
+}
+
+MessageType read_message_type( ENetMpBitReader* reader )
+{
+    return (MessageType)enet_mp_bit_reader_read_bits(reader, MESSAGE_TYPE_BITS);
+}
+
+bool is_session_token_set( const SessionToken* token )
+{
+    return token->words[0] != 0 || token->words[1] != 0;
+}
+
+void write_session( ENetMpBitWriter* writer,
+                    int client_slot,
+                    const SessionToken* token )
+{
+    enet_mp_bit_writer_write_varint(writer, (enet_uint32)client_slot);
+    enet_mp_bit_writer_write_bits(writer, token->words[0], 32);
+    enet_mp_bit_writer_write_bits(writer, token->words[1], 32);
+}
+
+int read_session( ENetMpBitReader* reader, SessionToken* token )
+{
+    const enet_uint32 client_slot = enet_mp_bit_reader_read_varint(reader);
+    token->words[0] = enet_mp_bit_reader_read_bits(reader, 32);
+    token->words[1] = enet_mp_bit_reader_read_bits(reader, 32);
+    if(enet_mp_bit_reader_has_error(reader) || client_slot > 0x7FFFFFFF)
+        return -1;
+    return (int)client_slot;
+}
+
+void begin_internal_message( ENetMpBitWriter* writer,
+                             PacketPool* pool,
                              MessageType type,
-                             int size,
-                             int user_channel_count )
+                             int max_size )
 {
-    const int packet_size = sizeof(MessageHeader) + size;
-    ENetPacket* packet = enet_packet_create(NULL,
-                                            packet_size,
-                                            ENET_PACKET_FLAG_RELIABLE);
+    ENetPacket* packet = packet_pool_acquire(pool,
+                                             max_size,
+                                             ENET_PACKET_FLAG_RELIABLE);
+    enet_mp_bit_writer_init_packet(writer, packet);
+    write_message_type(writer, type);
+}
+
+void send_internal_message( ENetMpBitWriter* writer,
+                            ENetPeer* peer,
+                            int user_channel_count )
+{
+    const int size = enet_mp_bit_writer_finish(writer);
+    assert(size >= 0);
 
     const enet_uint8 channel = get_internal_channel(MESSAGE_CHANNEL, user_channel_count);
-    const int result = enet_peer_send(peer, channel, packet);
-    assert(result == 0);
+    if(enet_peer_send(peer, channel, writer->packet) != 0)
+        enet_packet_destroy(writer->packet); // The peer is gone.
+}
 
-    MessageHeader* header = (MessageHeader*)packet->data;
-    header->type = type;
+ENetPacket* enet_mp_packet_retain( const ENetPacket* packet )
+{
+    if(is_temporary_message(packet))
+        return retain_message(packet);
 
-    char* data = &packet->data[sizeof(MessageHeader)];
-    memset(data, 0, size);
-    return data;
+    ENetPacket* retained = (ENetPacket*)packet;
+    retained->referenceCount++;
+    return retained;
 }
 
-const char* read_internal_message( const ENetPacket* packet,
-                                   MessageType* type,
-                                   int* size )
+void enet_mp_packet_release( ENetPacket* packet )
 {
-    const MessageHeader* header = (const MessageHeader*)packet->data;
-    *type = header->type;
-    *size = packet->dataLength - sizeof(MessageHeader);
-    return &packet->data[sizeof(MessageHeader)];
+    assert(packet->referenceCount > 0);
+    packet->referenceCount--;
+    if(packet->referenceCount == 0)
+        enet_packet_destroy(packet);
+}
+
+int enet_mp_query_send( ENetSocket socket, const ENetAddress* address )
+{
+    ENetBuffer buffer;
+    buffer.data = (void*)QUERY_REQUEST_MAGIC;
+    buffer.dataLength = QUERY_MAGIC_SIZE;
+    return enet_socket_send(socket, address, &buffer, 1) > 0 ? 0 : -1;
+}
+
+int enet_mp_query_parse_reply( const void* data,
+                               int size,
+                               ENetMpServerInformation* information )
+{
+    if(size < QUERY_MAGIC_SIZE ||
+       memcmp(data, QUERY_REPLY_MAGIC, QUERY_MAGIC_SIZE) != 0)
+        return -1;
+
+    ENetMpBitReader reader;
+    enet_mp_bit_reader_init(&reader,
+                            &((const char*)data)[QUERY_MAGIC_SIZE],
+                            size - QUERY_MAGIC_SIZE);
+    if(read_message_type(&reader) != SERVER_INFORMATION_MESSAGE)
+        return -1;
+
+    information->free_client_slots = (int)enet_mp_bit_reader_read_varint(&reader);
+    information->used_client_slots = (int)enet_mp_bit_reader_read_varint(&reader);
+    const enet_uint32 user_data_size = enet_mp_bit_reader_read_varint(&reader);
+    if(user_data_size > (enet_uint32)size)
+        return -1;
+    information->user_data_size = (int)user_data_size;
+    information->user_data = enet_mp_bit_reader_read_bytes(&reader, (int)user_data_size);
+    if(enet_mp_bit_reader_has_error(&reader))
+        return -1;
+    if(user_data_size == 0)
+        information->user_data = NULL;
+    return 0;
 }
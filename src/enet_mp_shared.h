@@ -1,12 +1,41 @@
 #ifndef __ENET_MP_SHARED_H__
 #define __ENET_MP_SHARED_H__
 
-#include <stdio.h> // DEBGUG
 #include <stdbool.h>
+#include "enet_mp_pool.h"
 
 
 #define UNIMPLEMENTED() assert(!"UNIMPLEMENTED!")
 
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+// A 32 bit varint takes at most 5 bytes.
+#define MAX_VARINT_SIZE 5
+
+// Log messages above this level are compiled out.
+#if !defined(ENET_MP_MAX_LOG_LEVEL)
+#define ENET_MP_MAX_LOG_LEVEL ENET_MP_LOG_TRACE
+#endif
+
+/**
+ * Logs a printf style message.
+ *
+ * The arguments are not evaluated if the message is not logged.
+ */
+#define LOG(logger, level, category, ...) \
+    do \
+    { \
+        if((level) <= ENET_MP_MAX_LOG_LEVEL && \
+           is_log_enabled((logger), (level), (category))) \
+            log_message((logger), (level), (category), __VA_ARGS__); \
+    } while(0)
+
 typedef enum _ConnectionType
 {
     QUERY_CONNECTION,
@@ -17,10 +46,21 @@ typedef enum _ConnectionType
 typedef enum _InternalChannel
 {
     MESSAGE_CHANNEL,
+    VARIABLE_CHANNEL,
+    SNAPSHOT_CHANNEL,
     INTERNAL_CHANNEL_COUNT
 
 } InternalChannel;
 
+typedef struct _Logger
+{
+    ENetMpLogSink sink;
+    void* user_data;
+    ENetMpLogLevel level;
+    int categories;
+
+} Logger;
+
 typedef void (*ConnectHandler)( void* context,
                                 ENetPeer* peer,
                                 ConnectionType connection_type );
@@ -40,56 +80,223 @@ typedef enum _MessageType
 
 } MessageType;
 
-typedef struct _MessageHeader
-{
-    enet_uint8 type;
+// Internal messages start with their type.
+#define MESSAGE_TYPE_BITS 4
 
-} MessageHeader;
+/**
+ * Server information replies contain:
+ *
+ * - varint free client slots
+ * - varint used client slots
+ * - varint size and bytes of the user defined server information
+ *
+ * Client auth requests contain:
+ *
+ * - varint size and bytes of the auth data
+ * - bool whether a session is resumed, followed by:
+ *   - varint client slot
+ *   - 2x32 bits session token
+ *
+ * Client activations contain:
+ *
+ * - bool whether a session was resumed
+ * - bool whether the session can be resumed, followed by:
+ *   - varint client slot
+ *   - 2x32 bits session token
+ */
 
-typedef struct _ServerInformationMessage
+// Identifies a session, which the server issues to each activated client.
+// Zero means no session.
+typedef struct _SessionToken
 {
-    enet_uint8 free_client_slots;
-    enet_uint8 used_client_slots;
+    enet_uint32 words[2];
 
-} ServerInformationMessage;
+} SessionToken;
 
-typedef struct _ClientAuthRequestHeader
+// Connectionless queries are raw datagrams which start with these bytes.
+// A peer id of 0xFFF with all header flags set never starts a valid ENet
+// datagram of this size.
+enum
 {
-    enet_uint8 debug_padding; // TODO: Remove this later on.
-
-} ClientAuthRequestHeader;
-
-typedef struct _ServerAuthResponseMessage
-{
-    enet_uint8 max_clients;
-
-} ServerAuthResponseMessage;
+    QUERY_MAGIC_SIZE = 8
+};
+extern const enet_uint8 QUERY_REQUEST_MAGIC[QUERY_MAGIC_SIZE];
+extern const enet_uint8 QUERY_REPLY_MAGIC[QUERY_MAGIC_SIZE];
 
+// Sent by the game thread to the socket of a network thread, so it stops
+// waiting.
+extern const enet_uint8 WAKEUP_MAGIC[QUERY_MAGIC_SIZE];
 
 // TODO: Remove copy_string as its not used anymore.
 bool copy_string( const char* source, char* destination, int destination_size );
 
 bool is_in_bounds( int index, int array_size );
 
+/**
+ * Writes the value with 7 bits per byte, least significant group first.
+ *
+ * @return
+ * Number of bytes written; at most #MAX_VARINT_SIZE.
+ */
+int write_varint( enet_uint32 value, char* destination );
+
+/**
+ * @return
+ * Number of bytes read or 0 if the varint is truncated or too long.
+ */
+int read_varint( const char* source, int size, enet_uint32* value );
+
 const char* disconnect_reason_as_string( ENetMpDisconnectReason reason );
 
+/**
+ * Fills the destination with bytes of the system's secure random number
+ * generator.
+ *
+ * @return
+ * Whether it succeeded.
+ */
+bool get_random_bytes( void* destination, int size );
+
+bool is_session_token_set( const SessionToken* token );
+
+void write_session( ENetMpBitWriter* writer,
+                    int client_slot,
+                    const SessionToken* token );
+
+/**
+ * @return
+ * The client slot or -1 on errors.
+ */
+int read_session( ENetMpBitReader* reader, SessionToken* token );
+
+void logger_init( Logger* logger, const ENetMpLogConfiguration* config );
+
+static inline bool is_log_enabled( const Logger* logger,
+                                   ENetMpLogLevel level,
+                                   ENetMpLogCategory category )
+{
+    return level <= logger->level &&
+           (logger->categories & category) != 0;
+}
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 4, 5)))
+#endif
+void log_message( const Logger* logger,
+                  ENetMpLogLevel level,
+                  ENetMpLogCategory category,
+                  const char* format,
+                  ... );
+
+/**
+ * Context passed to the #host_service or #host_service_all call which is
+ * currently running on this thread or `NULL`.
+ *
+ * Allows ENet's intercept callback, which has no user data, to find its
+ * server.
+ */
+void* get_service_context( void );
+
+/**
+ * For threads which call `enet_host_service` themselves.
+ */
+void set_service_context( void* context );
+
+/**
+ * Passes the event to its handler and destroys received packets which
+ * have not been retained.
+ */
+void dispatch_event( ENetEvent* event,
+                     const Logger* logger,
+                     void* context,
+                     ConnectHandler connect_handler,
+                     DisconnectHandler disconnect_handler,
+                     ReceiveHandler receive_handler );
+
 void host_service( ENetHost* host,
                    int timeout,
+                   const Logger* logger,
                    void* context,
                    ConnectHandler connect_handler,
                    DisconnectHandler disconnect_handler,
                    ReceiveHandler receive_handler );
 
+/**
+ * Handles all pending events.
+ *
+ * Packets queued by the handlers are not flushed, so the caller can send
+ * them all at once with `enet_host_flush` after its own work is done.
+ *
+ * @param max_events
+ * Maximum number of events handled in this call or 0 for no limit.
+ *
+ * @param time_budget
+ * Stop handling events after this many milliseconds or 0 for no limit.
+ *
+ * @return
+ * Number of handled events.
+ */
+int host_service_all( ENetHost* host,
+                      int timeout,
+                      int max_events,
+                      int time_budget,
+                      const Logger* logger,
+                      void* context,
+                      ConnectHandler connect_handler,
+                      DisconnectHandler disconnect_handler,
+                      ReceiveHandler receive_handler );
+
+/**
+ * Handles everything which is due without waiting.  Reads datagrams until
+ * the socket is drained, as edge triggered event loops require.
+ *
+ * @return
+ * Number of handled events.
+ */
+int host_process( ENetHost* host,
+                  const Logger* logger,
+                  void* context,
+                  ConnectHandler connect_handler,
+                  DisconnectHandler disconnect_handler,
+                  ReceiveHandler receive_handler );
+
+/**
+ * Whether the peer is still connected with the given connect ID, i.e. has
+ * not been reset or reused by another connection.
+ */
+bool is_peer_current( const ENetPeer* peer, enet_uint32 connect_id );
+
+/**
+ * Milliseconds until ENet has to resend, ping or throttle, but at most
+ * `max_timeout`.  Zero if any peer has something to send.
+ *
+ * Only the oldest unacknowledged command of each peer is considered, so
+ * resends of later commands with shorter timeouts may be a little late.
+ */
+int get_host_timeout( const ENetHost* host, int max_timeout );
+
+/**
+ * Smaller of a timeout and the milliseconds until the deadline.
+ */
+int limit_timeout( int timeout, enet_uint32 deadline, enet_uint32 time );
+
 enet_uint8 get_internal_channel( InternalChannel channel, int user_channel_count );
 
-char* send_internal_message( ENetPeer* peer,
-                             MessageType type,
-                             int size,
-                             int user_channel_count );
+void write_message_type( ENetMpBitWriter* writer, MessageType type );
 
-const char* read_internal_message( const ENetPacket* packet,
-                                   MessageType* type,
-                                   int* size );
+MessageType read_message_type( ENetMpBitReader* reader );
+
+/**
+ * Acquires a reliable packet of at most `max_size` bytes and writes the
+ * message type.  The writer is finished by #send_internal_message.
+ */
+void begin_internal_message( ENetMpBitWriter* writer,
+                             PacketPool* pool,
+                             MessageType type,
+                             int max_size );
 
+void send_internal_message( ENetMpBitWriter* writer,
+                            ENetPeer* peer,
+                            int user_channel_count );
 
 #endif
@@ -0,0 +1,169 @@
+#include <assert.h>
+#include <stdlib.h> // realloc, free
+#include <string.h> // memset, memcpy
+#include "enet_mp.h"
+#include "enet_mp_shared.h"
+#include "enet_mp_snapshot.h"
+
+
+// Zero runs shorter than this are cheaper to store as literals.
+static const int MIN_ZERO_RUN = 3;
+
+void snapshot_ring_init( SnapshotRing* ring )
+{
+    memset(ring, 0, sizeof(SnapshotRing));
+}
+
+void snapshot_ring_destroy( SnapshotRing* ring )
+{
+    int i = 0;
+    for(; i < SNAPSHOT_RING_SIZE; i++)
+        free(ring->snapshots[i].data);
+    memset(ring, 0, sizeof(SnapshotRing));
+}
+
+Snapshot* snapshot_ring_store( SnapshotRing* ring,
+                               enet_uint32 sequence,
+                               const char* data,
+                               int size )
+{
+    assert(sequence != 0);
+    Snapshot* snapshot = &ring->snapshots[sequence % SNAPSHOT_RING_SIZE];
+    if(snapshot->capacity < size)
+    {
+        snapshot->data = (char*)realloc(snapshot->data, size);
+        snapshot->capacity = size;
+    }
+    snapshot->sequence = sequence;
+    snapshot->size = size;
+    if(data)
+        memcpy(snapshot->data, data, size);
+    ring->last_sequence = sequence;
+    return snapshot;
+}
+
+const Snapshot* snapshot_ring_find( const SnapshotRing* ring, enet_uint32 sequence )
+{
+    if(sequence == 0)
+        return NULL;
+    const Snapshot* snapshot = &ring->snapshots[sequence % SNAPSHOT_RING_SIZE];
+    if(snapshot->sequence == sequence)
+        return snapshot;
+    return NULL;
+}
+
+int get_max_snapshot_delta_size( int size )
+{
+    // Every literal run is followed by at least MIN_ZERO_RUN zero bytes,
+    // which pay for the run headers.  Only the first pair is not covered.
+    return size + size/2 + 2*MAX_VARINT_SIZE;
+}
+
+static char get_delta_byte( const char* baseline,
+                            int baseline_size,
+                            const char* data,
+                            int index )
+{
+    if(index < baseline_size)
+        return data[index] ^ baseline[index];
+    else
+        return data[index];
+}
+
+static int get_zero_run_length( const char* baseline,
+                                int baseline_size,
+                                const char* data,
+                                int size,
+                                int start )
+{
+    int i = start;
+    while(i < size && get_delta_byte(baseline, baseline_size, data, i) == 0)
+        i++;
+    return i - start;
+}
+
+int encode_snapshot_delta( const char* baseline,
+                           int baseline_size,
+                           const char* data,
+                           int size,
+                           char* destination )
+{
+    char* start = destination;
+    int i = 0;
+    while(i < size)
+    {
+        const int zero_run = get_zero_run_length(baseline, baseline_size, data, size, i);
+        if(i + zero_run == size)
+            break; // Trailing zeros are implied.
+
+        // The literal run ends at the next zero run which is long enough.
+        int literal_end = i + zero_run;
+        while(literal_end < size)
+        {
+            const int next_zero_run = get_zero_run_length(baseline,
+                                                          baseline_size,
+                                                          data,
+                                                          size,
+                                                          literal_end);
+            if(next_zero_run >= MIN_ZERO_RUN ||
+               literal_end + next_zero_run == size)
+                break;
+            literal_end += next_zero_run + 1;
+        }
+        if(literal_end > size)
+            literal_end = size;
+
+        const int literal_size = literal_end - (i + zero_run);
+        destination += write_varint((enet_uint32)zero_run, destination);
+        destination += write_varint((enet_uint32)literal_size, destination);
+
+        int j = i + zero_run;
+        for(; j < literal_end; j++)
+            *destination++ = get_delta_byte(baseline, baseline_size, data, j);
+
+        i = literal_end;
+    }
+    return (int)(destination - start);
+}
+
+bool decode_snapshot_delta( const char* baseline,
+                            int baseline_size,
+                            const char* delta,
+                            int delta_size,
+                            char* destination,
+                            int size )
+{
+    // Start with the baseline, which is what an empty delta decodes to.
+    const int copy_size = baseline_size < size ? baseline_size : size;
+    memcpy(destination, baseline, copy_size);
+    memset(&destination[copy_size], 0, size - copy_size);
+
+    const char* end = delta + delta_size;
+    int position = 0;
+    while(delta < end)
+    {
+        enet_uint32 zero_run;
+        enet_uint32 literal_size;
+        int length = read_varint(delta, (int)(end - delta), &zero_run);
+        if(length == 0)
+            return false;
+        delta += length;
+        length = read_varint(delta, (int)(end - delta), &literal_size);
+        if(length == 0)
+            return false;
+        delta += length;
+
+        if(zero_run > (enet_uint32)(size - position))
+            return false;
+        position += (int)zero_run;
+
+        if(literal_size > (enet_uint32)(size - position) ||
+           literal_size > (enet_uint32)(end - delta))
+            return false;
+
+        const int literal_end = position + (int)literal_size;
+        for(; position < literal_end; position++)
+            destination[position] ^= *delta++;
+    }
+    return true;
+}
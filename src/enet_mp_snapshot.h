@@ -0,0 +1,112 @@
+#ifndef __ENET_MP_SNAPSHOT_H__
+#define __ENET_MP_SNAPSHOT_H__
+
+#include <stdbool.h>
+#include <enet/enet.h>
+
+
+enum
+{
+    SNAPSHOT_RING_SIZE = 32,
+    MAX_SNAPSHOT_SIZE = 16*1024*1024
+};
+
+typedef struct _Snapshot
+{
+    enet_uint32 sequence; // 0 if unused.
+    int size;
+    int capacity;
+    char* data;
+
+} Snapshot;
+
+/**
+ * Stores the most recent snapshots, so they can be used as delta baselines.
+ */
+typedef struct _SnapshotRing
+{
+    Snapshot snapshots[SNAPSHOT_RING_SIZE];
+    enet_uint32 last_sequence;
+    enet_uint32 acked_sequence; // 0 if no snapshot has been acknowledged yet.
+
+} SnapshotRing;
+
+/**
+ * Header of snapshot packets.  The delta encoded data follows.
+ */
+typedef struct _SnapshotHeader
+{
+    enet_uint32 sequence;
+    enet_uint32 baseline_sequence; // 0 if the snapshot is not delta encoded.
+    enet_uint32 size; // Decoded size.
+
+} SnapshotHeader;
+
+/**
+ * Sent by clients to acknowledge a snapshot.
+ */
+typedef struct _SnapshotAck
+{
+    enet_uint32 sequence;
+
+} SnapshotAck;
+
+
+void snapshot_ring_init( SnapshotRing* ring );
+
+void snapshot_ring_destroy( SnapshotRing* ring );
+
+/**
+ * Stores a copy of the data, replacing the oldest snapshot.
+ */
+Snapshot* snapshot_ring_store( SnapshotRing* ring,
+                               enet_uint32 sequence,
+                               const char* data,
+                               int size );
+
+/**
+ * @return
+ * The snapshot or `NULL` if it has been replaced already.
+ */
+const Snapshot* snapshot_ring_find( const SnapshotRing* ring, enet_uint32 sequence );
+
+/**
+ * Upper bound for the size of delta encoded data.
+ */
+int get_max_snapshot_delta_size( int size );
+
+/**
+ * XORs the data with the baseline and run length encodes the zero bytes.
+ *
+ * Baseline bytes past `baseline_size` are treated as zero.
+ *
+ * @param destination
+ * Must hold at least #get_max_snapshot_delta_size bytes.
+ *
+ * @return
+ * Number of bytes written.
+ */
+int encode_snapshot_delta( const char* baseline,
+                           int baseline_size,
+                           const char* data,
+                           int size,
+                           char* destination );
+
+/**
+ * Reverses #encode_snapshot_delta.
+ *
+ * @param destination
+ * Receives exactly `size` bytes.
+ *
+ * @return
+ * `false` if the delta is malformed.
+ */
+bool decode_snapshot_delta( const char* baseline,
+                            int baseline_size,
+                            const char* delta,
+                            int delta_size,
+                            char* destination,
+                            int size );
+
+
+#endif
@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <stdlib.h> // malloc, free
+#include "enet_mp_thread.h"
+
+#if !defined(_WIN32)
+#include <sched.h> // sched_yield
+#include <time.h> // nanosleep
+#endif
+
+
+typedef struct _ThreadStart
+{
+    ThreadFunction function;
+    void* context;
+
+} ThreadStart;
+
+#if defined(_WIN32)
+static DWORD WINAPI run_thread( LPVOID argument )
+#else
+static void* run_thread( void* argument )
+#endif
+{
+    ThreadStart start = *(ThreadStart*)argument;
+    free(argument);
+    start.function(start.context);
+    return 0;
+}
+
+bool thread_start( Thread* thread, ThreadFunction function, void* context )
+{
+    ThreadStart* start = (ThreadStart*)malloc(sizeof(ThreadStart));
+    start->function = function;
+    start->context = context;
+#if defined(_WIN32)
+    *thread = CreateThread(NULL, 0, run_thread, start, 0, NULL);
+    if(*thread == NULL)
+#else
+    if(pthread_create(thread, NULL, run_thread, start) != 0)
+#endif
+    {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void thread_join( Thread* thread )
+{
+#if defined(_WIN32)
+    WaitForSingleObject(*thread, INFINITE);
+    CloseHandle(*thread);
+#else
+    pthread_join(*thread, NULL);
+#endif
+}
+
+void thread_yield( void )
+{
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+void thread_sleep( int milliseconds )
+{
+    assert(milliseconds >= 0);
+#if defined(_WIN32)
+    Sleep(milliseconds);
+#else
+    struct timespec duration;
+    duration.tv_sec = milliseconds / 1000;
+    duration.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+    nanosleep(&duration, NULL);
+#endif
+}
+
+void mutex_init( Mutex* mutex )
+{
+#if defined(_WIN32)
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void mutex_destroy( Mutex* mutex )
+{
+#if defined(_WIN32)
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+void mutex_lock( Mutex* mutex )
+{
+#if defined(_WIN32)
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void mutex_unlock( Mutex* mutex )
+{
+#if defined(_WIN32)
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
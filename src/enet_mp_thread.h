@@ -0,0 +1,44 @@
+#ifndef __ENET_MP_THREAD_H__
+#define __ENET_MP_THREAD_H__
+
+#include <stdbool.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+
+#if defined(_WIN32)
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+#else
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+#endif
+
+typedef void (*ThreadFunction)( void* context );
+
+
+bool thread_start( Thread* thread, ThreadFunction function, void* context );
+
+void thread_join( Thread* thread );
+
+/**
+ * Lets other threads run.
+ */
+void thread_yield( void );
+
+void thread_sleep( int milliseconds );
+
+void mutex_init( Mutex* mutex );
+
+void mutex_destroy( Mutex* mutex );
+
+void mutex_lock( Mutex* mutex );
+
+void mutex_unlock( Mutex* mutex );
+
+
+#endif
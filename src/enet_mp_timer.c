@@ -0,0 +1,218 @@
+#include <assert.h>
+#include <stdlib.h> // malloc, free
+#include "enet_mp_timer.h"
+
+
+static void unlink_timer( Timer* timer )
+{
+    timer->previous->next = timer->next;
+    timer->next->previous = timer->previous;
+    timer->next = NULL;
+    timer->previous = NULL;
+}
+
+static void link_timer( Timer* list, Timer* timer )
+{
+    timer->next = list->next;
+    timer->previous = list;
+    list->next->previous = timer;
+    list->next = timer;
+}
+
+static void init_list( Timer* list )
+{
+    list->next = list;
+    list->previous = list;
+}
+
+static Timer* get_bucket( TimerWheel* wheel, enet_uint32 time )
+{
+    const enet_uint32 tick = time / wheel->resolution;
+    return &wheel->buckets[tick & (enet_uint32)(wheel->bucket_count-1)];
+}
+
+void timer_init( Timer* timer, TimerCallback callback, void* context )
+{
+    timer->next = NULL;
+    timer->previous = NULL;
+    timer->deadline = 0;
+    timer->callback = callback;
+    timer->context = context;
+}
+
+bool timer_is_scheduled( const Timer* timer )
+{
+    return timer->next != NULL;
+}
+
+void timer_wheel_init( TimerWheel* wheel,
+                       int bucket_count,
+                       enet_uint32 resolution,
+                       enet_uint32 current_time )
+{
+    assert(bucket_count > 0);
+    assert(resolution > 0);
+
+    int rounded_bucket_count = 1;
+    while(rounded_bucket_count < bucket_count)
+        rounded_bucket_count *= 2;
+
+    wheel->buckets = (Timer*)malloc(rounded_bucket_count * sizeof(Timer));
+    wheel->bucket_count = rounded_bucket_count;
+    wheel->resolution = resolution;
+    wheel->current_time = current_time;
+    wheel->timer_count = 0;
+    wheel->next_deadline_known = false;
+
+    int i = 0;
+    for(; i < rounded_bucket_count; i++)
+        init_list(&wheel->buckets[i]);
+}
+
+void timer_wheel_destroy( TimerWheel* wheel )
+{
+    int i = 0;
+    for(; i < wheel->bucket_count; i++)
+    {
+        Timer* list = &wheel->buckets[i];
+        while(list->next != list)
+            unlink_timer(list->next);
+    }
+    free(wheel->buckets);
+    wheel->buckets = NULL;
+    wheel->timer_count = 0;
+}
+
+void timer_wheel_schedule( TimerWheel* wheel, Timer* timer, enet_uint32 deadline )
+{
+    timer_wheel_cancel(wheel, timer);
+
+    timer->deadline = deadline;
+
+    // Overdue timers go into the current bucket, which is visited next.
+    const enet_uint32 bucket_time =
+        ENET_TIME_LESS(deadline, wheel->current_time) ? wheel->current_time
+                                                      : deadline;
+    link_timer(get_bucket(wheel, bucket_time), timer);
+    wheel->timer_count++;
+
+    if(wheel->timer_count == 1)
+    {
+        wheel->next_deadline = deadline;
+        wheel->next_deadline_known = true;
+    }
+    else if(wheel->next_deadline_known &&
+            ENET_TIME_LESS(deadline, wheel->next_deadline))
+    {
+        wheel->next_deadline = deadline;
+    }
+}
+
+void timer_wheel_cancel( TimerWheel* wheel, Timer* timer )
+{
+    if(timer_is_scheduled(timer))
+    {
+        unlink_timer(timer);
+        wheel->timer_count--;
+        assert(wheel->timer_count >= 0);
+        if(timer->deadline == wheel->next_deadline)
+            wheel->next_deadline_known = false;
+    }
+}
+
+// Buckets are visited in time order from the current time.  The first
+// bucket which holds a timer that is due within its time span has the
+// earliest deadline, since overdue timers are kept in the current bucket.
+// Only timers which are more than a revolution ahead need the full scan.
+static enet_uint32 find_next_deadline( TimerWheel* wheel )
+{
+    bool found = false;
+    enet_uint32 earliest = 0;
+    enet_uint32 i = 0;
+    for(; i < (enet_uint32)wheel->bucket_count; i++)
+    {
+        const enet_uint32 bucket_time = wheel->current_time + i*wheel->resolution;
+        const enet_uint32 bucket_end = (bucket_time / wheel->resolution + 1) * wheel->resolution;
+        const Timer* list = get_bucket(wheel, bucket_time);
+        const Timer* timer = list->next;
+        bool due = false;
+        for(; timer != list; timer = timer->next)
+        {
+            if(!found || ENET_TIME_LESS(timer->deadline, earliest))
+                earliest = timer->deadline;
+            found = true;
+            due = due || ENET_TIME_LESS(timer->deadline, bucket_end);
+        }
+        if(due)
+            break;
+    }
+    assert(found);
+    return earliest;
+}
+
+bool timer_wheel_get_next_deadline( TimerWheel* wheel, enet_uint32* deadline )
+{
+    if(wheel->timer_count == 0)
+        return false;
+
+    if(!wheel->next_deadline_known)
+    {
+        wheel->next_deadline = find_next_deadline(wheel);
+        wheel->next_deadline_known = true;
+    }
+    *deadline = wheel->next_deadline;
+    return true;
+}
+
+int timer_wheel_advance( TimerWheel* wheel, enet_uint32 current_time )
+{
+    const enet_uint32 previous_time = wheel->current_time;
+    wheel->current_time = current_time;
+
+    if(wheel->timer_count == 0)
+        return 0;
+
+    // Visit every bucket between the previous and the current time
+    // (both inclusive), but each bucket at most once.
+    enet_uint32 steps = current_time / wheel->resolution -
+                        previous_time / wheel->resolution + 1;
+    if(steps > (enet_uint32)wheel->bucket_count)
+        steps = (enet_uint32)wheel->bucket_count;
+
+    // Expired timers are collected first, so callbacks can safely
+    // reschedule timers into the buckets which are being visited.
+    Timer expired;
+    init_list(&expired);
+
+    enet_uint32 i = 0;
+    for(; i < steps; i++)
+    {
+        Timer* list = get_bucket(wheel, previous_time + i*wheel->resolution);
+        Timer* timer = list->next;
+        while(timer != list)
+        {
+            Timer* next = timer->next;
+            if(ENET_TIME_LESS_EQUAL(timer->deadline, current_time))
+            {
+                unlink_timer(timer);
+                link_timer(&expired, timer);
+            }
+            timer = next;
+        }
+    }
+
+    // Callbacks may schedule timers, which then update the deadline again.
+    if(expired.next != &expired)
+        wheel->next_deadline_known = false;
+
+    int fired_count = 0;
+    while(expired.next != &expired)
+    {
+        Timer* timer = expired.next;
+        unlink_timer(timer);
+        wheel->timer_count--;
+        fired_count++;
+        timer->callback(timer->context, timer);
+    }
+    return fired_count;
+}
@@ -0,0 +1,106 @@
+#ifndef __ENET_MP_TIMER_H__
+#define __ENET_MP_TIMER_H__
+
+#include <stddef.h> // offsetof
+#include <stdbool.h>
+#include <enet/enet.h>
+
+
+/**
+ * Retrieves the structure which embeds the given member.
+ */
+#define CONTAINER_OF(pointer, type, member) \
+    ((type*)((char*)(pointer) - offsetof(type, member)))
+
+typedef struct _Timer Timer;
+
+typedef void (*TimerCallback)( void* context, Timer* timer );
+
+/**
+ * Intrusive timer which is meant to be embedded into other structures.
+ *
+ * A timer fires once; it must be scheduled again to fire another time.
+ */
+struct _Timer
+{
+    Timer* next;
+    Timer* previous;
+    enet_uint32 deadline;
+    TimerCallback callback;
+    void* context;
+};
+
+/**
+ * Hashed timer wheel.
+ *
+ * Timers are hashed by their deadline into buckets which each cover
+ * `resolution` milliseconds.  Advancing the wheel only visits the buckets
+ * that elapsed since the last call, so the cost depends on the number of
+ * expiring timers and not on the number of scheduled ones.
+ */
+typedef struct _TimerWheel
+{
+    Timer* buckets; // Sentinel nodes of the circular bucket lists.
+    int bucket_count; // Always a power of two.
+    enet_uint32 resolution;
+    enet_uint32 current_time; // Time up to which the wheel has been advanced.
+    int timer_count;
+    enet_uint32 next_deadline; // Earliest deadline, if known.
+    bool next_deadline_known;
+} TimerWheel;
+
+
+void timer_init( Timer* timer, TimerCallback callback, void* context );
+
+bool timer_is_scheduled( const Timer* timer );
+
+/**
+ * @param bucket_count
+ * Is rounded up to the next power of two.
+ *
+ * @param resolution
+ * Milliseconds covered by each bucket.
+ */
+void timer_wheel_init( TimerWheel* wheel,
+                       int bucket_count,
+                       enet_uint32 resolution,
+                       enet_uint32 current_time );
+
+/**
+ * Unschedules all timers without firing them.
+ */
+void timer_wheel_destroy( TimerWheel* wheel );
+
+/**
+ * (Re)schedules the timer.  Deadlines in the past fire on the next advance.
+ */
+void timer_wheel_schedule( TimerWheel* wheel, Timer* timer, enet_uint32 deadline );
+
+/**
+ * Does nothing if the timer is not scheduled.
+ */
+void timer_wheel_cancel( TimerWheel* wheel, Timer* timer );
+
+/**
+ * Finds the earliest deadline.  It's tracked while timers are scheduled
+ * and only searched for after the earliest timer fired or was cancelled.
+ * The search visits buckets in time order and stops at the first one
+ * which is due, so it's usually short.
+ *
+ * @return
+ * Whether any timer is scheduled.
+ */
+bool timer_wheel_get_next_deadline( TimerWheel* wheel, enet_uint32* deadline );
+
+/**
+ * Fires all timers whose deadline is not after `current_time`.
+ *
+ * Callbacks may schedule or cancel any timer.
+ *
+ * @return
+ * Number of fired timers.
+ */
+int timer_wheel_advance( TimerWheel* wheel, enet_uint32 current_time );
+
+
+#endif
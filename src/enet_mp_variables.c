@@ -0,0 +1,218 @@
+#include <assert.h>
+#include <stdlib.h> // realloc, free
+#include <string.h> // memcpy, memcmp
+#include "enet_mp.h"
+#include "enet_mp_shared.h"
+#include "enet_mp_variables.h"
+
+
+static const int MAX_VARIABLE_COUNT = 0xFFFF;
+static const int VARIABLE_ID_SIZE = sizeof(enet_uint16);
+
+static int get_type_size( ENetMpVariableType type, int blob_size )
+{
+    switch(type)
+    {
+        case ENET_MP_VARIABLE_INT8: return 1;
+        case ENET_MP_VARIABLE_INT16: return 2;
+        case ENET_MP_VARIABLE_INT32: return 4;
+        case ENET_MP_VARIABLE_FLOAT: return 4;
+        case ENET_MP_VARIABLE_BLOB: return blob_size;
+        default: assert(!"Unknown variable type!"); return 0;
+    }
+}
+
+// Byte order conversion is its own inverse, so it is used for both directions.
+static void convert_byte_order( ENetMpVariableType type,
+                                const char* source,
+                                char* destination,
+                                int size )
+{
+    switch(type)
+    {
+        case ENET_MP_VARIABLE_INT16:
+        {
+            enet_uint16 value;
+            memcpy(&value, source, sizeof(value));
+            value = ENET_HOST_TO_NET_16(value);
+            memcpy(destination, &value, sizeof(value));
+            break;
+        }
+
+        case ENET_MP_VARIABLE_INT32:
+        case ENET_MP_VARIABLE_FLOAT:
+        {
+            enet_uint32 value;
+            memcpy(&value, source, sizeof(value));
+            value = ENET_HOST_TO_NET_32(value);
+            memcpy(destination, &value, sizeof(value));
+            break;
+        }
+
+        default:
+            memcpy(destination, source, size);
+    }
+}
+
+void variable_registry_init( VariableRegistry* registry )
+{
+    memset(registry, 0, sizeof(VariableRegistry));
+    bitset_init(&registry->dirty_variables, 0);
+}
+
+void variable_registry_destroy( VariableRegistry* registry )
+{
+    bitset_destroy(&registry->dirty_variables);
+    free(registry->variables);
+    free(registry->values);
+}
+
+int variable_registry_add( VariableRegistry* registry,
+                           ENetMpVariableType type,
+                           int size )
+{
+    if(registry->variable_count >= MAX_VARIABLE_COUNT)
+        return -1;
+
+    size = get_type_size(type, size);
+    assert(size > 0);
+
+    if(registry->variable_count == registry->variable_capacity)
+    {
+        registry->variable_capacity = registry->variable_capacity*2 + 8;
+        registry->variables = (Variable*)realloc(registry->variables,
+            registry->variable_capacity * sizeof(Variable));
+    }
+
+    if(registry->values_size + size > registry->values_capacity)
+    {
+        registry->values_capacity = (registry->values_size + size)*2;
+        registry->values = (char*)realloc(registry->values,
+                                          registry->values_capacity);
+    }
+
+    const int id = registry->variable_count;
+    Variable* variable = &registry->variables[id];
+    variable->type = type;
+    variable->size = size;
+    variable->offset = registry->values_size;
+    memset(&registry->values[variable->offset], 0, size);
+
+    registry->variable_count++;
+    registry->values_size += size;
+    bitset_resize(&registry->dirty_variables, registry->variable_count);
+    return id;
+}
+
+void variable_registry_set( VariableRegistry* registry,
+                            int variable,
+                            const void* value )
+{
+    assert(is_in_bounds(variable, registry->variable_count));
+    const Variable* v = &registry->variables[variable];
+    char* target = &registry->values[v->offset];
+    if(memcmp(target, value, v->size) != 0)
+    {
+        memcpy(target, value, v->size);
+        bitset_set(&registry->dirty_variables, variable);
+    }
+}
+
+const void* variable_registry_get( const VariableRegistry* registry,
+                                   int variable )
+{
+    assert(is_in_bounds(variable, registry->variable_count));
+    return &registry->values[registry->variables[variable].offset];
+}
+
+bool variable_registry_has_changes( const VariableRegistry* registry )
+{
+    return registry->dirty_variables.set_count > 0;
+}
+
+void variable_registry_clear_changes( VariableRegistry* registry )
+{
+    bitset_clear_all(&registry->dirty_variables);
+}
+
+int variable_registry_get_encoded_size( const VariableRegistry* registry,
+                                        bool changes_only )
+{
+    if(!changes_only)
+        return registry->variable_count*VARIABLE_ID_SIZE + registry->values_size;
+
+    int size = 0;
+    int i = bitset_find_first_set(&registry->dirty_variables, 0);
+    for(; i >= 0; i = bitset_find_first_set(&registry->dirty_variables, i+1))
+        size += VARIABLE_ID_SIZE + registry->variables[i].size;
+    return size;
+}
+
+static char* encode_variable( const VariableRegistry* registry,
+                              int variable,
+                              char* destination )
+{
+    const Variable* v = &registry->variables[variable];
+    const enet_uint16 id = ENET_HOST_TO_NET_16((enet_uint16)variable);
+    memcpy(destination, &id, VARIABLE_ID_SIZE);
+    destination += VARIABLE_ID_SIZE;
+    convert_byte_order(v->type,
+                       &registry->values[v->offset],
+                       destination,
+                       v->size);
+    return destination + v->size;
+}
+
+void variable_registry_encode( const VariableRegistry* registry,
+                               bool changes_only,
+                               char* destination )
+{
+    if(changes_only)
+    {
+        int i = bitset_find_first_set(&registry->dirty_variables, 0);
+        for(; i >= 0; i = bitset_find_first_set(&registry->dirty_variables, i+1))
+            destination = encode_variable(registry, i, destination);
+    }
+    else
+    {
+        int i = 0;
+        for(; i < registry->variable_count; i++)
+            destination = encode_variable(registry, i, destination);
+    }
+}
+
+bool variable_registry_decode( VariableRegistry* registry,
+                               const char* data,
+                               int size,
+                               VariableChangedHandler changed_handler,
+                               void* context )
+{
+    const char* end = data + size;
+    while(data < end)
+    {
+        if(end - data < VARIABLE_ID_SIZE)
+            return false;
+
+        enet_uint16 id;
+        memcpy(&id, data, VARIABLE_ID_SIZE);
+        id = ENET_NET_TO_HOST_16(id);
+        data += VARIABLE_ID_SIZE;
+
+        if(!is_in_bounds(id, registry->variable_count))
+            return false;
+
+        const Variable* v = &registry->variables[id];
+        if(end - data < v->size)
+            return false;
+
+        convert_byte_order(v->type,
+                           data,
+                           &registry->values[v->offset],
+                           v->size);
+        data += v->size;
+
+        if(changed_handler)
+            changed_handler(context, id);
+    }
+    return true;
+}
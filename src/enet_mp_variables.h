@@ -0,0 +1,94 @@
+#ifndef __ENET_MP_VARIABLES_H__
+#define __ENET_MP_VARIABLES_H__
+
+#include <stdbool.h>
+#include "enet_mp_bitset.h"
+
+
+typedef struct _Variable
+{
+    ENetMpVariableType type;
+    int size;
+    int offset; // Offset into VariableRegistry::values.
+
+} Variable;
+
+/**
+ * Stores the values of synced variables and tracks which of them changed.
+ *
+ * Values are stored in host byte order and converted when they're written
+ * to or read from a packet.  The wire format is a sequence of
+ * `variable id (16 bit) + value` entries.
+ */
+typedef struct _VariableRegistry
+{
+    Variable* variables;
+    int variable_count;
+    int variable_capacity;
+
+    char* values;
+    int values_size;
+    int values_capacity;
+
+    Bitset dirty_variables;
+
+} VariableRegistry;
+
+typedef void (*VariableChangedHandler)( void* context, int variable );
+
+
+void variable_registry_init( VariableRegistry* registry );
+
+void variable_registry_destroy( VariableRegistry* registry );
+
+/**
+ * @param size
+ * Only used for #ENET_MP_VARIABLE_BLOB.
+ *
+ * @return
+ * Id of the new variable or -1 if the registry is full.
+ */
+int variable_registry_add( VariableRegistry* registry,
+                           ENetMpVariableType type,
+                           int size );
+
+/**
+ * Copies the value and marks the variable as dirty if it changed.
+ */
+void variable_registry_set( VariableRegistry* registry,
+                            int variable,
+                            const void* value );
+
+const void* variable_registry_get( const VariableRegistry* registry,
+                                   int variable );
+
+bool variable_registry_has_changes( const VariableRegistry* registry );
+
+void variable_registry_clear_changes( VariableRegistry* registry );
+
+/**
+ * @param changes_only
+ * Whether only dirty variables or all variables are encoded.
+ */
+int variable_registry_get_encoded_size( const VariableRegistry* registry,
+                                        bool changes_only );
+
+void variable_registry_encode( const VariableRegistry* registry,
+                               bool changes_only,
+                               char* destination );
+
+/**
+ * Applies the encoded variables and calls `changed_handler` for each one.
+ *
+ * @return
+ * `false` if the data is malformed.  Variables which were decoded before
+ * the error was detected stay applied.
+ */
+bool variable_registry_decode( VariableRegistry* registry,
+                               const char* data,
+                               int size,
+                               VariableChangedHandler changed_handler,
+                               void* context );
+
+
+#endif